@@ -27,10 +27,15 @@
 #define APNSPUSHER_CLASS_APNS_H
 
 #include <pthread.h>
+#include <time.h>
 
 #include <openframe/openframe.h>
 #include <apns/apns.h>
 
+#include "Payload.h"
+#include "RingQueue.h"
+#include "TlsContext.h"
+
 namespace apnspusher {
 
 /**************************************************************************
@@ -48,40 +53,134 @@ namespace apnspusher {
       static const char *kDefaultKey;
 
       static const char *kDefaultPushHost;
+      static const char *kDefaultSandboxPushHost;
       static const int kDefaultPushPort;
       static const time_t kDefaultPushTimeout;
+      static const time_t kDefaultPushExpiry;
 
       static const char *kDefaultFeedbackHost;
+      static const char *kDefaultSandboxFeedbackHost;
       static const int kDefaultFeedbackPort;
       static const time_t kDefaultFeedbackInterval;
 
-      APNS(const unsigned int num_threads, const bool enable_feedback);
-      virtual ~APNS();
-      APNS &start();
-      void stop();
+      static const char *kDefaultHttp2Host;
+      static const char *kDefaultSandboxHttp2Host;
+      static const int kDefaultHttp2Port;
+      static const size_t kDefaultHttp2Streams;
+
+      static const size_t kDefaultQueueSize;
+      static const int kDefaultIdleWait;
+      static const int kDefaultBusyWait;
 
       /**********************
        ** Type Definitions **
        **********************/
 
-      typedef openframe::ThreadQueue<apns::ApnsMessage *> messages_t;
-      typedef openframe::ThreadQueue<apns::FeedbackMessage *> feedbacks_t;
+      // Apple serves sandbox and production tokens from different
+      // gateways with different certificates, each gets its own pool
+      enum environmentEnum {
+        ENVIRONMENT_SANDBOX	= 0,
+        ENVIRONMENT_PROD	= 1,
+        ENVIRONMENT_MAX	= 2
+      };
+
+      // binary is the legacy gateway protocol via libapns, http2 the
+      // provider API with a status for every notification
+      enum transportEnum {
+        TRANSPORT_BINARY	= 0,
+        TRANSPORT_HTTP2	= 1
+      };
+
+      explicit APNS(const size_t queue_size=kDefaultQueueSize);
+      virtual ~APNS();
+      APNS &start();
+      // the connections first send what is queued, for up to drain
+      // seconds, then hang up
+      void stop(const time_t drain=0);
+
+      // what to send to one device, the payload is shared with every
+      // other device the same message goes to
+      struct notification_t {
+        std::string device_token;
+        Payload payload;
+      }; // notification_t
+
+      // serialize an alert once, before fanning it out
+      static Payload payload(const std::string &text,
+                             const std::string &action,
+                             const int badge);
+
+      // stamped on the way in so the ssl threads can report how long
+      // a message waited before it was written
+      struct queued_message_t {
+        notification_t notification;
+        struct timespec queued_at;
+      }; // queued_message_t
+
+      // a token Apple says is no longer installed
+      struct feedback_t {
+        std::string device_token;
+        time_t timestamp;
+      }; // feedback_t
+
+      typedef RingQueue<queued_message_t> messages_t;
+      typedef openframe::ThreadQueue<feedback_t> feedbacks_t;
       typedef std::set<pthread_t> threadSetType;
 
 
-      APNS &set_cert(const std::string &cert,
+      // a pool without threads drops what is pushed to it
+      APNS &set_pool(const environmentEnum environment,
+                     const unsigned int num_threads,
+                     const bool enable_feedback);
+
+      APNS &set_cert(const environmentEnum environment,
+                     const std::string &cert,
                      const std::string &key);
 
-      APNS &set_push(const std::string &host,
+      APNS &set_push(const environmentEnum environment,
+                     const std::string &host,
                      const int port,
                      const time_t timeout);
 
-      APNS &set_feedback(const std::string &host,
+      APNS &set_feedback(const environmentEnum environment,
+                         const std::string &host,
                          const int port,
                          const time_t interval);
 
-      void push(apns::ApnsMessage *);
+      // topic is the app's bundle id, required when the certificate
+      // covers more than one
+      APNS &set_transport(const transportEnum transport,
+                          const std::string &topic,
+                          const size_t max_streams);
+
+      // binary frames are written a TLS record at a time, or once the
+      // oldest has waited delay milliseconds
+      APNS &set_coalesce(const size_t record_size, const int delay);
+
+      // ask for kernel TLS on every push connection, used where the
+      // kernel and OpenSSL support it
+      APNS &set_ktls(const bool ktls);
+
+      APNS &set_http2(const environmentEnum environment,
+                      const std::string &host,
+                      const int port);
+
+      static const char *environment_str(const environmentEnum environment);
+
+      // false when the notification was dropped
+      bool push(const notification_t &notification, const environmentEnum environment);
+      // tokens reported by the feedback service or answered 410
+      bool next_feedback(feedback_t &ret) { return _feedback_q.dequeue(ret); }
+
+      // messages not yet written to Apple, waiting in every pool's queue
+      // or taken off it by a connection
+      size_t backlog() const;
+      // running total of messages written to the binary gateway or
+      // answered over HTTP/2, the rate it grows at is the rate Apple
+      // accepts them
+      unsigned long long drained() const { return __atomic_load_n(&_drained, __ATOMIC_RELAXED); }
       static void *SslThread(void *);
+      static void *Http2Thread(void *);
       static void *FeedbackThread(void *);
 
       void set_done() {
@@ -94,21 +193,43 @@ namespace apnspusher {
         return _done;
       } // is_done
 
+      // a connection stops once it is idle, or the drain ran out
+      bool is_stopped(const bool idle) {
+        openframe::scoped_lock slock(&_done_l);
+        return _done && (idle || time(NULL) >= _drain_by);
+      } // is_stopped
+
       openframe::Stopwatch profile;
 
     protected:
     private:
-      unsigned int _num_threads;
-      bool _enable_feedback;
+      struct pool_t {
+        unsigned int num_threads;
+        bool enable_feedback;
+        messages_t *message_q;
+        int wakeup_fd;				// eventfd, written by push() and stop()
+        TlsContext *tls;			// shared by the pool's connections
+      }; // pool_t
+
+      void signal(pool_t &pool);
+      std::string key(const environmentEnum environment, const std::string &name) const {
+        return std::string(environment_str(environment)) + "." + name;
+      } // key
+
+      pool_t _pools[ENVIRONMENT_MAX];
 
       bool _done;
+      time_t _drain_by;
       openframe::OFLock _done_l;
 
       openframe::ConfController *_cfg;
+      transportEnum _transport;
+      bool _ktls;
+      unsigned long long _taken;			// off the queues by a connection
+      unsigned long long _drained;
 
       threadSetType _sslThreads;			// ssl thread ids
 
-      messages_t _message_q;
       feedbacks_t _feedback_q;
   }; // APNS
 
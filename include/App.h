@@ -8,6 +8,13 @@
 #include <openframe/App/Server.h>
 #include <stomp/StompStats.h>
 
+#include "APNS.h"
+#include "Pipeline.h"
+#include "RegisterCache.h"
+#include "RegisterFilter.h"
+#include "RegisterFlight.h"
+#include "RegisterIndex.h"
+
 namespace apnspusher {
 /**************************************************************************
  ** General Defines                                                      **
@@ -51,6 +58,20 @@ namespace apnspusher {
       typedef workers_t::size_type workers_st;
 
       static const char *kPidFile;
+      static const size_t kDefaultLookupQueueSize;
+      static const size_t kDefaultPushQueueSize;
+      static const size_t kDefaultRecordQueueSize;
+      static const time_t kDefaultDrainTimeout;
+
+      // the pipeline front to back, shutdown stops each stage only once
+      // the one before it is gone and its queue is empty
+      enum stageEnum {
+        STAGE_RECEIVE			= 0,
+        STAGE_LOOKUP			= 1,
+        STAGE_PUSH			= 2,
+        STAGE_RECORD			= 3,
+        STAGE_MAX			= 4
+      };
 
       App(const std::string &prompt, const std::string &config, const bool console=false);
       virtual ~App();
@@ -77,13 +98,48 @@ namespace apnspusher {
       bool onRun();
 
       static void *WorkerThread(void *arg);
+      static void *ChangeListenerThread(void *arg);
+      static void *ResolverThread(void *arg);
+      static void *PusherThread(void *arg);
+      static void *PushWriterThread(void *arg);
+
+      // stage was told to stop and nothing is left in front of it, or
+      // shutdown gave up on draining
+      bool is_drained(const stageEnum stage);
+      // shutdown ran past app.shutdown.drain, whatever is still queued
+      // is dropped
+      bool is_abandoned() const;
 
       stomp::StompStats *stats() { return _stats; }
+      int wakeup_fd() const { return _wakeup_fd; }
+      lookup_queue_t *lookup_q() { return _lookup_q; }
+      push_queue_t *push_q() { return _push_q; }
+      record_queue_t *record_q() { return _record_q; }
+      APNS *apns() { return _apns; }
+      RegisterCache *register_cache() { return _register_cache; }
+      RegisterFilter *register_filter() { return _register_filter; }
+      RegisterFlight *register_flight() { return _register_flight; }
+      RegisterIndex *register_index() { return _register_index; }
 
     protected:
+      void start_threads(const std::string &name, const int num, void *(*func)(void *), workers_t &threads);
+      void join_threads(workers_t &threads);
+      void init_apns_pool(const APNS::environmentEnum environment);
+
     private:
-      workers_t _workers;
+      workers_t _stages[STAGE_MAX];		// threads by stage
+      bool _stopping[STAGE_MAX];
+      time_t _drain_by;				// 0 until shutdown
       stomp::StompStats *_stats;
+      int _wakeup_fd;				// eventfd signalled on shutdown
+      lookup_queue_t *_lookup_q;			// receive -> lookup stage
+      push_queue_t *_push_q;			// lookup -> push stage
+      record_queue_t *_record_q;			// push stage -> write behind
+      APNS *_apns;				// push service shared by every Pusher
+      RegisterCache *_register_cache;		// shared by every Store
+      RegisterFilter *_register_filter;		// NULL when disabled
+      RegisterFlight *_register_flight;		// SQL lookups shared by every Store
+      RegisterIndex *_register_index;		// NULL when disabled
   }; // App
 
 /**************************************************************************
@@ -0,0 +1,51 @@
+#ifndef APNSPUSHER_BLOOMFILTER_H
+#define APNSPUSHER_BLOOMFILTER_H
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // Plain bloom filter over strings sized from the expected number of
+  // members and the wanted false positive rate.  Not thread safe, build
+  // one and publish it read only.
+  class BloomFilter {
+    public:
+      BloomFilter(const size_t expected, const double fpp);
+      virtual ~BloomFilter();
+
+      void add(const std::string &key);
+      bool contains(const std::string &key) const;
+
+      size_t count() const { return _count; }
+      size_t bytes() const { return _bits.size(); }
+      unsigned int num_hashes() const { return _num_hashes; }
+      double fpr() const;
+
+    private:
+      static void hash(const std::string &key, uint32_t &h1, uint32_t &h2);
+
+      std::vector<unsigned char> _bits;
+      uint64_t _num_bits;
+      unsigned int _num_hashes;
+      size_t _count;
+  }; // class BloomFilter
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
@@ -0,0 +1,164 @@
+#ifndef APNSPUSHER_BOUNDEDQUEUE_H
+#define APNSPUSHER_BOUNDEDQUEUE_H
+
+#include <vector>
+
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // Fixed capacity FIFO shared between pipeline stages.  Items are
+  // copied into preallocated slots, producers block while the queue is
+  // full and consumers block while it is empty, timeouts are in
+  // milliseconds with -1 meaning wait forever.
+  template<typename T>
+  class BoundedQueue {
+    public:
+      typedef std::vector<T> items_t;
+      typedef typename items_t::size_type size_type;
+
+      explicit BoundedQueue(const size_type capacity)
+        : _slots(capacity ? capacity : 1),
+          _head(0),
+          _size(0) {
+        pthread_mutex_init(&_lock, NULL);
+        pthread_cond_init(&_not_empty, NULL);
+        pthread_cond_init(&_not_full, NULL);
+      } // BoundedQueue
+
+      virtual ~BoundedQueue() {
+        pthread_cond_destroy(&_not_full);
+        pthread_cond_destroy(&_not_empty);
+        pthread_mutex_destroy(&_lock);
+      } // ~BoundedQueue
+
+      bool enqueue(const T &item, const int timeout=-1) {
+        struct timespec deadline;
+        make_deadline(timeout, deadline);
+
+        pthread_mutex_lock(&_lock);
+        while(_size == _slots.size()) {
+          if (!wait(&_not_full, timeout, deadline)) {
+            pthread_mutex_unlock(&_lock);
+            return false;
+          } // if
+        } // while
+
+        _slots[(_head + _size) % _slots.size()] = item;
+        ++_size;
+
+        pthread_cond_signal(&_not_empty);
+        pthread_mutex_unlock(&_lock);
+        return true;
+      } // enqueue
+
+      bool dequeue(T &ret, const int timeout=-1) {
+        struct timespec deadline;
+        make_deadline(timeout, deadline);
+
+        pthread_mutex_lock(&_lock);
+        while(_size == 0) {
+          if (!wait(&_not_empty, timeout, deadline)) {
+            pthread_mutex_unlock(&_lock);
+            return false;
+          } // if
+        } // while
+
+        take(ret);
+
+        pthread_cond_signal(&_not_full);
+        pthread_mutex_unlock(&_lock);
+        return true;
+      } // dequeue
+
+      // waits for at least one item then takes up to max without
+      // waiting any further
+      size_type dequeue(items_t &ret, const size_type max, const int timeout=-1) {
+        struct timespec deadline;
+        make_deadline(timeout, deadline);
+
+        pthread_mutex_lock(&_lock);
+        while(_size == 0) {
+          if (!wait(&_not_empty, timeout, deadline)) {
+            pthread_mutex_unlock(&_lock);
+            return 0;
+          } // if
+        } // while
+
+        size_type num = 0;
+        while(_size && num < max) {
+          T item;
+          take(item);
+          ret.push_back(item);
+          ++num;
+        } // while
+
+        pthread_cond_broadcast(&_not_full);
+        pthread_mutex_unlock(&_lock);
+        return num;
+      } // dequeue
+
+      size_type size() {
+        pthread_mutex_lock(&_lock);
+        size_type ret = _size;
+        pthread_mutex_unlock(&_lock);
+        return ret;
+      } // size
+
+      size_type capacity() const { return _slots.size(); }
+
+    private:
+      BoundedQueue(const BoundedQueue &);
+      BoundedQueue &operator=(const BoundedQueue &);
+
+      void take(T &ret) {
+        ret = _slots[_head];
+        _slots[_head] = T();
+        _head = (_head + 1) % _slots.size();
+        --_size;
+      } // take
+
+      static void make_deadline(const int timeout, struct timespec &ts) {
+        if (timeout < 0) return;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += timeout / 1000;
+        ts.tv_nsec += (timeout % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+          ++ts.tv_sec;
+          ts.tv_nsec -= 1000000000L;
+        } // if
+      } // make_deadline
+
+      bool wait(pthread_cond_t *cond, const int timeout, const struct timespec &deadline) {
+        if (timeout < 0) return pthread_cond_wait(cond, &_lock) == 0;
+        if (timeout == 0) return false;
+        return pthread_cond_timedwait(cond, &_lock, &deadline) != ETIMEDOUT;
+      } // wait
+
+      items_t _slots;
+      size_type _head;
+      size_type _size;
+
+      pthread_mutex_t _lock;
+      pthread_cond_t _not_empty;
+      pthread_cond_t _not_full;
+  }; // class BoundedQueue
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
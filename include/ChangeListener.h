@@ -0,0 +1,105 @@
+#ifndef APNSPUSHER_CHANGELISTENER_H
+#define APNSPUSHER_CHANGELISTENER_H
+
+#include <string>
+#include <vector>
+
+#include <openframe/openframe.h>
+#include <openstats/openstats.h>
+#include <stomp/Stomp.h>
+
+#include "EventWait.h"
+#include "MemcachedController.h"
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // Registration changes published on a topic evict the callsigns named
+  // from memcached and from the process wide caches.  It keeps its own
+  // stomp connection and is never throttled, a change read late is a
+  // push sent to a device that's gone or not sent to one just added.
+  class ChangeListener : public openframe::LogObject,
+                         public openstats::StatsClient_Interface {
+    public:
+      // ### Constants ### //
+      static const int kDefaultIdleTimeout;
+      static const char *kDefaultStompDestRegisterChanges;
+
+      // ### Init ### //
+      ChangeListener(const thread_id_t thread_id,
+                     const std::string &stomp_hosts,
+                     const std::string &stomp_login,
+                     const std::string &stomp_passcode,
+                     const std::string &memcached_host);
+      virtual ~ChangeListener();
+      void init();
+      bool run();
+      bool wait(const int timeout=kDefaultIdleTimeout);
+      void try_stats();
+
+      // ### Options ### //
+      // eventfd that becomes readable when the listener should stop
+      // waiting, normally the application shutdown event
+      ChangeListener &set_wakeup(const int fd) {
+        _wakeup_fd = fd;
+        return *this;
+      } // set_wakeup
+
+      // a topic hands every instance its own copy of each change
+      ChangeListener &set_destination(const std::string &destination) {
+        _stomp_dest_changes = destination;
+        return *this;
+      } // set_destination
+
+      // ### StatsClient Pure Virtuals ### //
+      void onDescribeStats();
+      void onDestroyStats();
+
+    protected:
+      void try_stompstats();
+
+      size_t process_change(const std::string &body);
+
+    private:
+      // constructor variables
+      std::string _stomp_hosts;
+      std::string _stomp_login;
+      std::string _stomp_passcode;
+      std::string _memcached_host;
+
+      std::string _stomp_dest_changes;
+      stomp::Stomp *_stomp;
+      MemcachedController *_memcached;
+      bool _connected;
+
+      int _wakeup_fd;
+      EventWait _events;			// stomp socket and wakeup
+
+      struct obj_stats_t {
+        unsigned int connects;
+        unsigned int disconnects;
+        unsigned int changes;
+        unsigned int rejected;
+        unsigned int evicted;
+        time_t report_interval;
+        time_t last_report_at;
+        time_t created_at;
+      } _stats, _stompstats;
+      void init_stats(obj_stats_t &stats, const bool startup = false);
+  }; // class ChangeListener
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
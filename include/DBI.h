@@ -24,6 +24,11 @@
 #ifndef APNSPUSHER_DBI_H
 #define APNSPUSHER_DBI_H
 
+#include <string>
+#include <vector>
+
+#include <time.h>
+
 #include <openframe/DBI.h>
 
 namespace apnspusher {
@@ -38,6 +43,19 @@ namespace apnspusher {
  ** Structures                                                           **
  **************************************************************************/
 
+  // one apns_push row, written in batches
+  struct apns_push_t {
+    std::string register_id;
+    std::string alertmsg;
+    time_t created_at;
+  }; // struct apns_push_t
+
+  // one token Apple reported as no longer installed
+  struct apns_feedback_t {
+    std::string device_token;
+    time_t apns_timestamp;
+  }; // struct apns_feedback_t
+
   class DBI_Apns : public openframe::DBI {
     public:
       DBI_Apns(const thread_id_t thread_id,
@@ -51,10 +69,29 @@ namespace apnspusher {
 
       resultSizeType getApnsRegisterByCallsign(const std::string &callsign,
                                                resultType &res);
+      // ok, when given, tells a failed query apart from no rows
+      resultSizeType getApnsRegistersByCallsigns(const std::vector<std::string> &callsigns,
+                                                 resultType &res,
+                                                 bool *ok=NULL);
+      resultSizeType getApnsRegisterCallsigns(resultType &res);
+      // every active registration, callsign included
+      resultSizeType getApnsRegisterIndex(resultType &res);
+      // id and callsign of every row added after id, active or not
+      resultSizeType getApnsRegisterCallsignsSince(const std::string &id,
+                                                   resultType &res,
+                                                   bool *ok=NULL);
       simpleResultSizeType setApnsPush(const std::string &id,
                                        const std::string &message);
+      simpleResultSizeType setApnsPushes(const std::vector<apns_push_t> &pushes);
+      simpleResultSizeType setApnsFeedbacks(const std::vector<apns_feedback_t> &feedbacks);
+      resultSizeType getApnsRegisterCallsignsByTokens(const std::vector<std::string> &tokens,
+                                                      resultType &res);
+      // only rows registered before each token's feedback timestamp
+      simpleResultSizeType setApnsRegistersInactive(const std::vector<apns_feedback_t> &feedbacks);
 
     protected:
+      static std::string escape_list(mysqlpp::Query *query, const std::vector<std::string> &values);
+
     private:
   }; // class DBI_Apns
 
@@ -0,0 +1,52 @@
+#ifndef APNSPUSHER_EVENTWAIT_H
+#define APNSPUSHER_EVENTWAIT_H
+
+#include <string>
+
+#include <openframe/openframe.h>
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  class EventWait_Exception : public openframe::OpenFrame_Exception {
+    public:
+      EventWait_Exception(const std::string message) throw() : openframe::OpenFrame_Exception(message) { };
+  }; // class EventWait_Exception
+
+  // Waits for a connection's socket or a wakeup eventfd to become
+  // readable.  The socket is followed across reconnects, the kernel
+  // drops closed descriptors from the set on its own.
+  class EventWait : public openframe::OpenFrame_Abstract {
+    public:
+      EventWait();
+      virtual ~EventWait();
+
+      // wakeup_fd (-1 for none) is watched for good from here on
+      void init(const int wakeup_fd);
+      // up to timeout ms on fd (-1 for none) and the wakeup event, true
+      // when either became readable
+      bool wait(const int fd, const int timeout);
+
+    private:
+      EventWait(const EventWait &);
+      EventWait &operator=(const EventWait &);
+
+      int _epoll_fd;
+      int _watch_fd;
+  }; // class EventWait
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
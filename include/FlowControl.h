@@ -0,0 +1,63 @@
+#ifndef APNSPUSHER_FLOWCONTROL_H
+#define APNSPUSHER_FLOWCONTROL_H
+
+#include <stddef.h>
+#include <time.h>
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // Decides how many more messages a worker may take off the broker.
+  // Everything queued between the worker and Apple may amount to delay
+  // milliseconds of what Apple has lately been draining, never less
+  // than floor; the room left under that is split between the workers.
+  // When Apple slows down the drain rate falls, the room closes and the
+  // workers stop reading, so the backlog stays on the broker instead of
+  // in our queues.
+  class FlowControl {
+    public:
+      FlowControl(const time_t delay,
+                  const size_t floor,
+                  const size_t max_window,
+                  const unsigned int num_consumers);
+      virtual ~FlowControl() { }
+
+      // backlog is what is queued downstream now, drained the running
+      // total taken off those queues; returns the new window
+      size_t update(const size_t backlog, const unsigned long long drained);
+
+      size_t window() const { return _window; }
+      size_t backlog() const { return _backlog; }
+      size_t target() const;
+      double rate() const { return _rate; }
+
+    private:
+      // constructor variables
+      time_t _delay;				// ms of drain downstream may hold
+      size_t _floor;
+      size_t _max_window;
+      unsigned int _num_consumers;
+
+      bool _primed;
+      struct timespec _sampled_at;
+      unsigned long long _drained;
+      double _rate;				// drained per second, smoothed
+      size_t _backlog;
+      size_t _window;
+  }; // class FlowControl
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
@@ -0,0 +1,206 @@
+#ifndef APNSPUSHER_GATEWAYCLIENT_H
+#define APNSPUSHER_GATEWAYCLIENT_H
+
+#include <deque>
+#include <string>
+
+#include <stdint.h>
+#include <time.h>
+
+#include <openssl/ssl.h>
+
+#include <openframe/openframe.h>
+
+#include "Payload.h"
+#include "TlsContext.h"
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // One TLS connection to the legacy binary gateway.  Frames are packed
+  // into a buffer and written a full TLS record at a time, or once the
+  // oldest has waited the flush delay, instead of a record and a write(2)
+  // per notification.  The gateway only ever answers to reject a frame,
+  // after which it closes the connection and drops everything written
+  // behind the bad one, so recently written frames are kept in a window
+  // and those behind the rejected one go out again on the next connection.
+  class GatewayClient : public openframe::OpenFrame_Abstract {
+    public:
+      static const size_t kDefaultRecordSize;
+      static const int kDefaultFlushDelay;
+      static const size_t kMaxPayload;
+      static const size_t kDefaultResendWindow;
+      static const size_t kMaxBufferedRecords;
+
+      // status codes from Apple's error response
+      enum statusEnum {
+        STATUS_PROCESSING_ERROR		= 1,
+        STATUS_MISSING_TOKEN		= 2,
+        STATUS_MISSING_TOPIC		= 3,
+        STATUS_MISSING_PAYLOAD		= 4,
+        STATUS_INVALID_TOKEN_SIZE	= 5,
+        STATUS_INVALID_TOPIC_SIZE	= 6,
+        STATUS_INVALID_PAYLOAD_SIZE	= 7,
+        STATUS_INVALID_TOKEN		= 8,
+        STATUS_SHUTDOWN			= 10,
+        STATUS_UNKNOWN			= 255
+      };
+
+      struct frame_t {
+        uint32_t identifier;
+        std::string device_token;
+        Payload payload;
+        time_t expiry;
+      }; // frame_t
+
+      struct rejection_t {
+        frame_t frame;
+        int status;
+      }; // rejection_t
+
+      typedef std::deque<frame_t> frames_t;
+      typedef std::deque<rejection_t> rejections_t;
+
+      struct stats_t {
+        unsigned long frames;
+        unsigned long records;			// SSL_write calls, one record each
+        unsigned long bytes;
+        unsigned long rejected;			// error responses from Apple
+        unsigned long resent;			// frames written again after one
+        unsigned long handshakes;
+        unsigned long resumed;			// handshakes that resumed a session
+        unsigned long ktls;			// connections written by the kernel
+      }; // stats_t
+
+      GatewayClient(const std::string &host,
+                    const int port,
+                    const std::string &cert,
+                    const std::string &key,
+                    const std::string &capath,
+                    const time_t timeout);
+      virtual ~GatewayClient();
+
+      GatewayClient &set_verify(const bool verify) {
+        _verify = verify;
+        return *this;
+      } // set_verify
+
+      GatewayClient &set_flush(const size_t record_size, const int delay) {
+        _record_size = record_size ? record_size : kDefaultRecordSize;
+        _flush_delay = delay;
+        return *this;
+      } // set_flush
+
+      // share certificate and sessions with the other connections, the
+      // context outlives the client
+      GatewayClient &set_tls(TlsContext *tls);
+
+      // how many written frames to keep for resending, Apple's error
+      // response can trail the bad frame by a few hundred more
+      GatewayClient &set_resend_window(const size_t window) {
+        _resend_window = window;
+        return *this;
+      } // set_resend_window
+
+      // frames waiting for a resend are buffered first
+      bool connect();
+      // sorts the window into rejected and to be resent
+      void disconnect();
+      bool is_connected() const { return _ssl != NULL; }
+      size_t resend_pending() const { return _resend.size(); }
+
+      // false when token or payload can't be framed
+      bool add(const std::string &device_token,
+               const Payload &payload,
+               const uint32_t identifier,
+               const time_t expiry);
+      size_t buffered() const { return _wbuf.length() - _woffset; }
+      // a few records are already waiting on the socket, stop adding
+      bool is_full() const { return buffered() >= _record_size * kMaxBufferedRecords; }
+      // frames Apple refused, collected by disconnect()
+      size_t rejections(rejections_t &ret);
+      // running total of frames handed to TLS, each counted once however
+      // often it is resent
+      unsigned long long written() const { return _frames_written; }
+
+      // writes whatever is due, then waits up to timeout ms on the socket
+      // and wakeup_fd (-1 for none), false when the connection is gone
+      bool run(const int timeout, const int wakeup_fd=-1);
+
+      const stats_t &stats() const { return _stats; }
+      void reset_stats();
+
+    protected:
+      struct sent_t {
+        frame_t frame;
+        unsigned long long end;			// _appended once framed
+        bool counted;				// in _frames_written
+      }; // sent_t
+
+      bool queue(const sent_t &sent);
+      void encode(const frame_t &frame, const std::string &token);
+      bool flush(const bool force);
+      bool receive();
+      int flush_wait() const;
+
+    private:
+      GatewayClient(const GatewayClient &);
+      GatewayClient &operator=(const GatewayClient &);
+
+      // constructor variables
+      std::string _host;
+      int _port;
+      std::string _cert;
+      std::string _key;
+      std::string _capath;
+      time_t _timeout;				// idle seconds before we hang up
+
+      bool _verify;
+      size_t _record_size;
+      int _flush_delay;
+      size_t _resend_window;
+
+      int _sock;
+      TlsContext *_tls;
+      bool _own_tls;				// made by connect(), not shared
+      SSL *_ssl;
+
+      std::string _wbuf;
+      size_t _woffset;				// written part of _wbuf
+      bool _blocked;				// socket buffer full, wait for POLLOUT
+      struct timespec _buffered_at;		// oldest unwritten frame
+      time_t _last_write_at;
+
+      std::string _rbuf;
+      bool _error;				// error response read
+      int _error_status;
+      uint32_t _error_identifier;
+
+      // byte counts over the connection's life, a frame whose end is
+      // at or below _written has been handed to TLS
+      unsigned long long _appended;
+      unsigned long long _written;
+      std::deque<sent_t> _sent;
+      size_t _uncounted;			// first of _sent not yet written
+      std::deque<sent_t> _resend;
+      unsigned long long _frames_written;
+      rejections_t _rejections;
+
+      stats_t _stats;
+  }; // class GatewayClient
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
@@ -0,0 +1,168 @@
+#ifndef APNSPUSHER_HTTP2CLIENT_H
+#define APNSPUSHER_HTTP2CLIENT_H
+
+#include <deque>
+#include <map>
+#include <string>
+
+#include <stdint.h>
+#include <time.h>
+
+#include <openssl/ssl.h>
+#include <nghttp2/nghttp2.h>
+
+#include <openframe/openframe.h>
+
+#include "Payload.h"
+#include "TlsContext.h"
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // One TLS connection to the APNs provider API.  Notifications are
+  // multiplexed as concurrent HTTP/2 streams, each answered with its own
+  // status, so a bad token costs one stream rather than the connection.
+  // Everything runs on the calling thread: add() queues, run() submits
+  // what stream limits and flow control allow, writes the frames in one
+  // go and reads whatever came back, responses() hands out the results.
+  class Http2Client : public openframe::OpenFrame_Abstract {
+    public:
+      static const size_t kDefaultMaxStreams;
+      static const unsigned int kDefaultMaxAttempts;
+
+      struct request_t {
+        std::string device_token;
+        Payload payload;
+        struct timespec queued_at;
+        unsigned int attempts;
+      }; // request_t
+
+      struct response_t {
+        request_t request;
+        int status;				// 0 when no answer came back
+        std::string reason;
+        time_t timestamp;			// when Apple saw the token go, 410 only
+      }; // response_t
+
+      typedef std::deque<request_t> requests_t;
+      typedef std::deque<response_t> responses_t;
+
+      struct stats_t {
+        unsigned long handshakes;
+        unsigned long resumed;			// handshakes that resumed a session
+      }; // stats_t
+
+      Http2Client(const std::string &host,
+                  const int port,
+                  const std::string &cert,
+                  const std::string &key,
+                  const std::string &capath,
+                  const std::string &topic);
+      virtual ~Http2Client();
+
+      Http2Client &set_verify(const bool verify) {
+        _verify = verify;
+        return *this;
+      } // set_verify
+
+      // share certificate and sessions with the other connections, the
+      // context outlives the client
+      Http2Client &set_tls(TlsContext *tls);
+
+      Http2Client &set_max_streams(const size_t max_streams) {
+        _max_streams = max_streams ? max_streams : 1;
+        return *this;
+      } // set_max_streams
+
+      bool connect();
+      // in flight requests go back to pending for the next connection
+      void disconnect();
+      bool is_connected() const { return _session != NULL; }
+
+      // how many more requests are worth queueing right now
+      size_t room() const;
+      size_t pending() const { return _pending.size(); }
+      size_t in_flight() const { return _streams.size(); }
+
+      // the aps dictionary the legacy protocol built for us
+      static std::string payload(const std::string &text,
+                                 const std::string &action,
+                                 const int badge);
+
+      void add(const request_t &request);
+      // waits up to timeout ms on the socket and wakeup_fd (-1 for none),
+      // false when the connection is gone
+      bool run(const int timeout, const int wakeup_fd=-1);
+      size_t responses(responses_t &ret);
+
+      const stats_t &stats() const { return _stats; }
+      void reset_stats();
+
+    protected:
+      struct stream_t {
+        request_t request;
+        int status;
+        std::string body;
+        size_t offset;
+      }; // stream_t
+
+      bool submit();
+      bool flush();
+      bool receive();
+      void finish(stream_t *stream, const uint32_t error_code);
+
+      static ssize_t send_cb(nghttp2_session *, const uint8_t *, size_t, int, void *);
+      static int on_header_cb(nghttp2_session *, const nghttp2_frame *, const uint8_t *, size_t,
+                              const uint8_t *, size_t, uint8_t, void *);
+      static int on_data_chunk_cb(nghttp2_session *, uint8_t, int32_t, const uint8_t *, size_t, void *);
+      static int on_stream_close_cb(nghttp2_session *, int32_t, uint32_t, void *);
+      static int on_frame_recv_cb(nghttp2_session *, const nghttp2_frame *, void *);
+      static ssize_t read_payload_cb(nghttp2_session *, int32_t, uint8_t *, size_t, uint32_t *,
+                                     nghttp2_data_source *, void *);
+
+    private:
+      Http2Client(const Http2Client &);
+      Http2Client &operator=(const Http2Client &);
+
+      // constructor variables
+      std::string _host;
+      int _port;
+      std::string _cert;
+      std::string _key;
+      std::string _capath;
+      std::string _topic;
+
+      bool _verify;
+      size_t _max_streams;
+
+      int _sock;
+      TlsContext *_tls;
+      bool _own_tls;				// made by connect(), not shared
+      SSL *_ssl;
+      nghttp2_session *_session;
+      bool _goaway;
+      bool _settings;				// server SETTINGS seen
+      std::string _wbuf;			// frames waiting for the socket
+
+      requests_t _pending;
+      std::map<int32_t, stream_t *> _streams;
+      responses_t _responses;
+
+      stats_t _stats;
+  }; // class Http2Client
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
@@ -26,7 +26,10 @@
 #ifndef APNSPUSHER_MEMCACHEDCONTROLLER_H
 #define APNSPUSHER_MEMCACHEDCONTROLLER_H
 
+#include <map>
 #include <set>
+#include <string>
+#include <vector>
 
 #include <netdb.h>
 #include <unistd.h>
@@ -68,9 +71,13 @@ class MemcachedController_Exception : public openframe::OpenFrame_Exception {
         MEMCACHED_CONTROLLER_SUCCESS,
         MEMCACHED_CONTROLLER_ERROR
       };
+      typedef std::map<std::string, std::string> mgetResultType;
 
       // ### Members ###
       const memcachedReturnEnum get(const std::string &, const std::string &, std::string &);
+      // fetch several keys in one pipelined exchange, only found keys
+      // are returned, without the namespace
+      const size_t mget(const std::string &, const std::vector<std::string> &, mgetResultType &);
       void put(const std::string &, const std::string &, const std::string &);
       void put(const std::string &, const std::string &, const std::string &, const time_t);
       void replace(const std::string &, const std::string &, const std::string &);
@@ -0,0 +1,70 @@
+#ifndef APNSPUSHER_NOTIFYPARSER_H
+#define APNSPUSHER_NOTIFYPARSER_H
+
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  struct notify_message_t;
+
+  // Single pass parser for the key:value|key:value bodies published on
+  // the notify topic.  Fields are located as pointer/length slices into
+  // the frame body and only copied once the message is known to be
+  // wanted, ack only messages are rejected before anything is copied.
+  // Bodies that may carry an escaped value are rare and are parsed with
+  // openframe::Vars instead, so values come out exactly as it decoded
+  // them.
+  class NotifyParser {
+    public:
+      enum parseEnum {
+        PARSE_OK,
+        PARSE_ACKONLY,
+        PARSE_INCOMPLETE,
+        PARSE_TOOLONG
+      };
+
+      static parseEnum parse(const char *buf, const size_t len, notify_message_t &ret);
+      static parseEnum parse(const std::string &buf, notify_message_t &ret) {
+        return parse(buf.data(), buf.size(), ret);
+      } // parse
+
+      static const char *str(const parseEnum result);
+
+      // register change bodies name the callsigns whose registrations
+      // changed, cs:N0CALL,K1ABC and cs may repeat; returns how many
+      // were appended to ret, upper cased
+      static size_t parse_change(const char *buf, const size_t len, std::vector<std::string> &ret);
+      static size_t parse_change(const std::string &buf, std::vector<std::string> &ret) {
+        return parse_change(buf.data(), buf.size(), ret);
+      } // parse_change
+
+    private:
+      struct slice_t {
+        const char *ptr;
+        size_t len;
+      }; // slice_t
+
+      static parseEnum parse_escaped(const char *buf, const size_t len, notify_message_t &ret);
+      static bool is_key(const slice_t &key, const char *name);
+      static bool copy(const slice_t &value, char *dst, const size_t max, const bool upper);
+  }; // class NotifyParser
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
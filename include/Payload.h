@@ -0,0 +1,73 @@
+#ifndef APNSPUSHER_PAYLOAD_H
+#define APNSPUSHER_PAYLOAD_H
+
+#include <string>
+
+#include <stddef.h>
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // A serialized notification payload, built once per message and shared
+  // by every device it fans out to.  Copies only bump a reference count;
+  // the bytes never change after construction so the ssl threads read
+  // them without a lock, and the last copy to go frees them.
+  class Payload {
+    public:
+      Payload() : _buf(NULL) { }
+
+      explicit Payload(const std::string &data) : _buf(new buf_t(data)) { }
+
+      Payload(const Payload &payload) : _buf(payload._buf) {
+        if (_buf) __atomic_add_fetch(&_buf->refs, 1, __ATOMIC_RELAXED);
+      } // Payload
+
+      ~Payload() { release(); }
+
+      Payload &operator=(const Payload &payload) {
+        if (payload._buf) __atomic_add_fetch(&payload._buf->refs, 1, __ATOMIC_RELAXED);
+        release();
+        _buf = payload._buf;
+        return *this;
+      } // operator=
+
+      const std::string &str() const {
+        static const std::string empty;
+        return _buf ? _buf->data : empty;
+      } // str
+
+      const char *data() const { return str().data(); }
+      size_t length() const { return _buf ? _buf->data.length() : 0; }
+      bool empty() const { return length() == 0; }
+
+    private:
+      struct buf_t {
+        explicit buf_t(const std::string &data) : refs(1), data(data) { }
+        unsigned int refs;
+        const std::string data;
+      }; // buf_t
+
+      void release() {
+        if (_buf && __atomic_sub_fetch(&_buf->refs, 1, __ATOMIC_ACQ_REL) == 0)
+          delete _buf;
+        _buf = NULL;
+      } // release
+
+      buf_t *_buf;
+  }; // class Payload
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
@@ -0,0 +1,55 @@
+#ifndef APNSPUSHER_PIPELINE_H
+#define APNSPUSHER_PIPELINE_H
+
+#include <string>
+
+#include <stddef.h>
+
+#include "BoundedQueue.h"
+#include "Store.h"
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // receive stage (Worker) -> lookup stage (Resolver), fixed size so
+  // that parsing and queueing a message never touches the heap
+  struct notify_message_t {
+    static const size_t kMaxCallsignLength = 15;
+    static const size_t kMaxIdLength = 7;
+    static const size_t kMaxBodyLength = 255;
+
+    char source[kMaxCallsignLength + 1];
+    char target[kMaxCallsignLength + 1];
+    char id[kMaxIdLength + 1];
+    char body[kMaxBodyLength + 1];
+  }; // notify_message_t
+
+  // lookup stage (Resolver) -> persist/enqueue stage (Pusher), the
+  // registers are owned by the job until the Pusher deletes them
+  struct push_job_t {
+    notify_message_t message;
+    apns_registers_t registers;
+  }; // push_job_t
+
+  typedef BoundedQueue<notify_message_t> lookup_queue_t;
+  typedef BoundedQueue<push_job_t> push_queue_t;
+
+  // push stage (Pusher) -> write behind (PushWriter), apns_push rows
+  // recorded after the notification was handed to APNS
+  typedef BoundedQueue<apns_push_t> record_queue_t;
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
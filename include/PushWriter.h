@@ -0,0 +1,109 @@
+#ifndef APNSPUSHER_PUSHWRITER_H
+#define APNSPUSHER_PUSHWRITER_H
+
+#include <string>
+#include <vector>
+
+#include <openframe/openframe.h>
+#include <openstats/openstats.h>
+
+#include "DBI.h"
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  class Store;
+  template<typename T> class BoundedQueue;
+
+  // Write behind for apns_push, collects the rows recorded by the push
+  // stage and writes them as multi row inserts once enough have piled
+  // up or the oldest has waited long enough.
+  class PushWriter : public openframe::LogObject,
+                     public openstats::StatsClient_Interface {
+    public:
+      // ### Constants ### //
+      static const time_t kDefaultStatsInterval;
+      static const time_t kDefaultMemcachedExpire;
+      static const size_t kDefaultFlushRows;
+      static const int kDefaultFlushInterval;
+      static const int kDefaultIdleTimeout;
+
+      // ### Init ### //
+      PushWriter(const thread_id_t thread_id,
+                 const std::string &memcached_host,
+                 const std::string &db_host,
+                 const std::string &db_user,
+                 const std::string &db_pass,
+                 const std::string &db_database);
+      virtual ~PushWriter();
+      void init();
+      bool run();
+      void drain();
+      void try_stats();
+      void try_stompstats();
+
+      // ### Options ### //
+      PushWriter &set_record_queue(BoundedQueue<apns_push_t> *record_q) {
+        _record_q = record_q;
+        return *this;
+      } // set_record_queue
+
+      // flush at rows collected or interval milliseconds after the
+      // first row of a batch arrived, whichever comes first
+      PushWriter &set_flush(const size_t rows, const int interval) {
+        _flush_rows = rows ? rows : 1;
+        _flush_interval = interval;
+        return *this;
+      } // set_flush
+
+      // ### StatsClient Pure Virtuals ### //
+      void onDescribeStats();
+      void onDestroyStats();
+
+    protected:
+      bool flush();
+
+    private:
+      // constructor variables
+      std::string _memcached_host;
+      std::string _db_host;
+      std::string _db_user;
+      std::string _db_pass;
+      std::string _db_database;
+
+      Store *_store;
+      BoundedQueue<apns_push_t> *_record_q;
+      std::vector<apns_push_t> _rows;
+      size_t _flush_rows;
+      int _flush_interval;
+      openframe::Stopwatch _profile;
+
+      struct obj_stats_t {
+        unsigned int rows;
+        unsigned int flushes;
+        unsigned int retried;			// one by one after a rejected flush
+        unsigned int failed;
+        unsigned int max_flush;
+        double flush_time;			// seconds spent in flushes
+        time_t report_interval;
+        time_t last_report_at;
+        time_t created_at;
+      } _stats, _stompstats;
+      void init_stats(obj_stats_t &stats, const bool startup = false);
+  }; // class PushWriter
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
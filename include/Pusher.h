@@ -0,0 +1,104 @@
+#ifndef APNSPUSHER_PUSHER_H
+#define APNSPUSHER_PUSHER_H
+
+#include <string>
+
+#include <openframe/openframe.h>
+#include <openstats/openstats.h>
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  class Store;
+  class APNS;
+  template<typename T> class BoundedQueue;
+  struct push_job_t;
+  struct apns_push_t;
+
+  // Push stage, queues each notification for delivery to Apple and
+  // hands the matching apns_push row to the write behind.
+  class Pusher : public openframe::LogObject,
+                 public openstats::StatsClient_Interface {
+    public:
+      // ### Constants ### //
+      static const time_t kDefaultStatsInterval;
+      static const time_t kDefaultMemcachedExpire;
+      static const int kDefaultIdleTimeout;
+
+      // ### Init ### //
+      Pusher(const thread_id_t thread_id,
+             const std::string &memcached_host,
+             const std::string &db_host,
+             const std::string &db_user,
+             const std::string &db_pass,
+             const std::string &db_database);
+      virtual ~Pusher();
+      void init();
+      bool run();
+      void try_stats();
+      void try_stompstats();
+
+      // ### Options ### //
+      Pusher &set_push_queue(BoundedQueue<push_job_t> *push_q) {
+        _push_q = push_q;
+        return *this;
+      } // set_push_queue
+
+      Pusher &set_record_queue(BoundedQueue<apns_push_t> *record_q) {
+        _record_q = record_q;
+        return *this;
+      } // set_record_queue
+
+      // ### StatsClient Pure Virtuals ### //
+      void onDescribeStats();
+      void onDestroyStats();
+
+    protected:
+      bool event_message_to_apns(push_job_t &job);
+      void record_push(const std::string &id, const std::string &message);
+      void try_feedback();
+
+    private:
+      // constructor variables
+      std::string _memcached_host;
+      std::string _db_host;
+      std::string _db_user;
+      std::string _db_pass;
+      std::string _db_database;
+
+      Store *_store;
+      APNS *_apns;			// shared, owned by App
+      BoundedQueue<push_job_t> *_push_q;
+      BoundedQueue<apns_push_t> *_record_q;
+
+      struct obj_stats_t {
+        unsigned int jobs;
+        unsigned int queued;
+        unsigned int dropped;
+        unsigned int recorded;
+        unsigned int record_fallbacks;
+        unsigned int feedbacks;
+        unsigned int pruned;
+        unsigned int evicted;
+        time_t report_interval;
+        time_t last_report_at;
+        time_t created_at;
+      } _stats, _stompstats;
+      void init_stats(obj_stats_t &stats, const bool startup = false);
+  }; // class Pusher
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
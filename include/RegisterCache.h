@@ -0,0 +1,91 @@
+#ifndef APNSPUSHER_REGISTERCACHE_H
+#define APNSPUSHER_REGISTERCACHE_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <openframe/openframe.h>
+
+#include "Store.h"
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // Process wide cache of register lookups keyed by upper case callsign,
+  // shared by every Store in front of memcached.  Callsigns without a
+  // registration are cached too.  Each shard holds a fixed number of
+  // slots and evicts with CLOCK once full.
+  class RegisterCache {
+    public:
+      static const size_t kDefaultSize;
+      static const size_t kDefaultShards;
+      static const time_t kDefaultTtl;
+      static const time_t kDefaultNegativeTtl;
+
+      enum lookupEnum {
+        REGISTER_CACHE_MISS,
+        REGISTER_CACHE_FOUND,
+        REGISTER_CACHE_NOTFOUND
+      };
+
+      RegisterCache(const size_t size=kDefaultSize,
+                    const time_t ttl=kDefaultTtl,
+                    const time_t negative_ttl=kDefaultNegativeTtl,
+                    const size_t num_shards=kDefaultShards);
+      virtual ~RegisterCache();
+
+      // on REGISTER_CACHE_FOUND copies of the cached rows are appended
+      // to ret and owned by the caller
+      lookupEnum get(const std::string &key, apns_registers_t &ret);
+      void put(const std::string &key, const apns_registers_t &registers);
+      void remove(const std::string &key);
+      size_t size();
+
+    private:
+      typedef std::vector<apns_register_t> rows_t;
+
+      struct entry_t {
+        std::string key;
+        rows_t rows;
+        time_t expires_at;
+        bool used;
+        bool referenced;
+      }; // entry_t
+
+      typedef std::map<std::string, size_t> index_t;
+
+      struct shard_t {
+        openframe::OFLock lock;
+        std::vector<entry_t> slots;
+        index_t index;
+        size_t hand;
+        unsigned int seed;			// ttl jitter
+      }; // shard_t
+
+      RegisterCache(const RegisterCache &);
+      RegisterCache &operator=(const RegisterCache &);
+
+      shard_t &shard(const std::string &key);
+      size_t evict(shard_t &s);
+
+      std::vector<shard_t *> _shards;
+      time_t _ttl;
+      time_t _negative_ttl;
+  }; // class RegisterCache
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
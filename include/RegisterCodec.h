@@ -0,0 +1,67 @@
+#ifndef APNSPUSHER_REGISTERCODEC_H
+#define APNSPUSHER_REGISTERCODEC_H
+
+#include <string>
+
+#include "Store.h"
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // Binary memcached value for a register lookup.
+  //
+  //   byte 0    magic, never a valid first byte of a Vars string
+  //   byte 1    format version
+  //   byte 2    flags, bit 0 set when the callsign was found
+  //   varint    number of rows
+  //   per row   varint id, 32 byte raw device token, 1 byte environment
+  //
+  // Values that do not start with the magic byte are the legacy Vars
+  // encoding and left to the caller.
+  class RegisterCodec {
+    public:
+      static const unsigned char kMagic;
+      static const unsigned char kVersion;
+      static const size_t kTokenLength;
+
+      enum environmentEnum {
+        ENVIRONMENT_SANDBOX	= 0,
+        ENVIRONMENT_PROD	= 1
+      };
+
+      enum decodeEnum {
+        DECODE_FOUND,
+        DECODE_NOTFOUND,
+        DECODE_INVALID
+      };
+
+      static bool is_binary(const std::string &buf) {
+        return buf.length() >= 3 && static_cast<unsigned char>(buf[0]) == kMagic;
+      } // is_binary
+
+      // false when a row cannot be represented (non numeric id or a
+      // token that is not 64 hex characters), use the legacy encoding
+      static bool encode(const apns_registers_t &registers, std::string &ret);
+      static decodeEnum decode(const std::string &buf, apns_registers_t &ret);
+
+    private:
+      static void put_varint(unsigned long long value, std::string &ret);
+      static bool get_varint(const std::string &buf, size_t &pos, unsigned long long &ret);
+      static int unhex(const char c);
+  }; // class RegisterCodec
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
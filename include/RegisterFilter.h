@@ -0,0 +1,70 @@
+#ifndef APNSPUSHER_REGISTERFILTER_H
+#define APNSPUSHER_REGISTERFILTER_H
+
+#include <string>
+
+#include <time.h>
+#include <pthread.h>
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  class BloomFilter;
+
+  // Process wide bloom filter of every callsign with an active
+  // registration.  Until the first load it lets everything through, a
+  // negative answer afterwards means the callsign is definitely not
+  // registered as of the last refresh.
+  class RegisterFilter {
+    public:
+      static const time_t kDefaultRefreshInterval;
+      static const double kDefaultFalsePositiveRate;
+
+      RegisterFilter(const time_t refresh_interval=kDefaultRefreshInterval,
+                     const double fpp=kDefaultFalsePositiveRate);
+      virtual ~RegisterFilter();
+
+      bool maybe_registered(const std::string &key);
+
+      // marks a callsign registered ahead of the next rebuild
+      void add(const std::string &key);
+
+      // returns true to exactly one caller once the refresh interval
+      // has passed, that caller is expected to rebuild and swap
+      bool claim_refresh();
+      void swap(BloomFilter *filter);
+      double fpp() const { return _fpp; }
+
+      bool is_loaded();
+      size_t count();
+      size_t bytes();
+      double fpr();
+
+    private:
+      RegisterFilter(const RegisterFilter &);
+      RegisterFilter &operator=(const RegisterFilter &);
+
+      BloomFilter *_filter;
+      pthread_rwlock_t _filter_l;
+
+      time_t _refresh_interval;
+      time_t _next_refresh_at;
+      pthread_mutex_t _refresh_l;
+      double _fpp;
+  }; // class RegisterFilter
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
@@ -0,0 +1,81 @@
+#ifndef APNSPUSHER_REGISTERFLIGHT_H
+#define APNSPUSHER_REGISTERFLIGHT_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+#include "Store.h"
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // Register lookups on their way to SQL, shared by every Store.  The
+  // first Store to miss a callsign leads it and lands what it found,
+  // any other Store missing the same callsign meanwhile waits for that
+  // instead of running the same query.
+  class RegisterFlight {
+    public:
+      static const int kDefaultWait;
+
+      struct flight_t;
+
+      // wait is how long (ms) a follower waits before giving up on the
+      // leader and querying itself
+      explicit RegisterFlight(const int wait=kDefaultWait);
+      virtual ~RegisterFlight();
+
+      // true when the caller now leads key and must land() it, otherwise
+      // flight is set for the caller to wait() on
+      bool lead(const std::string &key, flight_t *&flight);
+      // false when key changed while in flight, the rows may predate
+      // the change and mustn't be cached
+      bool land(const std::string &key, const apns_registers_t &registers);
+      // the leader's lookup failed, anyone waiting on key gives up at
+      // once and queries itself
+      void abandon(const std::string &key);
+      // key's registration changed, anything in flight for it is stale
+      void invalidate(const std::string &key);
+      // copies of the leader's rows are appended to ret and owned by the
+      // caller, false when it didn't land in time or was abandoned
+      bool wait(flight_t *flight, apns_registers_t &ret);
+
+      struct flight_t {
+        std::vector<apns_register_t> rows;
+        bool landed;
+        bool abandoned;
+        bool stale;
+        unsigned int refs;			// the leader and each follower
+      }; // flight_t
+
+    private:
+      typedef std::map<std::string, flight_t *> flights_t;
+
+      RegisterFlight(const RegisterFlight &);
+      RegisterFlight &operator=(const RegisterFlight &);
+
+      void release(flight_t *flight);
+
+      int _wait;
+      flights_t _flights;			// keys led and not yet landed
+      pthread_mutex_t _lock;
+      pthread_cond_t _landed;
+  }; // class RegisterFlight
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
@@ -0,0 +1,138 @@
+#ifndef APNSPUSHER_REGISTERINDEX_H
+#define APNSPUSHER_REGISTERINDEX_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "Store.h"
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // Every active registration held in memory, keyed by upper case
+  // callsign.  Once loaded it answers every lookup, found or not, so
+  // nothing leaves the process.
+  //
+  // Readers never lock.  The index is an immutable snapshot, a sync
+  // builds a new one and publishes it with a pointer swap; each reader
+  // announces the epoch it entered in and the old snapshot is freed
+  // once no reader is left in an earlier epoch.
+  class RegisterIndex {
+    public:
+      static const time_t kDefaultSyncInterval;
+      static const time_t kDefaultReloadInterval;
+      static const size_t kMaxReaders;
+
+      enum lookupEnum {
+        REGISTER_INDEX_UNLOADED,
+        REGISTER_INDEX_FOUND,
+        REGISTER_INDEX_NOTFOUND
+      };
+
+      enum syncEnum {
+        SYNC_NONE,
+        SYNC_FULL,
+        SYNC_DELTA
+      };
+
+      // callsign to every row registered for it
+      typedef std::map<std::string, std::vector<apns_register_t> > registers_t;
+
+      RegisterIndex(const time_t sync_interval=kDefaultSyncInterval,
+                    const time_t reload_interval=kDefaultReloadInterval);
+      virtual ~RegisterIndex();
+
+      // a reader slot for the calling thread, -1 once they run out
+      int attach();
+      // on REGISTER_INDEX_FOUND copies of the rows are appended to ret
+      // and owned by the caller
+      lookupEnum get(const int reader, const std::string &key, apns_registers_t &ret);
+
+      // hands exactly one caller the sync that is due, it must publish()
+      // or abandon() before anyone is handed another
+      syncEnum claim_sync();
+      // a full sync replaces the index with registers, a delta replaces
+      // only the callsigns in it and an empty row set removes one
+      void publish(const syncEnum sync, const registers_t &registers, const uint64_t last_id);
+      void abandon();
+
+      // highest apns_register id seen so far, deltas start after it
+      uint64_t last_id();
+      // callsign changed somewhere we can't see by id, the next delta
+      // fetches it again
+      void touch(const std::string &key);
+      void touched(std::vector<std::string> &ret);
+
+      bool is_loaded();
+      size_t count();
+      size_t rows();
+      size_t bytes();
+
+    private:
+      struct entry_t {
+        std::string key;
+        uint32_t first;				// into rows
+        uint32_t num_rows;
+      }; // entry_t
+
+      struct snapshot_t {
+        std::vector<uint32_t> buckets;		// entry + 1, 0 when empty
+        std::vector<entry_t> entries;
+        std::vector<apns_register_t> rows;
+        uint64_t last_id;
+        size_t bytes;
+      }; // snapshot_t
+
+      // one cache line each so readers don't contend
+      struct reader_t {
+        uint64_t epoch;				// 0 while outside get()
+        char pad[56];
+      }; // reader_t
+
+      RegisterIndex(const RegisterIndex &);
+      RegisterIndex &operator=(const RegisterIndex &);
+
+      static uint32_t hash(const std::string &key);
+      static const entry_t *find(const snapshot_t *s, const std::string &key);
+      // base's callsigns not in registers carry over, none without
+      static snapshot_t *build(const snapshot_t *base,
+                               const registers_t &registers,
+                               const uint64_t last_id);
+      snapshot_t *acquire(const int reader);
+      void release(const int reader);
+      void swap(snapshot_t *snapshot);
+
+      snapshot_t *_snapshot;			// NULL until the first load
+      uint64_t _epoch;
+      reader_t *_readers;
+      unsigned int _num_readers;
+
+      time_t _sync_interval;
+      time_t _reload_interval;
+      time_t _next_sync_at;
+      time_t _next_reload_at;
+      bool _syncing;
+      std::set<std::string> _touched;
+      pthread_mutex_t _sync_l;			// everything but readers
+  }; // class RegisterIndex
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
@@ -0,0 +1,116 @@
+#ifndef APNSPUSHER_RESOLVER_H
+#define APNSPUSHER_RESOLVER_H
+
+#include <string>
+#include <vector>
+
+#include <openframe/openframe.h>
+#include <openstats/openstats.h>
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  class Store;
+  template<typename T> class BoundedQueue;
+  struct notify_message_t;
+  struct push_job_t;
+
+  // Lookup stage, resolves the target callsign of each message to its
+  // registered devices and hands the result to the push stage.
+  class Resolver : public openframe::LogObject,
+                   public openstats::StatsClient_Interface {
+    public:
+      // ### Constants ### //
+      static const time_t kDefaultStatsInterval;
+      static const time_t kDefaultMemcachedExpire;
+      static const int kDefaultIdleTimeout;
+      static const size_t kDefaultBatchSize;
+
+      // ### Init ### //
+      Resolver(const thread_id_t thread_id,
+               const std::string &memcached_host,
+               const std::string &db_host,
+               const std::string &db_user,
+               const std::string &db_pass,
+               const std::string &db_database);
+      virtual ~Resolver();
+      void init();
+      bool run();
+      void try_stats();
+      void try_stompstats();
+
+      // ### Options ### //
+      Resolver &set_queues(BoundedQueue<notify_message_t> *lookup_q,
+                           BoundedQueue<push_job_t> *push_q) {
+        _lookup_q = lookup_q;
+        _push_q = push_q;
+        return *this;
+      } // set_queues
+
+      // most messages queued at once that are looked up together
+      Resolver &set_batch_size(const size_t batch_size) {
+        _batch_size = batch_size ? batch_size : 1;
+        return *this;
+      } // set_batch_size
+
+      Resolver &set_memcached_binary(const bool memcached_binary) {
+        _memcached_binary = memcached_binary;
+        return *this;
+      } // set_memcached_binary
+
+      Resolver &set_register_expire(const time_t register_expire) {
+        _register_expire = register_expire;
+        return *this;
+      } // set_register_expire
+
+      // ### StatsClient Pure Virtuals ### //
+      void onDescribeStats();
+      void onDestroyStats();
+
+    protected:
+      bool resolve(std::vector<notify_message_t> &messages);
+      bool push(push_job_t &job);
+
+    private:
+      // constructor variables
+      std::string _memcached_host;
+      std::string _db_host;
+      std::string _db_user;
+      std::string _db_pass;
+      std::string _db_database;
+      bool _memcached_binary;
+      time_t _register_expire;
+      size_t _batch_size;
+
+      Store *_store;
+      BoundedQueue<notify_message_t> *_lookup_q;
+      BoundedQueue<push_job_t> *_push_q;
+      openframe::Stopwatch _profile;
+
+      struct obj_stats_t {
+        unsigned int messages;
+        unsigned int batches;
+        unsigned int found;
+        unsigned int not_found;
+        time_t report_interval;
+        time_t last_report_at;
+        time_t created_at;
+      } _stats, _stompstats;
+      void init_stats(obj_stats_t &stats, const bool startup = false);
+  }; // class Resolver
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
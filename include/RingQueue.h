@@ -0,0 +1,176 @@
+#ifndef APNSPUSHER_RINGQUEUE_H
+#define APNSPUSHER_RINGQUEUE_H
+
+#include <vector>
+
+#include <stddef.h>
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // Bounded lock free multi producer / multi consumer FIFO.  Every slot
+  // carries a sequence number telling producers and consumers whose turn
+  // it is, so the only contended writes are the two position counters
+  // (D. Vyukov's bounded MPMC queue).  Nothing here blocks, enqueue fails
+  // when full and dequeue when empty; callers decide how to wait.
+  // Capacity is rounded up to a power of two.
+  template<typename T>
+  class RingQueue {
+    public:
+      typedef std::vector<T> items_t;
+      typedef size_t size_type;
+
+      explicit RingQueue(const size_type capacity)
+        : _mask(round_up(capacity) - 1),
+          _cells(_mask + 1),
+          _enqueue_pos(0),
+          _dequeue_pos(0) {
+        for(size_type i = 0; i <= _mask; i++)
+          _cells[i].sequence = i;
+      } // RingQueue
+
+      virtual ~RingQueue() { }
+
+      bool enqueue(const T &item) {
+        size_type pos = __atomic_load_n(&_enqueue_pos, __ATOMIC_RELAXED);
+        cell_t *cell;
+
+        while(true) {
+          cell = &_cells[pos & _mask];
+          size_type seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+          long diff = long(seq) - long(pos);
+
+          if (diff == 0) {
+            if (__atomic_compare_exchange_n(&_enqueue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+              break;
+            // lost the race, pos now holds the current position
+          } // if
+          else if (diff < 0) return false;	// full
+          else pos = __atomic_load_n(&_enqueue_pos, __ATOMIC_RELAXED);
+        } // while
+
+        cell->data = item;
+        __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+        return true;
+      } // enqueue
+
+      bool dequeue(T &ret) {
+        size_type pos = __atomic_load_n(&_dequeue_pos, __ATOMIC_RELAXED);
+        cell_t *cell;
+
+        while(true) {
+          cell = &_cells[pos & _mask];
+          size_type seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+          long diff = long(seq) - long(pos + 1);
+
+          if (diff == 0) {
+            if (__atomic_compare_exchange_n(&_dequeue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+              break;
+          } // if
+          else if (diff < 0) return false;	// empty
+          else pos = __atomic_load_n(&_dequeue_pos, __ATOMIC_RELAXED);
+        } // while
+
+        release(cell, pos, ret);
+        return true;
+      } // dequeue
+
+      // claims up to max consecutive ready items with a single CAS,
+      // returns how many were appended to ret
+      size_type dequeue(items_t &ret, const size_type max) {
+        size_type pos = __atomic_load_n(&_dequeue_pos, __ATOMIC_RELAXED);
+        size_type num;
+
+        while(true) {
+          num = 0;
+          while(num < max && num <= _mask) {
+            size_type seq = __atomic_load_n(&_cells[(pos + num) & _mask].sequence, __ATOMIC_ACQUIRE);
+            if (long(seq) - long(pos + num + 1) != 0) break;
+            ++num;
+          } // while
+
+          if (num == 0) {
+            // either empty or another consumer moved on, tell them apart
+            size_type cur = __atomic_load_n(&_dequeue_pos, __ATOMIC_RELAXED);
+            if (cur == pos) return 0;
+            pos = cur;
+            continue;
+          } // if
+
+          // the claimed cells stay full until released below, producers
+          // can't touch them and consumers have to move _dequeue_pos first
+          if (__atomic_compare_exchange_n(&_dequeue_pos, &pos, pos + num, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+        } // while
+
+        for(size_type i = 0; i < num; i++) {
+          T item;
+          release(&_cells[(pos + i) & _mask], pos + i, item);
+          ret.push_back(item);
+        } // for
+
+        return num;
+      } // dequeue
+
+      // approximate while producers or consumers are active
+      size_type size() const {
+        size_type dequeue_pos = __atomic_load_n(&_dequeue_pos, __ATOMIC_RELAXED);
+        size_type enqueue_pos = __atomic_load_n(&_enqueue_pos, __ATOMIC_RELAXED);
+        return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+      } // size
+
+      bool empty() const { return size() == 0; }
+      size_type capacity() const { return _mask + 1; }
+
+    private:
+      RingQueue(const RingQueue &);
+      RingQueue &operator=(const RingQueue &);
+
+      struct cell_t {
+        size_type sequence;
+        T data;
+      }; // cell_t
+
+      void release(cell_t *cell, const size_type pos, T &ret) {
+        ret = cell->data;
+        cell->data = T();
+        __atomic_store_n(&cell->sequence, pos + _mask + 1, __ATOMIC_RELEASE);
+      } // release
+
+      static size_type round_up(const size_type capacity) {
+        size_type ret = 2;
+        while(ret < capacity) ret <<= 1;
+        return ret;
+      } // round_up
+
+      // keep the counters on their own cache lines, producers and
+      // consumers would otherwise invalidate each other on every op
+      enum { kCacheLine = 64 };
+
+      const size_type _mask;
+      std::vector<cell_t> _cells;
+      char _pad0[kCacheLine];
+      size_type _enqueue_pos;
+      char _pad1[kCacheLine - sizeof(size_type)];
+      size_type _dequeue_pos;
+      char _pad2[kCacheLine - sizeof(size_type)];
+  }; // class RingQueue
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
@@ -26,10 +26,15 @@
 #ifndef APNSPUSHER_STORE_H
 #define APNSPUSHER_STORE_H
 
+#include <map>
+#include <string>
+#include <vector>
+
 #include <openframe/openframe.h>
 #include <openstats/StatsClient_Interface.h>
 
 #include "DBI.h"
+#include "MemcachedController.h"
 
 namespace apnspusher {
 
@@ -51,11 +56,19 @@ namespace apnspusher {
   typedef apns_registers_t::const_iterator apns_registers_citr;
   typedef apns_registers_t::size_type apns_registers_st;
 
-  class MemcachedController;
+  // upper cased callsign to its registers, empty when not registered
+  typedef std::map<std::string, apns_registers_t> apns_register_map_t;
+  typedef apns_register_map_t::iterator apns_register_map_itr;
+
+  class RegisterCache;
+  class RegisterFilter;
+  class RegisterFlight;
+  class RegisterIndex;
   class Store : public openframe::LogObject,
                 public openstats::StatsClient_Interface {
     public:
       static const time_t kDefaultReportInterval;
+      static const time_t kDefaultRegisterExpire;
 
         Store(const thread_id_t thread_id,
               const std::string &host,
@@ -67,6 +80,38 @@ namespace apnspusher {
               const time_t report_interval=kDefaultReportInterval);
         virtual ~Store();
         Store &init();
+
+        // process wide register cache consulted before memcached
+        Store &set_cache(RegisterCache *cache) {
+          _cache = cache;
+          return *this;
+        } // set_cache
+
+        // process wide table of lookups on their way to SQL, a callsign
+        // another Store is already querying is waited for instead
+        Store &set_flight(RegisterFlight *flight) {
+          _flight = flight;
+          return *this;
+        } // set_flight
+
+        // process wide index of every registration, once loaded it
+        // answers every lookup and nothing goes to memcached or SQL
+        Store &set_index(RegisterIndex *index) {
+          _index = index;
+          return *this;
+        } // set_index
+
+        bool loadApnsRegisterIndex();
+        bool syncApnsRegisterIndex();
+        void abandonApnsRegisterIndex(const std::vector<std::string> &keys);
+
+        // how long register entries live in memcached, raise it when
+        // register changes are subscribed to and evict entries early
+        Store &set_register_expire(const time_t register_expire) {
+          _register_expire = register_expire;
+          return *this;
+        } // set_register_expire
+
         void onDescribeStats();
         void onDestroyStats();
 
@@ -77,11 +122,45 @@ namespace apnspusher {
 
         bool getApnsRegisterFromMemcached(const std::string &callsign, std::string &ret);
         bool setApnsRegisterInMemcached(const std::string &callsign, const std::string &buf, const time_t expire);
+        bool removeApnsRegisterFromMemcached(const std::string &callsign);
+        size_t getApnsRegistersFromMemcached(const std::vector<std::string> &keys,
+                                             MemcachedController::mgetResultType &ret);
+
+        // process wide filter of registered callsigns, lookups for
+        // anything it rules out never reach memcached or SQL
+        Store &set_filter(RegisterFilter *filter) {
+          _filter = filter;
+          return *this;
+        } // set_filter
+
+        bool loadApnsRegisterFilter();
+
+        // write register entries to memcached in the compact binary
+        // format, reads accept either format so this can be switched
+        // on once every reader understands it
+        Store &set_memcached_binary(const bool memcached_binary) {
+          _memcached_binary = memcached_binary;
+          return *this;
+        } // set_memcached_binary
+
+        bool getApnsRegisterFromIndex(const std::string &key, apns_registers_t &ret);
+        bool getApnsRegisterFromCache(const std::string &key, apns_registers_t &ret);
+        void setApnsRegisterInCache(const std::string &key, const apns_registers_t &registers);
 
         apns_registers_st getApnsRegisterByCallsign(const std::string &callsign,
                                                     apns_registers_t &ret);
+        // resolves every callsign with at most one memcached exchange
+        // and one SQL query, returns the number of callsigns found
+        size_t getApnsRegistersByCallsigns(const std::vector<std::string> &callsigns,
+                                           apns_register_map_t &ret);
         openframe::DBI::simpleResultSizeType setApnsPush(const std::string &id,
                                                          const std::string &message);
+        openframe::DBI::simpleResultSizeType setApnsPushes(const std::vector<apns_push_t> &pushes);
+
+        // records feedback, deactivates the reported tokens and evicts
+        // the callsigns they belonged to, returns the tokens deactivated
+        size_t pruneApnsRegisters(const std::vector<apns_feedback_t> &feedbacks,
+                                  size_t &num_evicted);
 
 //        openframe::DBI::resultSizeType getApnsRegisterByCallsign(const std::string &callsign,
 //                                                                 openframe::DBI::resultType &res);
@@ -90,11 +169,28 @@ namespace apnspusher {
 
     protected:
       void try_stompstats();
+      void try_filter();
+      void try_index();
       bool isMemcachedOk() const { return _last_cache_fail_at < time(NULL) - 60; }
+      bool decodeApnsRegister(const std::string &callsign, const std::string &buf,
+                              apns_registers_t &ret, bool &found);
+      std::string encodeApnsRegister(const apns_registers_t &registers);
+      void getApnsRegistersFromSql(const std::vector<std::string> &keys,
+                                   apns_register_map_t &ret,
+                                   const bool land);
+      // ttl less up to a tenth, so entries loaded together don't all
+      // expire together
+      time_t jitter(const time_t ttl);
 
     private:
       DBI_Apns *_dbi;			// new Injection handler
       MemcachedController *_memcached;	// memcached controller instance
+      RegisterCache *_cache;		// shared local register cache
+      RegisterFilter *_filter;		// shared registered callsign filter
+      RegisterFlight *_flight;		// shared lookups in flight
+      RegisterIndex *_index;		// shared register index
+      int _index_reader;			// our slot in it, -1 none
+      bool _index_attached;
       openframe::Stopwatch *_profile;
 
       // contructor vars
@@ -105,6 +201,9 @@ namespace apnspusher {
       std::string _memcached_host;
       time_t _expire_interval;
       time_t _last_cache_fail_at;
+      bool _memcached_binary;
+      time_t _register_expire;
+      unsigned int _seed;
 
       struct memcache_stats_t {
         unsigned int hits;
@@ -121,9 +220,25 @@ namespace apnspusher {
         unsigned int failed;
       };
 
+      struct filter_stats_t {
+        unsigned int tries;
+        unsigned int rejects;
+        unsigned int false_positives;
+      }; // filter_stats_t
+
+      struct flight_stats_t {
+        unsigned int led;
+        unsigned int coalesced;
+        unsigned int timeouts;
+      }; // flight_stats_t
+
       struct obj_stats_t {
+        filter_stats_t filter;
+        flight_stats_t flight;
         memcache_stats_t cache_message;
         memcache_stats_t cache_register;
+        memcache_stats_t cache_local;
+        memcache_stats_t index_register;
         sql_stats_t sql_register;
         time_t last_report_at;
         time_t report_interval;
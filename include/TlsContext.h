@@ -0,0 +1,92 @@
+#ifndef APNSPUSHER_TLSCONTEXT_H
+#define APNSPUSHER_TLSCONTEXT_H
+
+#include <map>
+#include <string>
+
+#include <openssl/ssl.h>
+
+#include <openframe/openframe.h>
+
+namespace apnspusher {
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // The client SSL_CTX for one certificate, shared by every connection
+  // made with it.  It keeps the last session each host:port handed out
+  // so the next connection there resumes it, an abbreviated handshake
+  // without the certificate exchange, instead of starting over.
+  class TlsContext : public openframe::OpenFrame_Abstract {
+    public:
+      static const int kConnectTimeout;
+
+      TlsContext(const std::string &cert,
+                 const std::string &key,
+                 const std::string &capath,
+                 const bool verify);
+      virtual ~TlsContext();
+
+      bool verify() const { return _verify; }
+
+      // hand record encryption to the kernel after the handshake where
+      // both it and OpenSSL support kTLS, plain SSL_write otherwise
+      TlsContext &set_ktls(const bool ktls) {
+        _ktls = ktls;
+        return *this;
+      } // set_ktls
+      bool ktls() const { return _ktls; }
+      // whether ssl's writes actually go through the kernel
+      static bool ktls_send(SSL *ssl);
+
+      // an SSL on sock set up to resume the last session with host:port,
+      // NULL when the certificate can't be loaded
+      SSL *open(const int sock, const std::string &host, const int port);
+      // sessions from a host we fail to talk to aren't worth resuming
+      void forget(const std::string &host, const int port);
+      // resolves host, connects and completes the handshake, blocking
+      // for at most kConnectTimeout at each step; alpn is the wire
+      // format protocol list, asking for one also requires TLS 1.2 as
+      // HTTP/2 does.  NULL on failure; the SSL doesn't own its socket,
+      // the caller closes SSL_get_fd() after SSL_free()
+      SSL *connect(const std::string &host, const int port,
+                   const std::string &alpn="", bool *resumed=NULL);
+
+      // the oldest queued OpenSSL error, the queue is cleared
+      static std::string error();
+
+    protected:
+      bool init();
+      static int new_session_cb(SSL *ssl, SSL_SESSION *session);
+
+    private:
+      TlsContext(const TlsContext &);
+      TlsContext &operator=(const TlsContext &);
+
+      typedef std::map<std::string, SSL_SESSION *> sessions_t;
+
+      // constructor variables
+      std::string _cert;
+      std::string _key;
+      std::string _capath;
+      bool _verify;
+
+      bool _ktls;
+      SSL_CTX *_ctx;
+      sessions_t _sessions;			// host:port to its last session
+      openframe::OFLock _sessions_l;
+  }; // class TlsContext
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apnspusher
+#endif
@@ -9,6 +9,9 @@
 #include <openstats/openstats.h>
 #include <stomp/Stomp.h>
 
+#include "EventWait.h"
+#include "FlowControl.h"
+
 namespace apnspusher {
 /**************************************************************************
  ** General Defines                                                      **
@@ -18,8 +21,8 @@ namespace apnspusher {
  ** Structures                                                           **
  **************************************************************************/
 
-  class Store;
-  class APNS;
+  template<typename T> class BoundedQueue;
+  struct notify_message_t;
   class Worker_Exception : public openframe::OpenFrame_Exception {
     public:
       Worker_Exception(const std::string message) throw() : openframe::OpenFrame_Exception(message) { };
@@ -30,26 +33,36 @@ namespace apnspusher {
     public:
       // ### Constants ### //
       static const int kDefaultStompPrefetch;
-      static const time_t kDefaultStatsInterval;
-      static const time_t kDefaultMemcachedExpire;
+      static const size_t kDefaultBatchSize;
+      static const time_t kDefaultBatchTimeout;
+      static const int kDefaultIdleTimeout;
+      static const int kDefaultFlowWait;
+      static const time_t kDefaultFlowDelay;
+      static const size_t kDefaultFlowFloor;
       static const char *kDefaultStompDestNotifyMessages;
 
       // ### Init ### //
       Worker(const thread_id_t thread_id,
              const std::string &stomp_hosts,
              const std::string &stomp_login,
-             const std::string &stomp_passcode,
-             const std::string &memcached_host,
-             const std::string &db_host,
-             const std::string &db_user,
-             const std::string &db_pass,
-             const std::string &db_database);
+             const std::string &stomp_passcode);
       virtual ~Worker();
       void init();
       bool run();
+      bool wait(const int timeout=kDefaultIdleTimeout);
       void try_stats();
 
       // ### Type Definitions ###
+      // client acks cumulatively once per batch, client-individual acks
+      // every message, auto leaves it to the broker on delivery
+      enum ackEnum {
+        ACK_AUTO			= 0,
+        ACK_CLIENT			= 1,
+        ACK_CLIENT_INDIVIDUAL		= 2
+      };
+
+      static ackEnum str_to_ack(const std::string &name);
+      static const char *ack_str(const ackEnum ack);
 
       // ### Options ### //
       Worker &set_console(const bool onoff) {
@@ -62,6 +75,52 @@ namespace apnspusher {
         return *this;
       } // set_no_send
 
+      // eventfd that becomes readable when the worker should stop
+      // waiting, normally the application shutdown event
+      Worker &set_wakeup(const int fd) {
+        _wakeup_fd = fd;
+        return *this;
+      } // set_wakeup
+
+      // parsed messages are handed to the lookup stage through this
+      Worker &set_lookup_queue(BoundedQueue<notify_message_t> *lookup_q) {
+        _lookup_q = lookup_q;
+        return *this;
+      } // set_lookup_queue
+
+      // a /queue/ destination deals its messages out among the workers
+      // subscribed to it, a /topic/ hands every worker its own copy
+      Worker &set_subscription(const std::string &destination, const ackEnum ack) {
+        _stomp_dest_notify_msgs = destination;
+        _ack = ack;
+        return *this;
+      } // set_subscription
+
+      // drain up to size frames, or until timeout (ms) has elapsed,
+      // per call to run() and acknowledge them with a single ack
+      Worker &set_batch(const size_t size, const time_t timeout) {
+        _batch_size = size ? size : 1;
+        _batch_timeout = timeout;
+        return *this;
+      } // set_batch
+
+      // the broker may send up to prefetch unacked messages, our window
+      // never grows past it
+      Worker &set_prefetch(const int prefetch) {
+        _prefetch = prefetch > 0 ? prefetch : 1;
+        return *this;
+      } // set_prefetch
+
+      // only read from the broker while everything queued downstream
+      // amounts to less than delay (ms) of what Apple drains, or floor
+      // messages, shared among num_workers
+      Worker &set_flow(const time_t delay, const size_t floor, const unsigned int num_workers) {
+        _flow_delay = delay;
+        _flow_floor = floor;
+        _flow_workers = num_workers;
+        return *this;
+      } // set_flow
+
       // ### StatsClient Pure Virtuals ### //
       void onDescribeStats();
       void onDestroyStats();
@@ -70,44 +129,38 @@ namespace apnspusher {
       void try_stompstats();
 
       bool process_message(const std::string &body);
-
-      struct process_message_t {
-        std::string source;
-        std::string target;
-        std::string id;
-        std::string ack;
-        std::string reply_id;
-        std::string path;
-        std::string body;
-        bool is_ackonly;
-        bool is_to_me;
-        openframe::Vars *v;
-      }; // process_message_t
-
-      bool event_message_to_apns(process_message_t &pm);
+      size_t backlog();
 
     private:
       // constructor variables
       std::string _stomp_hosts;
       std::string _stomp_login;
       std::string _stomp_passcode;
-      std::string _memcached_host;
-      std::string _db_host;
-      std::string _db_user;
-      std::string _db_pass;
-      std::string _db_database;
       std::string _aprs_dest;
 
       std::string _stomp_dest_notify_msgs;
+      ackEnum _ack;
 
-      Store *_store;
       stomp::Stomp *_stomp;
-      APNS *_apns;
+      BoundedQueue<notify_message_t> *_lookup_q;
 
       bool _connected;
       bool _console;
       bool _no_send;
 
+      size_t _batch_size;
+      time_t _batch_timeout;
+
+      int _prefetch;
+      time_t _flow_delay;
+      size_t _flow_floor;
+      unsigned int _flow_workers;
+      FlowControl *_flow;
+      bool _throttled;				// window closed, leave stomp unread
+
+      int _wakeup_fd;
+      EventWait _events;			// stomp socket and wakeup
+
       struct create_timer_t {
         time_t last_try_at;
         time_t try_interval;
@@ -138,6 +191,9 @@ namespace apnspusher {
         unsigned int packets;
         unsigned int frames_in;
         unsigned int frames_out;
+        unsigned int batches;
+        unsigned int acks;
+        unsigned int throttled;
         time_t report_interval;
         time_t last_report_at;
         time_t created_at;
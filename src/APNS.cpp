@@ -23,7 +23,9 @@
  $Id: APNS.cpp,v 1.12 2003/09/05 22:23:41 omni Exp $
  **************************************************************************/
 
+#include <algorithm>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <queue>
 #include <cstdlib>
@@ -32,6 +34,7 @@
 #include <cassert>
 #include <list>
 #include <map>
+#include <vector>
 #include <new>
 #include <iostream>
 #include <fstream>
@@ -49,13 +52,18 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <math.h>
+#include <poll.h>
 #include <signal.h>
+#include <sys/eventfd.h>
 
 #include <openframe/openframe.h>
 #include <apns/apns.h>
 
 #include "App.h"
 #include "APNS.h"
+#include "GatewayClient.h"
+#include "Http2Client.h"
+#include "TlsContext.h"
 
 namespace apnspusher {
   using namespace openframe::loglevel;
@@ -69,70 +77,157 @@ namespace apnspusher {
   const char *APNS::kDefaultKey				= "Certs/apn-prod-key.pem";
 
   const char *APNS::kDefaultPushHost			= "gateway.push.apple.com";
+  const char *APNS::kDefaultSandboxPushHost		= "gateway.sandbox.push.apple.com";
   const int APNS::kDefaultPushPort			= 2195;
   const time_t APNS::kDefaultPushTimeout		= 3600;
 
   const char *APNS::kDefaultFeedbackHost		= "gateway.push.apple.com";
+  const char *APNS::kDefaultSandboxFeedbackHost		= "feedback.sandbox.push.apple.com";
   const int APNS::kDefaultFeedbackPort			= 2196;
   const time_t APNS::kDefaultFeedbackInterval		= 86400;
 
-  APNS::APNS(const unsigned int num_threads,
-             const bool enable_feedback)
-       : _num_threads(num_threads),
-         _enable_feedback(enable_feedback),
-         _done(false) {
+  const char *APNS::kDefaultHttp2Host			= "api.push.apple.com";
+  const char *APNS::kDefaultSandboxHttp2Host		= "api.sandbox.push.apple.com";
+  const int APNS::kDefaultHttp2Port			= 443;
+  const size_t APNS::kDefaultHttp2Streams		= 1000;
+
+  const time_t APNS::kDefaultPushExpiry			= 86400;
+
+  const size_t APNS::kDefaultQueueSize			= 4096;
+  const int APNS::kDefaultIdleWait			= 1000;
+  const int APNS::kDefaultBusyWait			= 10;
+
+  APNS::APNS(const size_t queue_size)
+       : _done(false),
+         _drain_by(0),
+         _transport(TRANSPORT_BINARY),
+         _ktls(false),
+         _taken(0),
+         _drained(0) {
 
     try {
       _cfg = new openframe::ConfController();
+      for(int i = 0; i < ENVIRONMENT_MAX; i++)
+        _pools[i].message_q = new messages_t(queue_size);
     } // try
     catch(std::bad_alloc xa) {
       assert(false);
     } // catch
 
-    set_cert(kDefaultCert,
-             kDefaultKey);
+    for(int i = 0; i < ENVIRONMENT_MAX; i++) {
+      environmentEnum environment = environmentEnum(i);
+      pool_t &pool = _pools[i];
+
+      pool.wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      pool.tls = NULL;
+
+      set_pool(environment, 1, false);
 
-    set_push(kDefaultPushHost,
-             kDefaultPushPort,
-             kDefaultPushTimeout);
+      set_cert(environment,
+               kDefaultCert,
+               kDefaultKey);
 
-    set_feedback(kDefaultFeedbackHost,
-                 kDefaultFeedbackPort,
-                 kDefaultFeedbackInterval);
+      set_push(environment,
+               environment == ENVIRONMENT_PROD ? kDefaultPushHost : kDefaultSandboxPushHost,
+               kDefaultPushPort,
+               kDefaultPushTimeout);
+
+      set_feedback(environment,
+                   environment == ENVIRONMENT_PROD ? kDefaultFeedbackHost : kDefaultSandboxFeedbackHost,
+                   kDefaultFeedbackPort,
+                   kDefaultFeedbackInterval);
+
+      set_http2(environment,
+                environment == ENVIRONMENT_PROD ? kDefaultHttp2Host : kDefaultSandboxHttp2Host,
+                kDefaultHttp2Port);
+    } // for
+
+    set_transport(TRANSPORT_BINARY, "", kDefaultHttp2Streams);
+    set_coalesce(GatewayClient::kDefaultRecordSize, GatewayClient::kDefaultFlushDelay);
 
     return;
   } // APNS::APNS
 
   APNS::~APNS() {
+    for(int i = 0; i < ENVIRONMENT_MAX; i++) {
+      pool_t &pool = _pools[i];
+      if (pool.wakeup_fd >= 0) close(pool.wakeup_fd);
+      delete pool.message_q;
+      delete pool.tls;
+    } // for
+
     delete _cfg;
     return;
   } // APNS::~APNS
 
-  APNS &APNS::set_cert(const std::string &cert,
+  const char *APNS::environment_str(const environmentEnum environment) {
+    return environment == ENVIRONMENT_PROD ? "prod" : "sandbox";
+  } // APNS::environment_str
+
+  APNS &APNS::set_pool(const environmentEnum environment,
+                       const unsigned int num_threads,
+                       const bool enable_feedback) {
+    _pools[environment].num_threads = num_threads;
+    _pools[environment].enable_feedback = enable_feedback;
+    return *this;
+  } // APNS::set_pool
+
+  APNS &APNS::set_cert(const environmentEnum environment,
+                       const std::string &cert,
                        const std::string &key) {
-    _cfg->replace_string("cert", cert);
-    _cfg->replace_string("key", key);
+    _cfg->replace_string(this->key(environment, "cert"), cert);
+    _cfg->replace_string(this->key(environment, "key"), key);
     return *this;
   } // APNS::set_cert
 
-  APNS &APNS::set_push(const std::string &host,
+  APNS &APNS::set_push(const environmentEnum environment,
+                       const std::string &host,
                        const int port,
                        const time_t timeout) {
-    _cfg->replace_string("push.host", host);
-    _cfg->replace_int("push.port", port);
-    _cfg->replace_int("push.timeout", timeout);
+    _cfg->replace_string(key(environment, "push.host"), host);
+    _cfg->replace_int(key(environment, "push.port"), port);
+    _cfg->replace_int(key(environment, "push.timeout"), timeout);
     return *this;
   } // APNS::set_push
 
-  APNS &APNS::set_feedback(const std::string &host,
-                                const int port,
-                                const time_t interval) {
-    _cfg->replace_string("feedback.host", host);
-    _cfg->replace_int("feedback.port", port);
-    _cfg->replace_int("feedback.interval", interval);
+  APNS &APNS::set_feedback(const environmentEnum environment,
+                           const std::string &host,
+                           const int port,
+                           const time_t interval) {
+    _cfg->replace_string(key(environment, "feedback.host"), host);
+    _cfg->replace_int(key(environment, "feedback.port"), port);
+    _cfg->replace_int(key(environment, "feedback.interval"), interval);
     return *this;
   } // APNS::set_feedback
 
+  APNS &APNS::set_transport(const transportEnum transport,
+                            const std::string &topic,
+                            const size_t max_streams) {
+    _transport = transport;
+    _cfg->replace_string("topic", topic);
+    _cfg->replace_int("http2.streams", max_streams);
+    return *this;
+  } // APNS::set_transport
+
+  APNS &APNS::set_coalesce(const size_t record_size, const int delay) {
+    _cfg->replace_int("coalesce.record", record_size);
+    _cfg->replace_int("coalesce.delay", delay);
+    return *this;
+  } // APNS::set_coalesce
+
+  APNS &APNS::set_ktls(const bool ktls) {
+    _ktls = ktls;
+    return *this;
+  } // APNS::set_ktls
+
+  APNS &APNS::set_http2(const environmentEnum environment,
+                        const std::string &host,
+                        const int port) {
+    _cfg->replace_string(key(environment, "http2.host"), host);
+    _cfg->replace_int(key(environment, "http2.port"), port);
+    return *this;
+  } // APNS::set_http2
+
   APNS &APNS::start() {
     // initialize OpenSSL library
     SSL_library_init();
@@ -144,52 +239,93 @@ namespace apnspusher {
 
     pthread_t sslThread_id;
 
-    // create our signal handling thread
-    for(unsigned int i=0; i < _num_threads; i++) {
-      openframe::ThreadMessage *tm = new openframe::ThreadMessage(i);
-      tm->var->push_void("apns", this);
-      tm->var->push_void("message_q", &_message_q);
-
-      tm->var->push_string("host", _cfg->get_string("push.host") );
-      tm->var->push_int("port", _cfg->get_int("push.port") );
-      tm->var->push_string("cert", _cfg->get_string("cert") );
-      tm->var->push_string("key", _cfg->get_string("key") );
-      tm->var->push_string("path", kDefaultCaPath );
-      tm->var->push_int("timeout", _cfg->get_int("push.timeout") );
-
-      pthread_create(&sslThread_id, NULL, APNS::SslThread, tm);
-      LOG(LogInfo, << "Push SSL Thread Started #"
-                   << i
-                   << ", id "
-                   << sslThread_id
-                   << std::endl);
-      _sslThreads.insert(sslThread_id);
+    for(int env = 0; env < ENVIRONMENT_MAX; env++) {
+      environmentEnum environment = environmentEnum(env);
+      pool_t &pool = _pools[env];
+
+      // one certificate and session cache for the whole pool, so a
+      // reconnect resumes whatever session any of its threads last had
+      pool.tls = new TlsContext(_cfg->get_string(key(environment, "cert")),
+                                _cfg->get_string(key(environment, "key")),
+                                kDefaultCaPath,
+                                true);
+      pool.tls->elogger( elogger(), elog_name() );
+      pool.tls->set_ktls(_ktls);
+
+      for(unsigned int i=0; i < pool.num_threads; i++) {
+        openframe::ThreadMessage *tm = new openframe::ThreadMessage(i);
+        tm->var->push_void("apns", this);
+        tm->var->push_void("message_q", pool.message_q);
+        tm->var->push_int("environment", environment);
+
+        tm->var->push_string("cert", _cfg->get_string(key(environment, "cert")) );
+        tm->var->push_string("key", _cfg->get_string(key(environment, "key")) );
+        tm->var->push_string("path", kDefaultCaPath );
+        tm->var->push_int("wakeup_fd", pool.wakeup_fd);
+        tm->var->push_void("tls", pool.tls);
+
+        if (_transport == TRANSPORT_HTTP2) {
+          tm->var->push_string("host", _cfg->get_string(key(environment, "http2.host")) );
+          tm->var->push_int("port", _cfg->get_int(key(environment, "http2.port")) );
+          tm->var->push_string("topic", _cfg->get_string("topic") );
+          tm->var->push_int("streams", _cfg->get_int("http2.streams") );
+          pthread_create(&sslThread_id, NULL, APNS::Http2Thread, tm);
+        } // if
+        else {
+          tm->var->push_string("host", _cfg->get_string(key(environment, "push.host")) );
+          tm->var->push_int("port", _cfg->get_int(key(environment, "push.port")) );
+          tm->var->push_int("timeout", _cfg->get_int(key(environment, "push.timeout")) );
+          tm->var->push_int("record", _cfg->get_int("coalesce.record") );
+          tm->var->push_int("delay", _cfg->get_int("coalesce.delay") );
+          pthread_create(&sslThread_id, NULL, APNS::SslThread, tm);
+        } // else
+
+        LOG(LogInfo, << "Push "
+                     << (_transport == TRANSPORT_HTTP2 ? "HTTP/2" : "SSL")
+                     << " Thread Started "
+                     << environment_str(environment)
+                     << " #"
+                     << i
+                     << ", id "
+                     << sslThread_id
+                     << std::endl);
+        _sslThreads.insert(sslThread_id);
+      } // for
+
+      if (pool.enable_feedback) {
+        openframe::ThreadMessage *tm = new openframe::ThreadMessage(0);
+        tm->var->push_void("apns", this);
+        tm->var->push_void("feedback_q", &_feedback_q);
+
+        tm->var->push_string("host", _cfg->get_string(key(environment, "feedback.host")) );
+        tm->var->push_int("port", _cfg->get_int(key(environment, "feedback.port")) );
+        tm->var->push_string("cert", _cfg->get_string(key(environment, "cert")) );
+        tm->var->push_string("key", _cfg->get_string(key(environment, "key")) );
+        tm->var->push_string("path", kDefaultCaPath);
+        tm->var->push_int("interval", _cfg->get_int(key(environment, "feedback.interval")) );
+
+        pthread_create(&sslThread_id, NULL, APNS::FeedbackThread, tm);
+        LOG(LogInfo, << "Feedback SSL Thread Started "
+                     << environment_str(environment)
+                     << ", id "
+                     << sslThread_id
+                     << std::endl);
+        _sslThreads.insert(sslThread_id);
+      } // if
     } // for
 
-    if (_enable_feedback) {
-      openframe::ThreadMessage *tm = new openframe::ThreadMessage(0);
-      tm->var->push_void("apns", this);
-      tm->var->push_void("feedback_q", &_feedback_q);
-
-      tm->var->push_string("host", _cfg->get_string("feedback.host") );
-      tm->var->push_int("port", _cfg->get_int("feedback.port") );
-      tm->var->push_string("cert", _cfg->get_string("cert") );
-      tm->var->push_string("key", _cfg->get_string("key") );
-      tm->var->push_string("path", kDefaultCaPath);
-      tm->var->push_int("interval", _cfg->get_int("feedback.interval") );
-
-      pthread_create(&sslThread_id, NULL, APNS::FeedbackThread, tm);
-      LOG(LogInfo, << "Feedback SSL Thread Started id "
-                   << sslThread_id
-                   << std::endl);
-      _sslThreads.insert(sslThread_id);
-    } // if
-
     return *this;
   } // APNS::start
 
-  void APNS::stop() {
-    set_done();
+  void APNS::stop(const time_t drain) {
+    {
+      openframe::scoped_lock slock(&_done_l);
+      _drain_by = time(NULL) + drain;
+      _done = true;
+    } // scoped_lock
+
+    for(int i = 0; i < ENVIRONMENT_MAX; i++)
+      signal(_pools[i]);
 
     // create our signal handling thread
     //pthread_cancel(_sslThread_tid);
@@ -212,53 +348,393 @@ namespace apnspusher {
 
   } // APNS::stop
 
-  void APNS::push(apns::ApnsMessage *aMessage) {
-    assert(aMessage != NULL);
-    _message_q.enqueue(aMessage);
+  void APNS::signal(pool_t &pool) {
+    // both transports sleep in poll() on their connection and this
+    if (pool.wakeup_fd >= 0) {
+      uint64_t one = 1;
+      if (write(pool.wakeup_fd, &one, sizeof(one)) < 0) { }
+    } // if
+  } // APNS::signal
+
+  bool APNS::push(const notification_t &notification, const environmentEnum environment) {
+    pool_t &pool = _pools[environment];
+    if (!pool.num_threads) return false;
+
+    queued_message_t qm;
+    qm.notification = notification;
+    clock_gettime(CLOCK_MONOTONIC, &qm.queued_at);
+
+    // the ring is bounded, when the ssl threads fall that far behind
+    // hold the pusher back until they catch up
+    while( !pool.message_q->enqueue(qm) ) {
+      // a connection that can't keep up must not hold up shutdown
+      if ( is_done() || app->is_abandoned() ) return false;
+
+      signal(pool);
+      usleep(kDefaultBusyWait * 1000);
+    } // while
+
+    signal(pool);
+    return true;
   } // APNS::push
 
+  size_t APNS::backlog() const {
+    size_t backlog = 0;
+    for(int i = 0; i < ENVIRONMENT_MAX; i++)
+      backlog += _pools[i].message_q->size();
+
+    // drained first, it never runs ahead of what was taken
+    unsigned long long drained = __atomic_load_n(&_drained, __ATOMIC_ACQUIRE);
+    unsigned long long taken = __atomic_load_n(&_taken, __ATOMIC_ACQUIRE);
+    if (taken > drained) backlog += taken - drained;
+    return backlog;
+  } // APNS::backlog
+
+  Payload APNS::payload(const std::string &text,
+                        const std::string &action,
+                        const int badge) {
+    return Payload( Http2Client::payload(text, action, badge) );
+  } // APNS::payload
+
   void *APNS::SslThread(void *args) {
     openframe::ThreadMessage *tm = static_cast<openframe::ThreadMessage *>(args);
     openframe::VarController *cfg = tm->var;
     APNS *apns = static_cast<APNS *>( tm->var->get_void("apns") );
     messages_t *message_q = static_cast<messages_t *>( tm->var->get_void("message_q") );
+    environmentEnum environment = environmentEnum( tm->var->get_int("environment") );
+    int wakeup_fd = tm->var->get_int("wakeup_fd");
 
     int maxQueue = app->cfg->get_int("app.apns.ssl.maxqueue", 100);
     int logStatsInterval = app->cfg->get_int("app.apns.ssl.stats.interval", apns::PushController::DEFAULT_STATS_INTERVAL);
 
-    apns::PushController *push;		// prod version
-    push = new apns::PushController(cfg->get_string("host"),
-                                    cfg->get_int("port"),
-                                    cfg->get_string("cert"),
-                                    cfg->get_string("key"),
-                                    cfg->get_string("path"),
-                                    cfg->get_int("timeout")
-                                   );
-
-    push->elogger( apns->elogger(), apns->elog_name() );
-    push->logStatsInterval(logStatsInterval);
+    GatewayClient *gateway = new GatewayClient(cfg->get_string("host"),
+                                               cfg->get_int("port"),
+                                               cfg->get_string("cert"),
+                                               cfg->get_string("key"),
+                                               cfg->get_string("path"),
+                                               cfg->get_int("timeout")
+                                              );
+    gateway->elogger( apns->elogger(), apns->elog_name() );
+    gateway->set_tls( static_cast<TlsContext *>( cfg->get_void("tls") ) );
+    gateway->set_flush( cfg->get_int("record"), cfg->get_int("delay") );
+    gateway->set_resend_window( app->cfg->get_int("app.apns.ssl.resend", GatewayClient::kDefaultResendWindow) );
+
+    // enqueue to write latency, reported every logStatsInterval
+    double latency_total = 0.0;
+    double latency_max = 0.0;
+    unsigned int latency_count = 0;
+    unsigned int num_invalid = 0;
+    time_t last_report_at = time(NULL);
+    time_t next_connect_at = 0;
+    int backoff = 1;
+    uint32_t identifier = 0;
+
+    std::vector<struct timespec> added;
+    added.reserve(maxQueue);
+    unsigned long long num_written = 0;
+    messages_t::items_t batch;
+    batch.reserve(maxQueue);
+    GatewayClient::rejections_t rejections;
 
     while(true) {
-      if ( apns->is_done() ) break;
+      // asked to stop, send what is queued and written first
+      if ( apns->is_stopped(message_q->empty() && gateway->buffered() == 0 && !gateway->resend_pending()) ) break;
 
       pthread_testcancel();
 
-      apns::ApnsMessage *msg;
-      while(push->sendQueueSize() < maxQueue && message_q->dequeue(msg)) {
-        push->add(msg);
-      } // while
+      // Apple hangs up on idle connections, only hold one while there
+      // is something to send
+      if (!gateway->is_connected()) {
+        if ((message_q->empty() && !gateway->resend_pending()) || time(NULL) < next_connect_at) {
+          struct pollfd pfd;
+          pfd.fd = wakeup_fd;
+          pfd.events = POLLIN;
+          if (poll(&pfd, 1, kDefaultIdleWait) > 0) {
+            uint64_t count;
+            if (read(wakeup_fd, &count, sizeof(count)) < 0) { }
+          } // if
+          continue;
+        } // if
+
+        if (gateway->connect()) backoff = 1;
+        else {
+          next_connect_at = time(NULL) + backoff;
+          backoff = std::min(backoff * 2, 60);
+          continue;
+        } // else
+      } // if
+
+      // what is queued goes into the write buffer, the gateway client
+      // cuts it into full records; while a few records still wait on
+      // the socket the backlog stays in the ring, so the write buffer,
+      // the resend window and added stay bounded
+      bool full = gateway->is_full();
+      if (!full && message_q->dequeue(batch, maxQueue) ) {
+        __atomic_add_fetch(&apns->_taken, batch.size(), __ATOMIC_RELEASE);
+        time_t expiry = time(NULL) + kDefaultPushExpiry;
+        for(messages_t::items_t::iterator itr = batch.begin(); itr != batch.end(); itr++) {
+          if (!gateway->add(itr->notification.device_token, itr->notification.payload, ++identifier, expiry)) {
+            LOG(LogWarn, << "Failed to frame APNS message for "
+                         << itr->notification.device_token
+                         << std::endl);
+            ++num_invalid;
+            // never written, but out of the backlog all the same
+            __atomic_add_fetch(&apns->_drained, 1, __ATOMIC_RELEASE);
+            continue;
+          } // if
+          added.push_back(itr->queued_at);
+        } // for
+        batch.clear();
+      } // if
+
+      // waits for the flush deadline, an error response or more work,
+      // only for the socket to drain while full
+      if (!gateway->run(kDefaultIdleWait, full ? -1 : wakeup_fd))
+        gateway->disconnect();
+
+      // drained once written to TLS, not when taken off the queue
+      if (gateway->written() != num_written) {
+        __atomic_add_fetch(&apns->_drained, gateway->written() - num_written, __ATOMIC_RELEASE);
+        num_written = gateway->written();
+      } // if
 
-      push->run();
+      // the gateway's version of the feedback service, a token it calls
+      // invalid is pruned like one reported uninstalled
+      if (gateway->rejections(rejections)) {
+        for(GatewayClient::rejections_t::iterator itr = rejections.begin(); itr != rejections.end(); itr++) {
+          LOG(LogNotice, << "Push SSL Thread "
+                         << environment_str(environment)
+                         << " notification to "
+                         << itr->frame.device_token
+                         << " rejected with status "
+                         << itr->status
+                         << std::endl);
+
+          if (itr->status != GatewayClient::STATUS_INVALID_TOKEN) continue;
+          feedback_t fb;
+          fb.device_token = itr->frame.device_token;
+          fb.timestamp = time(NULL);
+          apns->_feedback_q.enqueue(fb);
+        } // for
+        rejections.clear();
+      } // if
 
-      usleep(100000);
+      if (!added.empty() && gateway->buffered() == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for(size_t i = 0; i < added.size(); i++) {
+          double latency = double(now.tv_sec - added[i].tv_sec)
+                           + double(now.tv_nsec - added[i].tv_nsec) / 1000000000.0;
+          latency_total += latency;
+          if (latency > latency_max) latency_max = latency;
+        } // for
+        latency_count += added.size();
+        added.clear();
+      } // if
+
+      if (last_report_at <= time(NULL) - logStatsInterval) {
+        const GatewayClient::stats_t &stats = gateway->stats();
+        time_t elapsed = std::max(time(NULL) - last_report_at, time_t(1));
+
+        LOG(LogNotice, << "Push SSL Thread "
+                       << environment_str(environment)
+                       << " latency messages "
+                       << latency_count
+                       << ", average "
+                       << std::fixed << std::setprecision(4)
+                       << (latency_count ? latency_total / latency_count : 0.0)
+                       << "s, max "
+                       << latency_max
+                       << "s, records/s "
+                       << std::setprecision(2)
+                       << double(stats.records) / elapsed
+                       << ", bytes/record "
+                       << std::setprecision(0)
+                       << (stats.records ? double(stats.bytes) / stats.records : 0.0)
+                       << ", frames/record "
+                       << std::setprecision(2)
+                       << (stats.records ? double(stats.frames) / stats.records : 0.0)
+                       << ", rejected "
+                       << stats.rejected
+                       << ", resent "
+                       << stats.resent
+                       << ", invalid "
+                       << num_invalid
+                       << ", handshakes full "
+                       << stats.handshakes - stats.resumed
+                       << ", resumed "
+                       << stats.resumed
+                       << ", kernel TLS "
+                       << stats.ktls
+                       << std::endl);
+        latency_total = 0.0;
+        latency_max = 0.0;
+        latency_count = 0;
+        num_invalid = 0;
+        gateway->reset_stats();
+        last_report_at = time(NULL);
+      } // if
     } // while
 
-    delete push;
+    delete gateway;
     delete tm;
 
     return NULL;
   } // APNS::SslThread
 
+  void *APNS::Http2Thread(void *args) {
+    openframe::ThreadMessage *tm = static_cast<openframe::ThreadMessage *>(args);
+    openframe::VarController *cfg = tm->var;
+    APNS *apns = static_cast<APNS *>( tm->var->get_void("apns") );
+    messages_t *message_q = static_cast<messages_t *>( tm->var->get_void("message_q") );
+    environmentEnum environment = environmentEnum( tm->var->get_int("environment") );
+    int wakeup_fd = tm->var->get_int("wakeup_fd");
+
+    int logStatsInterval = app->cfg->get_int("app.apns.ssl.stats.interval", apns::PushController::DEFAULT_STATS_INTERVAL);
+
+    Http2Client *client = new Http2Client(cfg->get_string("host"),
+                                          cfg->get_int("port"),
+                                          cfg->get_string("cert"),
+                                          cfg->get_string("key"),
+                                          cfg->get_string("path"),
+                                          cfg->get_string("topic")
+                                         );
+    client->elogger( apns->elogger(), apns->elog_name() );
+    client->set_tls( static_cast<TlsContext *>( cfg->get_void("tls") ) );
+    client->set_max_streams( cfg->get_int("streams") );
+
+    // enqueue to answer latency and answers by status, reported
+    // every logStatsInterval
+    double latency_total = 0.0;
+    double latency_max = 0.0;
+    unsigned int latency_count = 0;
+    std::map<int, unsigned int> statuses;
+    unsigned int num_reconnects = 0;
+    time_t last_report_at = time(NULL);
+    time_t next_connect_at = 0;
+    int backoff = 1;
+
+    messages_t::items_t batch;
+    Http2Client::responses_t responses;
+
+    while(true) {
+      // asked to stop, wait for an answer to everything queued first
+      if ( apns->is_stopped(message_q->empty() && client->pending() == 0 && client->in_flight() == 0) ) break;
+
+      pthread_testcancel();
+
+      if (!client->is_connected() && time(NULL) >= next_connect_at) {
+        if (client->connect()) backoff = 1;
+        else {
+          next_connect_at = time(NULL) + backoff;
+          backoff = std::min(backoff * 2, 60);
+        } // else
+      } // if
+
+      // the ring keeps filling while we're disconnected, push() holds
+      // the pushers back once it is full
+      if (!client->is_connected()) {
+        usleep(kDefaultIdleWait * 1000);
+        continue;
+      } // if
+
+      // take as much as the open streams and a refill have room for
+      size_t room = client->room();
+      if (room > 0 && message_q->dequeue(batch, room) ) {
+        __atomic_add_fetch(&apns->_taken, batch.size(), __ATOMIC_RELEASE);
+        for(messages_t::items_t::iterator itr = batch.begin(); itr != batch.end(); itr++) {
+          Http2Client::request_t request;
+          request.device_token = itr->notification.device_token;
+          request.payload = itr->notification.payload;
+          request.queued_at = itr->queued_at;
+          request.attempts = 0;
+          client->add(request);
+        } // for
+        batch.clear();
+      } // if
+
+      // answers wake us through the socket, new work through wakeup_fd
+      if (!client->run(kDefaultIdleWait, wakeup_fd)) {
+        ++num_reconnects;
+        client->disconnect();
+      } // if
+
+      client->responses(responses);
+      if (!responses.empty()) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for(Http2Client::responses_t::iterator itr = responses.begin(); itr != responses.end(); itr++) {
+          double latency = double(now.tv_sec - itr->request.queued_at.tv_sec)
+                           + double(now.tv_nsec - itr->request.queued_at.tv_nsec) / 1000000000.0;
+          latency_total += latency;
+          if (latency > latency_max) latency_max = latency;
+          ++statuses[itr->status];
+
+          // 410 is the provider API's feedback service
+          if (itr->status == 410) {
+            feedback_t fb;
+            fb.device_token = itr->request.device_token;
+            fb.timestamp = itr->timestamp ? itr->timestamp : time(NULL);
+            apns->_feedback_q.enqueue(fb);
+          } // if
+          else if (itr->status != 200) {
+            LOG(LogNotice, << "HTTP/2 "
+                           << environment_str(environment)
+                           << " push to "
+                           << itr->request.device_token
+                           << " failed with "
+                           << itr->status
+                           << " "
+                           << itr->reason
+                           << std::endl);
+          } // else if
+        } // for
+        latency_count += responses.size();
+        // drained once answered, not when taken off the queue
+        __atomic_add_fetch(&apns->_drained, responses.size(), __ATOMIC_RELEASE);
+        responses.clear();
+      } // if
+
+      if (last_report_at <= time(NULL) - logStatsInterval) {
+        std::stringstream s;
+        for(std::map<int, unsigned int>::iterator itr = statuses.begin(); itr != statuses.end(); itr++)
+          s << ", " << itr->first << " " << itr->second;
+
+        LOG(LogNotice, << "Push HTTP/2 Thread "
+                       << environment_str(environment)
+                       << " latency messages "
+                       << latency_count
+                       << ", average "
+                       << std::fixed << std::setprecision(4)
+                       << (latency_count ? latency_total / latency_count : 0.0)
+                       << "s, max "
+                       << latency_max
+                       << "s, in flight "
+                       << client->in_flight()
+                       << ", reconnects "
+                       << num_reconnects
+                       << ", handshakes full "
+                       << client->stats().handshakes - client->stats().resumed
+                       << ", resumed "
+                       << client->stats().resumed
+                       << s.str()
+                       << std::endl);
+        latency_total = 0.0;
+        latency_max = 0.0;
+        latency_count = 0;
+        num_reconnects = 0;
+        statuses.clear();
+        client->reset_stats();
+        last_report_at = time(NULL);
+      } // if
+    } // while
+
+    delete client;
+    delete tm;
+
+    return NULL;
+  } // APNS::Http2Thread
+
   void *APNS::FeedbackThread(void *args) {
     openframe::ThreadMessage *tm = static_cast<openframe::ThreadMessage *>(args);
     openframe::VarController *cfg = tm->var;
@@ -287,8 +763,12 @@ namespace apnspusher {
       if (feedback->getQueue(removeRegisterQueue)) {
         while(!removeRegisterQueue.empty()) {
           apns::FeedbackMessage *fbm = *removeRegisterQueue.begin();
-          feedback_q->enqueue(fbm);
+          feedback_t fb;
+          fb.device_token = fbm->device_token();
+          fb.timestamp = fbm->timestamp();
+          feedback_q->enqueue(fb);
           removeRegisterQueue.erase(fbm);
+          delete fbm;
         } // while
       } // if
 
@@ -1,16 +1,27 @@
 #include "config.h"
 
+#include <algorithm>
 #include <string>
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 
 #include <signal.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include <openframe/openframe.h>
 
 #include "App.h"
+#include "APNS.h"
+#include "ChangeListener.h"
+#include "GatewayClient.h"
+#include "Pusher.h"
+#include "PushWriter.h"
+#include "Resolver.h"
 #include "Worker.h"
 
 #include "apnspusher.h"
@@ -19,9 +30,24 @@ namespace apnspusher {
   using namespace openframe::loglevel;
 
   const char *App::kPidFile		= "apnspusher.pid";
+  const size_t App::kDefaultLookupQueueSize	= 1024;
+  const size_t App::kDefaultPushQueueSize	= 1024;
+  const size_t App::kDefaultRecordQueueSize	= 4096;
+  const time_t App::kDefaultDrainTimeout	= 30;
 
   App::App(const std::string &prompt, const std::string &config, const bool console)
       : super(prompt, config, console) {
+    _wakeup_fd = -1;
+    _lookup_q = NULL;
+    _push_q = NULL;
+    _record_q = NULL;
+    _apns = NULL;
+    _register_cache = NULL;
+    _register_filter = NULL;
+    _register_flight = NULL;
+    _register_index = NULL;
+    _drain_by = 0;
+    for(int i = 0; i < STAGE_MAX; i++) _stopping[i] = false;
   } // App::App
 
   App::~App() {
@@ -55,29 +81,201 @@ namespace apnspusher {
     _stats->set_elogger(elogger(), elog_name());
     _stats->start();
 
+    // workers block on this alongside their stomp socket so that
+    // shutdown does not wait out an idle timeout
+    _wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_wakeup_fd == -1)
+      LOG(LogWarn, << "App: Unable to create wakeup eventfd; " << strerror(errno) << std::endl);
+
+    // each stage drains the queue in front of it, a slow stage only
+    // deepens its queue until the bound pushes back on the one before
+    _lookup_q = new lookup_queue_t(cfg->get_int("app.queues.lookup.size", kDefaultLookupQueueSize));
+    _push_q = new push_queue_t(cfg->get_int("app.queues.push.size", kDefaultPushQueueSize));
+    _record_q = new record_queue_t(cfg->get_int("app.queues.record.size", kDefaultRecordQueueSize));
+
+    _register_cache = new RegisterCache(cfg->get_int("app.cache.register.size", RegisterCache::kDefaultSize),
+                                        cfg->get_int("app.cache.register.ttl", RegisterCache::kDefaultTtl),
+                                        cfg->get_int("app.cache.register.negative_ttl", RegisterCache::kDefaultNegativeTtl),
+                                        cfg->get_int("app.cache.register.shards", RegisterCache::kDefaultShards)
+                                       );
+    _register_flight = new RegisterFlight(cfg->get_int("app.cache.register.flight_wait", RegisterFlight::kDefaultWait));
+
+    if ( cfg->get_bool("app.index.register.enable", false) ) {
+      _register_index = new RegisterIndex(cfg->get_int("app.index.register.sync", RegisterIndex::kDefaultSyncInterval),
+                                          cfg->get_int("app.index.register.reload", RegisterIndex::kDefaultReloadInterval)
+                                         );
+    } // if
+
+    if ( cfg->get_bool("app.filter.register.enable", false) ) {
+      _register_filter = new RegisterFilter(cfg->get_int("app.filter.register.interval", RegisterFilter::kDefaultRefreshInterval),
+                                            RegisterFilter::kDefaultFalsePositiveRate
+                                           );
+    } // if
+
+    // one set of connections to Apple for the whole process, sized by
+    // app.apns.<environment>.push to the outbound rate rather than to
+    // the number of pusher threads feeding it
+    _apns = new APNS(cfg->get_int("app.apns.queue.size", APNS::kDefaultQueueSize));
+    _apns->elogger( elogger(), elog_name() );
+    // app.apns.transport picks the legacy binary gateway or the HTTP/2
+    // provider API, the pools and certificates are the same for both
+    std::string transport = cfg->get_string("app.apns.transport", "binary");
+    _apns->set_transport(!strcasecmp(transport.c_str(), "http2") ? APNS::TRANSPORT_HTTP2 : APNS::TRANSPORT_BINARY,
+                         cfg->get_string("app.apns.topic", ""),
+                         cfg->get_int("app.apns.http2.streams", APNS::kDefaultHttp2Streams)
+                        );
+    _apns->set_coalesce(cfg->get_int("app.apns.coalesce.record", GatewayClient::kDefaultRecordSize),
+                        cfg->get_int("app.apns.coalesce.delay", GatewayClient::kDefaultFlushDelay)
+                       );
+    _apns->set_ktls( cfg->get_bool("app.apns.ssl.ktls", false) );
+    init_apns_pool(APNS::ENVIRONMENT_SANDBOX);
+    init_apns_pool(APNS::ENVIRONMENT_PROD);
+
+    _apns->start();
+
+    start_threads("PushWriterThread", cfg->get_int("app.threads.writer", 1), App::PushWriterThread, _stages[STAGE_RECORD]);
+    start_threads("PusherThread", cfg->get_int("app.threads.pusher", 1), App::PusherThread, _stages[STAGE_PUSH]);
+    start_threads("ResolverThread", cfg->get_int("app.threads.resolver", 1), App::ResolverThread, _stages[STAGE_LOOKUP]);
+    // workers only share the load when the broker deals messages out
+    // among them, subscribed to a topic each one gets every message
     int num_workers = cfg->get_int("app.threads.worker", 0);
-    for(int i=0; i < num_workers; i++) {
+    std::string destination = cfg->get_string("app.threads.worker.stomp.destination", Worker::kDefaultStompDestNotifyMessages);
+    if (num_workers > 1 && !destination.compare(0, 7, "/topic/"))
+      LOG(LogWarn, << "App: "
+                   << num_workers
+                   << " workers subscribed to topic "
+                   << destination
+                   << " will each push every message, use a /queue/ destination"
+                   << std::endl);
+    start_threads("WorkerThread", num_workers, App::WorkerThread, _stages[STAGE_RECEIVE]);
+    // a topic hands every instance its own copy of each change, one
+    // listener per instance is enough
+    if (!cfg->get_string("app.threads.worker.stomp.changes", ChangeListener::kDefaultStompDestRegisterChanges).empty())
+      start_threads("ChangeListenerThread", 1, App::ChangeListenerThread, _stages[STAGE_RECEIVE]);
+  } // App::onInitializeThreads
+
+  void App::start_threads(const std::string &name, const int num, void *(*func)(void *), workers_t &threads) {
+    for(int i=0; i < num; i++) {
       openframe::ThreadMessage *tm = new openframe::ThreadMessage(i+1);
       tm->var->push_void("app", app);
       tm->var->push_int("id", i+1);
       pthread_t thread_id;
-      pthread_create(&thread_id, NULL, App::WorkerThread, tm);
-      LOG(LogNotice, << "App: WorkerThread " << thread_id << " Initialized" << std::endl);
-      _workers.push_back(thread_id);
+      pthread_create(&thread_id, NULL, func, tm);
+      LOG(LogNotice, << "App: " << name << " " << thread_id << " Initialized" << std::endl);
+      threads.push_back(thread_id);
     } // for
-  } // App::onInitializeThreads
+  } // App::start_threads
+
+  void App::join_threads(workers_t &threads) {
+    while(!threads.empty()) {
+      pthread_t thread_id = threads.front();
+      LOG(LogNotice, << "App: Waiting for thread " << thread_id << " to Deinitialize" << std::endl);
+      pthread_join(thread_id, NULL);
+      threads.pop_front();
+    } // while
+  } // App::join_threads
+
+  bool App::is_drained(const stageEnum stage) {
+    if (stage == STAGE_RECEIVE) return is_done();
+    if (!__atomic_load_n(&_stopping[stage], __ATOMIC_ACQUIRE)) return false;
+    if (is_abandoned()) return true;
+
+    switch(stage) {
+      case STAGE_LOOKUP:
+        return _lookup_q->size() == 0;
+      case STAGE_PUSH:
+        return _push_q->size() == 0;
+      case STAGE_RECORD:
+        return _record_q->size() == 0;
+      default:
+        break;
+    } // switch
+    return true;
+  } // App::is_drained
+
+  bool App::is_abandoned() const {
+    time_t drain_by = __atomic_load_n(&_drain_by, __ATOMIC_ACQUIRE);
+    return drain_by && time(NULL) >= drain_by;
+  } // App::is_abandoned
+
+  void App::init_apns_pool(const APNS::environmentEnum environment) {
+    // app.apns.<environment> overrides the shared app.apns settings,
+    // except for the gateways which must differ between the two
+    std::string prefix = std::string("app.apns.") + APNS::environment_str(environment) + ".";
+    bool is_prod = (environment == APNS::ENVIRONMENT_PROD);
+
+    _apns->set_pool(environment,
+                    cfg->get_int(prefix + "push", cfg->get_int("app.apns.push", 1)),
+                    cfg->get_bool(prefix + "feedback.enable", cfg->get_bool("app.apns.feedback.enable", false))
+                   );
+
+    _apns->set_cert(environment,
+                    cfg->get_string(prefix + "ssl.cert", cfg->get_string("app.apns.ssl.cert")),
+                    cfg->get_string(prefix + "ssl.key", cfg->get_string("app.apns.ssl.key"))
+                   );
+
+    _apns->set_push(environment,
+                    cfg->get_string(prefix + "push.host", is_prod ? APNS::kDefaultPushHost : APNS::kDefaultSandboxPushHost),
+                    cfg->get_int(prefix + "push.port", cfg->get_int("app.apns.push.port", APNS::kDefaultPushPort)),
+                    cfg->get_int(prefix + "push.timeout", cfg->get_int("app.apns.push.timeout", APNS::kDefaultPushTimeout))
+                   );
+
+    _apns->set_feedback(environment,
+                        cfg->get_string(prefix + "feedback.host", is_prod ? APNS::kDefaultFeedbackHost : APNS::kDefaultSandboxFeedbackHost),
+                        cfg->get_int(prefix + "feedback.port", cfg->get_int("app.apns.feedback.port", APNS::kDefaultFeedbackPort)),
+                        cfg->get_int(prefix + "feedback.interval", cfg->get_int("app.apns.feedback.interval", APNS::kDefaultFeedbackInterval))
+                       );
+
+    _apns->set_http2(environment,
+                     cfg->get_string(prefix + "http2.host", is_prod ? APNS::kDefaultHttp2Host : APNS::kDefaultSandboxHttp2Host),
+                     cfg->get_int(prefix + "http2.port", cfg->get_int("app.apns.http2.port", APNS::kDefaultHttp2Port))
+                    );
+  } // App::init_apns_pool
 
   void App::onDeinitializeSystem() { }
   void App::onDeinitializeCommands() { }
   void App::onDeinitializeDatabase() { }
   void App::onDeinitializeModules() { }
   void App::onDeinitializeThreads() {
-    while(!_workers.empty()) {
-      pthread_t thread_id = _workers.front();
-      LOG(LogNotice, << "App: Waiting for WorkerThread " << thread_id << " to Deinitialize" << std::endl);
-      pthread_join(thread_id, NULL);
-      _workers.pop_front();
+    // every message taken from stomp was acked, so rather than drop
+    // what is queued stop the stages front to back, each one finishing
+    // what the one before it left behind, until app.shutdown.drain
+    time_t drain = cfg->get_int("app.shutdown.drain", kDefaultDrainTimeout);
+    __atomic_store_n(&_drain_by, time(NULL) + drain, __ATOMIC_RELEASE);
+
+    for(int stage = STAGE_RECEIVE; stage < STAGE_MAX; stage++) {
+      __atomic_store_n(&_stopping[stage], true, __ATOMIC_RELEASE);
+      join_threads(_stages[stage]);
+    } // for
+
+    if (_wakeup_fd != -1) close(_wakeup_fd);
+    _wakeup_fd = -1;
+
+    // every pusher is gone, nothing else will queue to apple; the
+    // connections get whatever is left of the drain to send theirs
+    if (_apns) {
+      _apns->stop( std::max(_drain_by - time(NULL), time_t(0)) );
+      delete _apns;
+      _apns = NULL;
+    } // if
+
+    LOG(LogNotice, << "App: Dropping " << _lookup_q->size() << " lookups and "
+                   << _push_q->size() << " pushes still queued, "
+                   << _record_q->size() << " push records unwritten" << std::endl);
+    push_job_t job;
+    while( _push_q->dequeue(job, 0) ) {
+      while( !job.registers.empty() ) {
+        delete job.registers.front();
+        job.registers.pop_front();
+      } // while
     } // while
+    delete _push_q;
+    delete _record_q;
+    delete _lookup_q;
+    delete _register_cache;
+    delete _register_flight;
+    if (_register_index) delete _register_index;
+    if (_register_filter) delete _register_filter;
 
     _stats->stop();
     delete _stats;
@@ -100,6 +298,13 @@ namespace apnspusher {
   void App::rcvSigint() {
     LOG(LogNotice, << "### SIGINT Received" << std::endl);
     set_done(true);
+
+    // never read back, stays readable so every worker wakes up
+    if (_wakeup_fd != -1) {
+      uint64_t one = 1;
+      ssize_t ret = write(_wakeup_fd, &one, sizeof(one));
+      (void) ret;
+    } // if
   } // App::rcvSigint
   void App::rcvSigpipe() {
     LOG(LogNotice, << "### SIGPIPE Received" << std::endl);
@@ -113,24 +318,32 @@ namespace apnspusher {
     Worker *worker = new Worker(thread_id,
                                 a->cfg->get_string("app.threads.worker.stomp.hosts", "localhost:61613"),
                                 a->cfg->get_string("app.threads.worker.stomp.login"),
-                                a->cfg->get_string("app.threads.worker.stomp.passcode"),
-                                a->cfg->get_string("app.threads.worker.memcached.host", "localhost"),
-                                a->cfg->get_string("app.threads.worker.sql.host", "localhost"),
-                                a->cfg->get_string("app.threads.worker.sql.user"),
-                                a->cfg->get_string("app.threads.worker.sql.pass"),
-                                a->cfg->get_string("app.threads.worker.sql.database")
+                                a->cfg->get_string("app.threads.worker.stomp.passcode")
                                );
 
     worker->set_elogger( a->elogger(), a->elog_name() );
     worker->replace_stats(a->stats(), "apnspusher.worker" + openframe::stringify<int>(thread_id) );
 
     worker->set_console( a->is_console() );
+    worker->set_wakeup( a->wakeup_fd() );
+    worker->set_lookup_queue( a->lookup_q() );
+    worker->set_subscription(a->cfg->get_string("app.threads.worker.stomp.destination", Worker::kDefaultStompDestNotifyMessages),
+                             Worker::str_to_ack(a->cfg->get_string("app.threads.worker.stomp.ack", "client"))
+                            );
+    worker->set_batch(a->cfg->get_int("app.threads.worker.batch.size", Worker::kDefaultBatchSize),
+                      a->cfg->get_int("app.threads.worker.batch.timeout", Worker::kDefaultBatchTimeout)
+                     );
+    worker->set_prefetch( a->cfg->get_int("app.threads.worker.stomp.prefetch", Worker::kDefaultStompPrefetch) );
+    worker->set_flow(a->cfg->get_int("app.threads.worker.flow.delay", Worker::kDefaultFlowDelay),
+                     a->cfg->get_int("app.threads.worker.flow.floor", Worker::kDefaultFlowFloor),
+                     a->cfg->get_int("app.threads.worker", 1)
+                    );
 
     worker->init();
 
     while( !a->is_done() ) {
       bool did_work = worker->run();
-      if (!did_work) sleep(2);
+      if (!did_work) worker->wait();
     } // while
 
     delete worker;
@@ -138,4 +351,126 @@ namespace apnspusher {
 
     return NULL;
   } // App::WorkerThread
+
+  void *App::ChangeListenerThread(void *arg) {
+    openframe::ThreadMessage *tm = static_cast<openframe::ThreadMessage *>(arg);
+    App *a = static_cast<App *>( tm->var->get_void("app") );
+    thread_id_t thread_id = tm->var->get_int("id");
+
+    ChangeListener *listener = new ChangeListener(thread_id,
+                                                  a->cfg->get_string("app.threads.worker.stomp.hosts", "localhost:61613"),
+                                                  a->cfg->get_string("app.threads.worker.stomp.login"),
+                                                  a->cfg->get_string("app.threads.worker.stomp.passcode"),
+                                                  a->cfg->get_string("app.threads.worker.memcached.host", "localhost")
+                                                 );
+
+    listener->set_elogger( a->elogger(), a->elog_name() );
+    listener->replace_stats(a->stats(), "apnspusher.changes" + openframe::stringify<int>(thread_id) );
+
+    listener->set_wakeup( a->wakeup_fd() );
+    listener->set_destination( a->cfg->get_string("app.threads.worker.stomp.changes", ChangeListener::kDefaultStompDestRegisterChanges) );
+
+    listener->init();
+
+    while( !a->is_done() ) {
+      bool did_work = listener->run();
+      if (!did_work) listener->wait();
+    } // while
+
+    delete listener;
+    delete tm;
+
+    return NULL;
+  } // App::ChangeListenerThread
+
+  void *App::ResolverThread(void *arg) {
+    openframe::ThreadMessage *tm = static_cast<openframe::ThreadMessage *>(arg);
+    App *a = static_cast<App *>( tm->var->get_void("app") );
+    thread_id_t thread_id = tm->var->get_int("id");
+
+    Resolver *resolver = new Resolver(thread_id,
+                                      a->cfg->get_string("app.threads.worker.memcached.host", "localhost"),
+                                      a->cfg->get_string("app.threads.worker.sql.host", "localhost"),
+                                      a->cfg->get_string("app.threads.worker.sql.user"),
+                                      a->cfg->get_string("app.threads.worker.sql.pass"),
+                                      a->cfg->get_string("app.threads.worker.sql.database")
+                                     );
+
+    resolver->set_elogger( a->elogger(), a->elog_name() );
+    resolver->replace_stats(a->stats(), "apnspusher.resolver" + openframe::stringify<int>(thread_id) );
+    resolver->set_queues( a->lookup_q(), a->push_q() );
+    resolver->set_batch_size( a->cfg->get_int("app.threads.resolver.batch", Resolver::kDefaultBatchSize) );
+    resolver->set_memcached_binary( a->cfg->get_bool("app.threads.worker.memcached.binary", false) );
+    resolver->set_register_expire( a->cfg->get_int("app.cache.register.memcached_ttl", Store::kDefaultRegisterExpire) );
+
+    resolver->init();
+
+    while( !a->is_drained(App::STAGE_LOOKUP) ) resolver->run();
+
+    delete resolver;
+    delete tm;
+
+    return NULL;
+  } // App::ResolverThread
+
+  void *App::PusherThread(void *arg) {
+    openframe::ThreadMessage *tm = static_cast<openframe::ThreadMessage *>(arg);
+    App *a = static_cast<App *>( tm->var->get_void("app") );
+    thread_id_t thread_id = tm->var->get_int("id");
+
+    Pusher *pusher = new Pusher(thread_id,
+                                a->cfg->get_string("app.threads.worker.memcached.host", "localhost"),
+                                a->cfg->get_string("app.threads.worker.sql.host", "localhost"),
+                                a->cfg->get_string("app.threads.worker.sql.user"),
+                                a->cfg->get_string("app.threads.worker.sql.pass"),
+                                a->cfg->get_string("app.threads.worker.sql.database")
+                               );
+
+    pusher->set_elogger( a->elogger(), a->elog_name() );
+    pusher->replace_stats(a->stats(), "apnspusher.pusher" + openframe::stringify<int>(thread_id) );
+    pusher->set_push_queue( a->push_q() );
+    pusher->set_record_queue( a->record_q() );
+
+    pusher->init();
+
+    while( !a->is_drained(App::STAGE_PUSH) ) pusher->run();
+
+    delete pusher;
+    delete tm;
+
+    return NULL;
+  } // App::PusherThread
+
+  void *App::PushWriterThread(void *arg) {
+    openframe::ThreadMessage *tm = static_cast<openframe::ThreadMessage *>(arg);
+    App *a = static_cast<App *>( tm->var->get_void("app") );
+    thread_id_t thread_id = tm->var->get_int("id");
+
+    PushWriter *writer = new PushWriter(thread_id,
+                                        a->cfg->get_string("app.threads.worker.memcached.host", "localhost"),
+                                        a->cfg->get_string("app.threads.worker.sql.host", "localhost"),
+                                        a->cfg->get_string("app.threads.worker.sql.user"),
+                                        a->cfg->get_string("app.threads.worker.sql.pass"),
+                                        a->cfg->get_string("app.threads.worker.sql.database")
+                                       );
+
+    writer->set_elogger( a->elogger(), a->elog_name() );
+    writer->replace_stats(a->stats(), "apnspusher.writer" + openframe::stringify<int>(thread_id) );
+    writer->set_record_queue( a->record_q() );
+    writer->set_flush(a->cfg->get_int("app.threads.writer.flush.rows", PushWriter::kDefaultFlushRows),
+                      a->cfg->get_int("app.threads.writer.flush.interval", PushWriter::kDefaultFlushInterval)
+                     );
+
+    writer->init();
+
+    // the pushers are gone by the time this stage stops, nothing they
+    // recorded is left behind
+    while( !a->is_drained(App::STAGE_RECORD) ) writer->run();
+    writer->drain();
+
+    delete writer;
+    delete tm;
+
+    return NULL;
+  } // App::PushWriterThread
 } // namespace apnspusher
@@ -0,0 +1,81 @@
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+#include <math.h>
+
+#include "BloomFilter.h"
+
+namespace apnspusher {
+
+/**************************************************************************
+ ** BloomFilter Class                                                    **
+ **************************************************************************/
+
+  BloomFilter::BloomFilter(const size_t expected, const double fpp)
+              : _count(0) {
+    double n = expected ? expected : 1;
+    double p = (fpp > 0.0 && fpp < 1.0) ? fpp : 0.01;
+
+    // m = -n ln(p) / ln(2)^2, k = m/n ln(2)
+    double m = ceil(-n * log(p) / (M_LN2 * M_LN2));
+    if (m < 64) m = 64;
+
+    _num_bits = static_cast<uint64_t>(m);
+    _num_hashes = static_cast<unsigned int>( floor(m / n * M_LN2 + 0.5) );
+    if (_num_hashes < 1) _num_hashes = 1;
+
+    _bits.resize((_num_bits + 7) / 8, 0);
+  } // BloomFilter::BloomFilter
+
+  BloomFilter::~BloomFilter() {
+  } // BloomFilter::~BloomFilter
+
+  // 64 bit FNV-1a split into the two halves used for double hashing
+  void BloomFilter::hash(const std::string &key, uint32_t &h1, uint32_t &h2) {
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i = 0; i < key.length(); i++) {
+      h ^= static_cast<unsigned char>(key[i]);
+      h *= 1099511628211ULL;
+    } // for
+
+    // avalanche so short callsigns still spread over both halves
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    h1 = static_cast<uint32_t>(h);
+    h2 = static_cast<uint32_t>(h >> 32) | 1;
+  } // BloomFilter::hash
+
+  void BloomFilter::add(const std::string &key) {
+    uint32_t h1, h2;
+    hash(key, h1, h2);
+
+    for(unsigned int i = 0; i < _num_hashes; i++) {
+      uint64_t bit = (h1 + static_cast<uint64_t>(i) * h2) % _num_bits;
+      _bits[bit >> 3] |= (1 << (bit & 7));
+    } // for
+
+    ++_count;
+  } // BloomFilter::add
+
+  bool BloomFilter::contains(const std::string &key) const {
+    uint32_t h1, h2;
+    hash(key, h1, h2);
+
+    for(unsigned int i = 0; i < _num_hashes; i++) {
+      uint64_t bit = (h1 + static_cast<uint64_t>(i) * h2) % _num_bits;
+      if (!(_bits[bit >> 3] & (1 << (bit & 7)))) return false;
+    } // for
+
+    return true;
+  } // BloomFilter::contains
+
+  // expected false positive rate at the current fill, (1 - e^(-kn/m))^k
+  double BloomFilter::fpr() const {
+    double k = _num_hashes;
+    return pow(1.0 - exp(-k * _count / double(_num_bits)), k);
+  } // BloomFilter::fpr
+} // namespace apnspusher
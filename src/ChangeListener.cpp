@@ -0,0 +1,220 @@
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openframe/openframe.h>
+#include <stomp/StompHeaders.h>
+#include <stomp/StompFrame.h>
+#include <stomp/Stomp.h>
+
+#include <App.h>
+#include <ChangeListener.h>
+#include <EventWait.h>
+#include <NotifyParser.h>
+
+namespace apnspusher {
+  using namespace openframe::loglevel;
+
+  const int ChangeListener::kDefaultIdleTimeout			= 2000;
+  const char *ChangeListener::kDefaultStompDestRegisterChanges	= "/topic/notify.apns.registers";
+
+  ChangeListener::ChangeListener(const thread_id_t thread_id,
+                                 const std::string &stomp_hosts,
+                                 const std::string &stomp_login,
+                                 const std::string &stomp_passcode,
+                                 const std::string &memcached_host)
+                 : openframe::LogObject(thread_id),
+                   _stomp_hosts(stomp_hosts),
+                   _stomp_login(stomp_login),
+                   _stomp_passcode(stomp_passcode),
+                   _memcached_host(memcached_host) {
+
+    _stomp_dest_changes = kDefaultStompDestRegisterChanges;
+    _stomp = NULL;
+    _memcached = NULL;
+    _connected = false;
+
+    _wakeup_fd = -1;
+
+    init_stats(_stats, true);
+    init_stats(_stompstats, true);
+    _stats.report_interval = 60;
+    _stompstats.report_interval = 5;
+  } // ChangeListener::ChangeListener
+
+  ChangeListener::~ChangeListener() {
+    onDestroyStats();
+
+    if (_stomp) delete _stomp;
+    if (_memcached) delete _memcached;
+  } // ChangeListener::~ChangeListener
+
+  void ChangeListener::init() {
+    try {
+      stomp::StompHeaders *headers = new stomp::StompHeaders("heart-beat", "0,5000");
+      _stomp = new stomp::Stomp(_stomp_hosts,
+                                _stomp_login,
+                                _stomp_passcode,
+                                headers);
+      _memcached = new MemcachedController(_memcached_host);
+    } // try
+    catch(std::bad_alloc xa) {
+      assert(false);
+    } // catch
+
+    _events.elogger( elogger(), elog_name() );
+    _events.init(_wakeup_fd);
+  } // ChangeListener::init
+
+  void ChangeListener::init_stats(obj_stats_t &stats, const bool startup) {
+    stats.connects = 0;
+    stats.disconnects = 0;
+    stats.changes = 0;
+    stats.rejected = 0;
+    stats.evicted = 0;
+
+    stats.last_report_at = time(NULL);
+    if (startup) stats.created_at = time(NULL);
+  } // ChangeListener::init_stats
+
+  void ChangeListener::onDescribeStats() {
+    describe_stat("num.changes", "changes"+thread_id_str()+"/num changes", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("num.rejected", "changes"+thread_id_str()+"/num rejected", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("num.evicted", "changes"+thread_id_str()+"/num evicted", openstats::graphTypeCounter, openstats::dataTypeInt);
+  } // ChangeListener::onDescribeStats
+
+  void ChangeListener::onDestroyStats() {
+    destroy_stat("num.*");
+  } // ChangeListener::onDestroyStats
+
+  void ChangeListener::try_stats() {
+    try_stompstats();
+
+    if (_stats.last_report_at > time(NULL) - _stats.report_interval) return;
+
+    TLOG(LogNotice, << "Stats changes " << _stats.changes
+                    << ", rejected " << _stats.rejected
+                    << ", evicted " << _stats.evicted
+                    << ", next in " << _stats.report_interval
+                    << ", connect attempts " << _stats.connects
+                    << ", disconnects " << _stats.disconnects
+                    << "; " << _stomp->connected_to()
+                    << std::endl);
+
+    init_stats(_stats);
+  } // ChangeListener::try_stats
+
+  void ChangeListener::try_stompstats() {
+    if (_stompstats.last_report_at > time(NULL) - _stompstats.report_interval) return;
+
+    datapoint("num.changes", _stompstats.changes);
+    datapoint("num.rejected", _stompstats.rejected);
+    datapoint("num.evicted", _stompstats.evicted);
+
+    init_stats(_stompstats);
+  } // ChangeListener::try_stompstats
+
+  bool ChangeListener::run() {
+    try_stats();
+
+    /**********************
+     ** Check Connection **
+     **********************/
+    if (!_connected) {
+      ++_stats.connects;
+      // changes are only evictions, losing one on a disconnect costs
+      // no more than the ttl we had before subscribing
+      if (!_stomp->subscribe(_stomp_dest_changes, "1", new stomp::StompHeaders("ack", "auto"))) {
+        TLOG(LogInfo, << "not connected, retry in 2 seconds; " << _stomp->last_error() << std::endl);
+        return false;
+      } // if
+      _connected = true;
+      TLOG(LogNotice, << "Connected to " << _stomp->connected_to()
+                      << ", subscribed to " << _stomp_dest_changes
+                      << std::endl);
+    } // if
+
+    /********************
+     ** Process Frames **
+     ********************/
+    // changes are few and cheap, take everything that's there
+    bool did_work = false;
+    for(;;) {
+      stomp::StompFrame *frame;
+      bool ok = false;
+
+      try {
+        ok = _stomp->next_frame(frame);
+      } // try
+      catch(stomp::Stomp_Exception ex) {
+        TLOG(LogWarn, << "ERROR: " << ex.message() << std::endl);
+        _connected = false;
+        ++_stats.disconnects;
+        break;
+      } // catch
+
+      if (!ok) break;
+      did_work = true;
+
+      if (frame->is_command(stomp::StompFrame::commandMessage)) {
+        ++_stats.changes;
+        ++_stompstats.changes;
+        size_t evicted = process_change( frame->body() );
+        _stats.evicted += evicted;
+        _stompstats.evicted += evicted;
+      } // if
+      frame->release();
+    } // for
+
+    return did_work;
+  } // ChangeListener::run
+
+  bool ChangeListener::wait(const int timeout) {
+    return _events.wait(_connected ? _stomp->sock() : -1, timeout);
+  } // ChangeListener::wait
+
+  // the change names callsigns, whatever we hold for them is dropped
+  // and the next lookup reads the new registration from SQL
+  size_t ChangeListener::process_change(const std::string &body) {
+    std::vector<std::string> callsigns;
+    if (!NotifyParser::parse_change(body, callsigns)) {
+      ++_stats.rejected;
+      ++_stompstats.rejected;
+      TLOG(LogInfo, << "rejected register change; "
+                    << body
+                    << std::endl);
+      return 0;
+    } // if
+
+    for(std::vector<std::string>::iterator itr = callsigns.begin(); itr != callsigns.end(); itr++) {
+      // a lookup already querying SQL may have read the old rows
+      if (app->register_flight()) app->register_flight()->invalidate(*itr);
+
+      try {
+        _memcached->remove("apnsregister", *itr);
+      } // try
+      catch(MemcachedController_Exception e) {
+        TLOG(LogError, << e.message()
+                       << std::endl);
+      } // catch
+
+      if (app->register_cache()) app->register_cache()->remove(*itr);
+      if (app->register_index()) app->register_index()->touch(*itr);
+      // a new registration would otherwise be ruled out until the
+      // filter is next rebuilt
+      if (app->register_filter()) app->register_filter()->add(*itr);
+
+      TLOG(LogInfo, << "evicted registers for "
+                    << *itr
+                    << " after register change"
+                    << std::endl);
+    } // for
+
+    return callsigns.size();
+  } // ChangeListener::process_change
+} // namespace apnspusher
@@ -28,6 +28,7 @@
 #include <new>
 #include <iostream>
 #include <string>
+#include <vector>
 #include <exception>
 #include <sstream>
 
@@ -70,6 +71,23 @@ namespace apnspusher {
                   (apns_timestamp, device_token, create_ts) \
            VALUES ('%d', '%s', UNIX_TIMESTAMP())");
 
+    add_query("i_apns_feedbacks", "\
+      INSERT INTO apns_feedback \
+                  (apns_timestamp, device_token, create_ts) \
+           VALUES %0:rows");
+
+    add_query("s_apns_register_callsigns_by_tokens", "\
+      SELECT DISTINCT apns_register.callsign \
+        FROM apns_register \
+       WHERE apns_register.device_token IN (%0:tokens) \
+         AND apns_register.active = 'Y'");
+
+    add_query("u_apns_register_inactive", "\
+      UPDATE apns_register \
+         SET apns_register.active = 'N' \
+       WHERE (%0:feedbacks) \
+         AND apns_register.active = 'Y'");
+
     add_query("s_apns_register", "\
       SELECT apns_register.id, apns_register.device_token, apns_register.environment \
         FROM apns_register \
@@ -78,10 +96,43 @@ namespace apnspusher {
          AND apns_register.active = 'Y' \
          AND web_users.active = 'Y'");
 
+    add_query("s_apns_registers", "\
+      SELECT apns_register.callsign, apns_register.id, apns_register.device_token, apns_register.environment \
+        FROM apns_register \
+             INNER JOIN web_users ON web_users.id = apns_register.user_id \
+       WHERE apns_register.callsign IN (%0:callsigns) \
+         AND apns_register.active = 'Y' \
+         AND web_users.active = 'Y'");
+
+    add_query("s_apns_register_callsigns", "\
+      SELECT DISTINCT apns_register.callsign \
+        FROM apns_register \
+             INNER JOIN web_users ON web_users.id = apns_register.user_id \
+       WHERE apns_register.active = 'Y' \
+         AND web_users.active = 'Y'");
+
+    add_query("s_apns_register_index", "\
+      SELECT apns_register.callsign, apns_register.id, apns_register.device_token, apns_register.environment \
+        FROM apns_register \
+             INNER JOIN web_users ON web_users.id = apns_register.user_id \
+       WHERE apns_register.active = 'Y' \
+         AND web_users.active = 'Y'");
+
+    add_query("s_apns_register_callsigns_since", "\
+      SELECT apns_register.id, apns_register.callsign \
+        FROM apns_register \
+       WHERE apns_register.id > %0:id \
+    ORDER BY apns_register.id");
+
     add_query("i_apns_push", "\
       INSERT INTO apns_push \
                   (apns_register_id, badge, alertmsg, sent, create_ts) \
            VALUES (%0q:id, '1', %1q:alertmsg, 'Y', UNIX_TIMESTAMP() )");
+
+    add_query("i_apns_pushes", "\
+      INSERT INTO apns_push \
+                  (apns_register_id, badge, alertmsg, sent, create_ts) \
+           VALUES %0:rows");
   } // DBI_Apns::prepare_queries
 
   openframe::DBI::resultSizeType DBI_Apns::getApnsRegisterByCallsign(const std::string &callsign,
@@ -111,6 +162,122 @@ namespace apnspusher {
     return numRows;
   } // DBI_Apns::getApnsRegisterByCallsign
 
+  openframe::DBI::resultSizeType DBI_Apns::getApnsRegistersByCallsigns(const std::vector<std::string> &callsigns,
+                                                                       openframe::DBI::resultType &res,
+                                                                       bool *ok) {
+    DBI::resultSizeType numRows = 0;
+    if (ok) *ok = callsigns.empty();
+
+    if (callsigns.empty()) return 0;
+
+    mysqlpp::Query *query = q("s_apns_registers");
+
+    std::string in = escape_list(query, callsigns);
+
+    try {
+      res = query->store(in);
+      numRows = res.num_rows();
+
+      while(query->more_results()) query->store_next();
+      if (ok) *ok = true;
+    } // try
+    catch(const mysqlpp::BadQuery &e) {
+      TLOG(LogWarn, << "*** MySQL++ Error{getApnsRegistersByCallsigns}: #"
+                    << e.errnum()
+                    << " " << e.what()
+                    << std::endl);
+    } // catch
+    catch(const mysqlpp::Exception &e) {
+      TLOG(LogWarn, << "*** MySQL++ Error{getApnsRegistersByCallsigns}: "
+                    << " " << e.what()
+                    << std::endl);
+    } // catch
+
+    return numRows;
+  } // DBI_Apns::getApnsRegistersByCallsigns
+
+  openframe::DBI::resultSizeType DBI_Apns::getApnsRegisterCallsigns(openframe::DBI::resultType &res) {
+    DBI::resultSizeType numRows = 0;
+
+    mysqlpp::Query *query = q("s_apns_register_callsigns");
+
+    try {
+      res = query->store();
+      numRows = res.num_rows();
+
+      while(query->more_results()) query->store_next();
+    } // try
+    catch(const mysqlpp::BadQuery &e) {
+      TLOG(LogWarn, << "*** MySQL++ Error{getApnsRegisterCallsigns}: #"
+                    << e.errnum()
+                    << " " << e.what()
+                    << std::endl);
+    } // catch
+    catch(const mysqlpp::Exception &e) {
+      TLOG(LogWarn, << "*** MySQL++ Error{getApnsRegisterCallsigns}: "
+                    << " " << e.what()
+                    << std::endl);
+    } // catch
+
+    return numRows;
+  } // DBI_Apns::getApnsRegisterCallsigns
+
+  openframe::DBI::resultSizeType DBI_Apns::getApnsRegisterIndex(openframe::DBI::resultType &res) {
+    DBI::resultSizeType numRows = 0;
+
+    mysqlpp::Query *query = q("s_apns_register_index");
+
+    try {
+      res = query->store();
+      numRows = res.num_rows();
+
+      while(query->more_results()) query->store_next();
+    } // try
+    catch(const mysqlpp::BadQuery &e) {
+      TLOG(LogWarn, << "*** MySQL++ Error{getApnsRegisterIndex}: #"
+                    << e.errnum()
+                    << " " << e.what()
+                    << std::endl);
+    } // catch
+    catch(const mysqlpp::Exception &e) {
+      TLOG(LogWarn, << "*** MySQL++ Error{getApnsRegisterIndex}: "
+                    << " " << e.what()
+                    << std::endl);
+    } // catch
+
+    return numRows;
+  } // DBI_Apns::getApnsRegisterIndex
+
+  openframe::DBI::resultSizeType DBI_Apns::getApnsRegisterCallsignsSince(const std::string &id,
+                                                                         openframe::DBI::resultType &res,
+                                                                         bool *ok) {
+    DBI::resultSizeType numRows = 0;
+    if (ok) *ok = false;
+
+    mysqlpp::Query *query = q("s_apns_register_callsigns_since");
+
+    try {
+      res = query->store(id);
+      numRows = res.num_rows();
+
+      while(query->more_results()) query->store_next();
+      if (ok) *ok = true;
+    } // try
+    catch(const mysqlpp::BadQuery &e) {
+      TLOG(LogWarn, << "*** MySQL++ Error{getApnsRegisterCallsignsSince}: #"
+                    << e.errnum()
+                    << " " << e.what()
+                    << std::endl);
+    } // catch
+    catch(const mysqlpp::Exception &e) {
+      TLOG(LogWarn, << "*** MySQL++ Error{getApnsRegisterCallsignsSince}: "
+                    << " " << e.what()
+                    << std::endl);
+    } // catch
+
+    return numRows;
+  } // DBI_Apns::getApnsRegisterCallsignsSince
+
   openframe::DBI::simpleResultSizeType DBI_Apns::setApnsPush(const std::string &id,
                                                              const std::string &message) {
     int numRows = 0;
@@ -140,4 +307,166 @@ namespace apnspusher {
     return numRows;
   } // DBI_Apns::setApnsPush
 
+  openframe::DBI::simpleResultSizeType DBI_Apns::setApnsPushes(const std::vector<apns_push_t> &pushes) {
+    int numRows = 0;
+
+    if (pushes.empty()) return 0;
+
+    mysqlpp::Query *query = q("i_apns_pushes");
+
+    // the row list is substituted as is, quote and escape it here
+    std::stringstream rows;
+    for(std::vector<apns_push_t>::const_iterator itr = pushes.begin(); itr != pushes.end(); itr++) {
+      std::string id, alertmsg;
+      query->escape_string(&id, itr->register_id.data(), itr->register_id.length());
+      query->escape_string(&alertmsg, itr->alertmsg.data(), itr->alertmsg.length());
+      rows << (itr == pushes.begin() ? "" : ",")
+           << "('" << id << "', '1', '" << alertmsg << "', 'Y', " << itr->created_at << ")";
+    } // for
+
+    DBI::simpleResultType res;
+    try {
+      res = query->execute(rows.str());
+
+      numRows = res.rows();
+
+      while(query->more_results()) query->store_next();
+    } // try
+    catch(const mysqlpp::BadQuery &e) {
+      TLOG(LogWarn, << "*** MySQL++ Error{setApnsPushes}: #"
+                    << e.errnum()
+                    << " " << e.what()
+                    << std::endl);
+    } // catch
+    catch(const mysqlpp::Exception &e) {
+      TLOG(LogWarn, << "*** MySQL++ Error{setApnsPushes}: "
+                    << " " << e.what()
+                    << std::endl);
+    } // catch
+
+    return numRows;
+  } // DBI_Apns::setApnsPushes
+
+  openframe::DBI::simpleResultSizeType DBI_Apns::setApnsFeedbacks(const std::vector<apns_feedback_t> &feedbacks) {
+    int numRows = 0;
+
+    if (feedbacks.empty()) return 0;
+
+    mysqlpp::Query *query = q("i_apns_feedbacks");
+
+    // the row list is substituted as is, quote and escape it here
+    std::stringstream rows;
+    for(std::vector<apns_feedback_t>::const_iterator itr = feedbacks.begin(); itr != feedbacks.end(); itr++) {
+      std::string device_token;
+      query->escape_string(&device_token, itr->device_token.data(), itr->device_token.length());
+      rows << (itr == feedbacks.begin() ? "" : ",")
+           << "(" << itr->apns_timestamp << ", '" << device_token << "', UNIX_TIMESTAMP())";
+    } // for
+
+    DBI::simpleResultType res;
+    try {
+      res = query->execute(rows.str());
+
+      numRows = res.rows();
+
+      while(query->more_results()) query->store_next();
+    } // try
+    catch(const mysqlpp::BadQuery &e) {
+      TLOG(LogWarn, << "*** MySQL++ Error{setApnsFeedbacks}: #"
+                    << e.errnum()
+                    << " " << e.what()
+                    << std::endl);
+    } // catch
+    catch(const mysqlpp::Exception &e) {
+      TLOG(LogWarn, << "*** MySQL++ Error{setApnsFeedbacks}: "
+                    << " " << e.what()
+                    << std::endl);
+    } // catch
+
+    return numRows;
+  } // DBI_Apns::setApnsFeedbacks
+
+  openframe::DBI::resultSizeType DBI_Apns::getApnsRegisterCallsignsByTokens(const std::vector<std::string> &tokens,
+                                                                            openframe::DBI::resultType &res) {
+    DBI::resultSizeType numRows = 0;
+
+    if (tokens.empty()) return 0;
+
+    mysqlpp::Query *query = q("s_apns_register_callsigns_by_tokens");
+    std::string in = escape_list(query, tokens);
+
+    try {
+      res = query->store(in);
+      numRows = res.num_rows();
+
+      while(query->more_results()) query->store_next();
+    } // try
+    catch(const mysqlpp::BadQuery &e) {
+      TLOG(LogWarn, << "*** MySQL++ Error{getApnsRegisterCallsignsByTokens}: #"
+                    << e.errnum()
+                    << " " << e.what()
+                    << std::endl);
+    } // catch
+    catch(const mysqlpp::Exception &e) {
+      TLOG(LogWarn, << "*** MySQL++ Error{getApnsRegisterCallsignsByTokens}: "
+                    << " " << e.what()
+                    << std::endl);
+    } // catch
+
+    return numRows;
+  } // DBI_Apns::getApnsRegisterCallsignsByTokens
+
+  openframe::DBI::simpleResultSizeType DBI_Apns::setApnsRegistersInactive(const std::vector<apns_feedback_t> &feedbacks) {
+    int numRows = 0;
+
+    if (feedbacks.empty()) return 0;
+
+    mysqlpp::Query *query = q("u_apns_register_inactive");
+
+    // a device registered again after Apple reported the app gone is
+    // still installed, only rows older than the report go
+    std::stringstream where;
+    for(std::vector<apns_feedback_t>::const_iterator itr = feedbacks.begin(); itr != feedbacks.end(); itr++) {
+      std::string device_token;
+      query->escape_string(&device_token, itr->device_token.data(), itr->device_token.length());
+      where << (itr == feedbacks.begin() ? "" : " OR ")
+            << "(apns_register.device_token = '" << device_token << "'"
+            << " AND apns_register.create_ts < " << itr->apns_timestamp << ")";
+    } // for
+
+    DBI::simpleResultType res;
+    try {
+      res = query->execute(where.str());
+
+      numRows = res.rows();
+
+      while(query->more_results()) query->store_next();
+    } // try
+    catch(const mysqlpp::BadQuery &e) {
+      TLOG(LogWarn, << "*** MySQL++ Error{setApnsRegistersInactive}: #"
+                    << e.errnum()
+                    << " " << e.what()
+                    << std::endl);
+    } // catch
+    catch(const mysqlpp::Exception &e) {
+      TLOG(LogWarn, << "*** MySQL++ Error{setApnsRegistersInactive}: "
+                    << " " << e.what()
+                    << std::endl);
+    } // catch
+
+    return numRows;
+  } // DBI_Apns::setApnsRegistersInactive
+
+  std::string DBI_Apns::escape_list(mysqlpp::Query *query, const std::vector<std::string> &values) {
+    // IN lists are substituted as is, quote and escape them here
+    std::string ret;
+    for(std::vector<std::string>::const_iterator itr = values.begin(); itr != values.end(); itr++) {
+      std::string escaped;
+      query->escape_string(&escaped, itr->data(), itr->length());
+      ret += (ret.empty() ? "'" : ",'") + escaped + "'";
+    } // for
+
+    return ret;
+  } // DBI_Apns::escape_list
+
 } // namespace apnspusher
@@ -0,0 +1,72 @@
+#include "config.h"
+
+#include <string>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <openframe/openframe.h>
+
+#include <EventWait.h>
+
+namespace apnspusher {
+  using namespace openframe::loglevel;
+
+/**************************************************************************
+ ** EventWait Class                                                      **
+ **************************************************************************/
+  EventWait::EventWait() : _epoll_fd(-1), _watch_fd(-1) {
+  } // EventWait::EventWait
+
+  EventWait::~EventWait() {
+    if (_epoll_fd != -1) close(_epoll_fd);
+  } // EventWait::~EventWait
+
+  void EventWait::init(const int wakeup_fd) {
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epoll_fd == -1)
+      throw EventWait_Exception("unable to create epoll instance; " + std::string(strerror(errno)));
+
+    if (wakeup_fd != -1) {
+      struct epoll_event ev;
+      memset(&ev, '\0', sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.fd = wakeup_fd;
+      if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &ev) == -1)
+        throw EventWait_Exception("unable to watch wakeup event; " + std::string(strerror(errno)));
+    } // if
+  } // EventWait::init
+
+  bool EventWait::wait(const int fd, const int timeout) {
+    if (fd != _watch_fd) {
+      if (_watch_fd != -1) epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, _watch_fd, NULL);
+      _watch_fd = -1;
+
+      if (fd != -1) {
+        struct epoll_event ev;
+        memset(&ev, '\0', sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0)
+          _watch_fd = fd;
+        else
+          LOG(LogWarn, << "EventWait unable to watch socket; "
+                       << strerror(errno)
+                       << std::endl);
+      } // if
+    } // if
+
+    struct epoll_event events[2];
+    int n = epoll_wait(_epoll_fd, events, 2, timeout);
+    if (n == -1 && errno != EINTR) {
+      LOG(LogWarn, << "EventWait epoll_wait failed; "
+                   << strerror(errno)
+                   << std::endl);
+      return false;
+    } // if
+
+    return n > 0;
+  } // EventWait::wait
+} // namespace apnspusher
@@ -0,0 +1,71 @@
+#include "config.h"
+
+#include <time.h>
+
+#include <FlowControl.h>
+
+namespace apnspusher {
+
+/**************************************************************************
+ ** FlowControl Class                                                    **
+ **************************************************************************/
+
+  // drain rate is sampled no more often than this, shorter intervals
+  // just measure how a single ssl thread pass lined up with ours
+  static const double kSampleInterval		= 0.1;
+  // weight of the newest sample in the smoothed drain rate
+  static const double kRateWeight		= 0.3;
+
+  FlowControl::FlowControl(const time_t delay,
+                           const size_t floor,
+                           const size_t max_window,
+                           const unsigned int num_consumers) :
+    _delay(delay),
+    _floor(floor),
+    _max_window(max_window),
+    _num_consumers(num_consumers ? num_consumers : 1),
+    _primed(false),
+    _drained(0),
+    _rate(0.0),
+    _backlog(0),
+    _window(max_window) {
+  } // FlowControl::FlowControl
+
+  size_t FlowControl::target() const {
+    size_t target = static_cast<size_t>(_rate * _delay / 1000.0);
+    return target > _floor ? target : _floor;
+  } // FlowControl::target
+
+  size_t FlowControl::update(const size_t backlog, const unsigned long long drained) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    _backlog = backlog;
+
+    if (!_primed) {
+      _primed = true;
+      _sampled_at = now;
+      _drained = drained;
+    } // if
+
+    double elapsed = (now.tv_sec - _sampled_at.tv_sec)
+                     + (now.tv_nsec - _sampled_at.tv_nsec) / 1e9;
+    if (elapsed >= kSampleInterval) {
+      double sample = (drained - _drained) / elapsed;
+      _rate = kRateWeight * sample + (1.0 - kRateWeight) * _rate;
+      _sampled_at = now;
+      _drained = drained;
+    } // if
+
+    size_t target = this->target();
+    size_t room = target > backlog ? target - backlog : 0;
+
+    // any room at all lets every worker take at least one, otherwise a
+    // floor below the worker count would stall them all
+    _window = room / _num_consumers;
+    if (room && !_window) _window = 1;
+    if (_window > _max_window) _window = _max_window;
+
+    return _window;
+  } // FlowControl::update
+} // namespace apnspusher
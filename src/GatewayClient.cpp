@@ -0,0 +1,441 @@
+#include "config.h"
+
+#include <algorithm>
+#include <string>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <openssl/ssl.h>
+
+#include <openframe/openframe.h>
+
+#include <GatewayClient.h>
+#include <TlsContext.h>
+
+namespace apnspusher {
+  using namespace openframe::loglevel;
+
+  // the most plaintext a single TLS record carries
+  const size_t GatewayClient::kDefaultRecordSize	= 16384;
+  const int GatewayClient::kDefaultFlushDelay		= 5;
+  const size_t GatewayClient::kMaxPayload		= 2048;
+  const size_t GatewayClient::kDefaultResendWindow	= 4096;
+  const size_t GatewayClient::kMaxBufferedRecords	= 4;
+
+  static const size_t kTokenLength			= 32;
+
+  static bool hex_decode(const std::string &hex, std::string &ret) {
+    if (hex.length() != kTokenLength * 2) return false;
+
+    ret.clear();
+    for(size_t i = 0; i < hex.length(); i += 2) {
+      char buf[3] = { hex[i], hex[i + 1], 0 };
+      char *end;
+      long c = strtol(buf, &end, 16);
+      if (*end != 0) return false;
+      ret += char(c);
+    } // for
+    return true;
+  } // hex_decode
+
+  static void put16(std::string &buf, const uint16_t v) {
+    uint16_t n = htons(v);
+    buf.append((const char *) &n, sizeof(n));
+  } // put16
+
+  static void put32(std::string &buf, const uint32_t v) {
+    uint32_t n = htonl(v);
+    buf.append((const char *) &n, sizeof(n));
+  } // put32
+
+  GatewayClient::GatewayClient(const std::string &host,
+                               const int port,
+                               const std::string &cert,
+                               const std::string &key,
+                               const std::string &capath,
+                               const time_t timeout) :
+    _host(host),
+    _port(port),
+    _cert(cert),
+    _key(key),
+    _capath(capath),
+    _timeout(timeout),
+    _verify(true),
+    _record_size(kDefaultRecordSize),
+    _flush_delay(kDefaultFlushDelay),
+    _resend_window(kDefaultResendWindow),
+    _sock(-1),
+    _tls(NULL),
+    _own_tls(false),
+    _ssl(NULL),
+    _woffset(0),
+    _blocked(false),
+    _last_write_at(0),
+    _error(false),
+    _error_status(0),
+    _error_identifier(0),
+    _appended(0),
+    _written(0),
+    _uncounted(0),
+    _frames_written(0) {
+    reset_stats();
+  } // GatewayClient::GatewayClient
+
+  GatewayClient::~GatewayClient() {
+    disconnect();
+    if (_own_tls) delete _tls;
+  } // GatewayClient::~GatewayClient
+
+  GatewayClient &GatewayClient::set_tls(TlsContext *tls) {
+    if (_own_tls) delete _tls;
+    _tls = tls;
+    _own_tls = false;
+    return *this;
+  } // GatewayClient::set_tls
+
+  void GatewayClient::reset_stats() {
+    _stats.frames = 0;
+    _stats.records = 0;
+    _stats.bytes = 0;
+    _stats.rejected = 0;
+    _stats.resent = 0;
+    _stats.handshakes = 0;
+    _stats.resumed = 0;
+    _stats.ktls = 0;
+  } // GatewayClient::reset_stats
+
+  bool GatewayClient::connect() {
+    disconnect();
+
+    // without a shared context every client keeps its own, which still
+    // lets it resume its own sessions
+    if (!_tls) {
+      _tls = new TlsContext(_cert, _key, _capath, _verify);
+      _tls->elogger( elogger(), elog_name() );
+      _own_tls = true;
+    } // if
+
+    bool resumed = false;
+    _ssl = _tls->connect(_host, _port, "", &resumed);
+    if (!_ssl) return false;
+    _sock = SSL_get_fd(_ssl);
+
+    ++_stats.handshakes;
+    if (resumed) ++_stats.resumed;
+
+    bool ktls = TlsContext::ktls_send(_ssl);
+    if (ktls) ++_stats.ktls;
+
+    fcntl(_sock, F_SETFL, fcntl(_sock, F_GETFL, 0) | O_NONBLOCK);
+    _last_write_at = time(NULL);
+
+    LOG(LogInfo, << "Gateway connected to "
+                 << _host
+                 << ":"
+                 << _port
+                 << (resumed ? ", resumed" : ", full handshake")
+                 << (ktls ? ", kernel TLS" : _tls->ktls() ? ", kernel TLS unavailable" : "")
+                 << ", resending "
+                 << _resend.size()
+                 << std::endl);
+
+    // what the last connection lost goes out ahead of anything new
+    std::deque<sent_t> resend;
+    resend.swap(_resend);
+    for(std::deque<sent_t>::iterator itr = resend.begin(); itr != resend.end(); itr++) {
+      if (queue(*itr)) {
+        --_stats.frames;
+        ++_stats.resent;
+      } // if
+    } // for
+
+    return true;
+  } // GatewayClient::connect
+
+  void GatewayClient::disconnect() {
+    std::deque<sent_t>::iterator first = _sent.begin();
+
+    if (_error) {
+      // everything up to the bad frame was delivered, everything after
+      // it was thrown away by Apple
+      std::deque<sent_t>::iterator itr;
+      for(itr = _sent.begin(); itr != _sent.end(); itr++)
+        if (itr->frame.identifier == _error_identifier) break;
+
+      if (itr != _sent.end()) {
+        // on shutdown the identifier is the last one delivered
+        if (_error_status != STATUS_SHUTDOWN) {
+          rejection_t rejection;
+          rejection.frame = itr->frame;
+          rejection.status = _error_status;
+          _rejections.push_back(rejection);
+        } // if
+        first = itr + 1;
+      } // if
+      else if (!_sent.empty()
+               && int32_t(_error_identifier - _sent.front().frame.identifier) < 0) {
+        // it fell out of the window, all we still hold came after it
+        // but whatever was between is gone
+        LOG(LogWarn, << "Gateway rejected notification "
+                     << _error_identifier
+                     << " is older than the resend window, resending the last "
+                     << _sent.size()
+                     << std::endl);
+      } // else if
+      else {
+        while(first != _sent.end() && first->end <= _written) first++;
+      } // else
+    } // if
+    else {
+      // without an answer only what never reached TLS is known lost
+      while(first != _sent.end() && first->end <= _written) first++;
+    } // else
+
+    for(; first != _sent.end(); first++)
+      _resend.push_back(*first);
+    _sent.clear();
+    _uncounted = 0;
+
+    if (_ssl) {
+      SSL_shutdown(_ssl);
+      SSL_free(_ssl);
+    } // if
+    if (_sock >= 0) close(_sock);
+
+    _ssl = NULL;
+    _sock = -1;
+    _wbuf.clear();
+    _woffset = 0;
+    _blocked = false;
+    _rbuf.clear();
+    _error = false;
+    _appended = 0;
+    _written = 0;
+  } // GatewayClient::disconnect
+
+  size_t GatewayClient::rejections(rejections_t &ret) {
+    size_t num = _rejections.size();
+    ret.insert(ret.end(), _rejections.begin(), _rejections.end());
+    _rejections.clear();
+    return num;
+  } // GatewayClient::rejections
+
+  bool GatewayClient::add(const std::string &device_token,
+                          const Payload &payload,
+                          const uint32_t identifier,
+                          const time_t expiry) {
+    sent_t sent;
+    sent.frame.identifier = identifier;
+    sent.frame.device_token = device_token;
+    sent.frame.payload = payload;
+    sent.frame.expiry = expiry;
+    sent.end = 0;
+    sent.counted = false;
+    return queue(sent);
+  } // GatewayClient::add
+
+  bool GatewayClient::queue(const sent_t &sent) {
+    std::string token;
+    if (!hex_decode(sent.frame.device_token, token) || sent.frame.payload.length() > kMaxPayload) return false;
+
+    // frames added while disconnected wait their turn behind the resend
+    if (!is_connected()) {
+      _resend.push_back(sent);
+      return true;
+    } // if
+
+    encode(sent.frame, token);
+    _sent.push_back(sent);
+    _sent.back().end = _appended;
+
+    // written frames past the window are taken as delivered
+    while(_sent.size() > _resend_window && _sent.front().end <= _written) {
+      _sent.pop_front();
+      if (_uncounted) --_uncounted;
+    } // while
+
+    ++_stats.frames;
+    return true;
+  } // GatewayClient::queue
+
+  void GatewayClient::encode(const frame_t &frame, const std::string &token) {
+    if (buffered() == 0) clock_gettime(CLOCK_MONOTONIC, &_buffered_at);
+
+    // enhanced notification format, command 1
+    size_t start = _wbuf.length();
+    _wbuf.reserve(start + 45 + frame.payload.length());
+    _wbuf += char(1);
+    put32(_wbuf, frame.identifier);
+    put32(_wbuf, uint32_t(frame.expiry));
+    put16(_wbuf, kTokenLength);
+    _wbuf += token;
+    put16(_wbuf, frame.payload.length());
+    _wbuf.append(frame.payload.data(), frame.payload.length());
+
+    _appended += _wbuf.length() - start;
+  } // GatewayClient::encode
+
+  int GatewayClient::flush_wait() const {
+    if (buffered() == 0) return -1;
+    if (buffered() >= _record_size) return 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long waited = (now.tv_sec - _buffered_at.tv_sec) * 1000
+                  + (now.tv_nsec - _buffered_at.tv_nsec) / 1000000;
+    return waited >= _flush_delay ? 0 : int(_flush_delay - waited);
+  } // GatewayClient::flush_wait
+
+  bool GatewayClient::flush(const bool force) {
+    _blocked = false;
+    while(buffered() > 0) {
+      // a partial record only goes out once it is old enough
+      if (!force && buffered() < _record_size && flush_wait() > 0) break;
+
+      size_t len = std::min(buffered(), _record_size);
+      int ret = SSL_write(_ssl, _wbuf.data() + _woffset, len);
+      if (ret <= 0) {
+        int err = SSL_get_error(_ssl, ret);
+        if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
+          _blocked = true;
+          break;
+        } // if
+
+        LOG(LogWarn, << "Gateway write to "
+                     << _host
+                     << " failed; "
+                     << TlsContext::error()
+                     << std::endl);
+        return false;
+      } // if
+
+      _woffset += ret;
+      _written += ret;
+      ++_stats.records;
+      _stats.bytes += ret;
+      _last_write_at = time(NULL);
+
+      for(; _uncounted < _sent.size() && _sent[_uncounted].end <= _written; _uncounted++) {
+        if (_sent[_uncounted].counted) continue;
+        _sent[_uncounted].counted = true;
+        ++_frames_written;
+      } // for
+    } // while
+
+    if (_woffset == _wbuf.length()) {
+      _wbuf.clear();
+      _woffset = 0;
+    } // if
+    else if (_woffset >= _record_size * 4) {
+      _wbuf.erase(0, _woffset);
+      _woffset = 0;
+    } // else if
+
+    return true;
+  } // GatewayClient::flush
+
+  bool GatewayClient::receive() {
+    char buf[64];
+
+    while(true) {
+      int ret = SSL_read(_ssl, buf, sizeof(buf));
+      if (ret <= 0) {
+        int err = SSL_get_error(_ssl, ret);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return true;
+        if (err != SSL_ERROR_ZERO_RETURN)
+          LOG(LogWarn, << "Gateway read from "
+                       << _host
+                       << " failed; "
+                       << TlsContext::error()
+                       << std::endl);
+        return false;
+      } // if
+      _rbuf.append(buf, ret);
+
+      // error response, command 8: status and the rejected identifier,
+      // Apple hangs up right after
+      if (_rbuf.length() >= 6) {
+        memcpy(&_error_identifier, _rbuf.data() + 2, sizeof(_error_identifier));
+        _error_identifier = ntohl(_error_identifier);
+        _error_status = (unsigned char) _rbuf[1];
+        _error = true;
+        ++_stats.rejected;
+        LOG(LogWarn, << "Gateway "
+                     << _host
+                     << " rejected notification "
+                     << _error_identifier
+                     << ", status "
+                     << _error_status
+                     << std::endl);
+        return false;
+      } // if
+    } // while
+
+    return true;
+  } // GatewayClient::receive
+
+  bool GatewayClient::run(const int timeout, const int wakeup_fd) {
+    if (!_ssl) return false;
+
+    // Apple hangs up right after its error response, so a write can fail
+    // before we got to read it, look for it or everything behind the bad
+    // frame is taken as delivered
+    if (!flush(false)) {
+      receive();
+      return false;
+    } // if
+
+    // Apple drops idle connections without telling us, beat it to it
+    if (buffered() == 0 && _timeout > 0 && _last_write_at + _timeout < time(NULL)) {
+      LOG(LogInfo, << "Gateway "
+                   << _host
+                   << " idle for "
+                   << _timeout
+                   << "s, disconnecting"
+                   << std::endl);
+      return false;
+    } // if
+
+    // sleep until the oldest frame is due, or the socket drains
+    int wait = _blocked ? -1 : flush_wait();
+    if (wait < 0 || wait > timeout) wait = timeout;
+
+    struct pollfd fds[2];
+    fds[0].fd = _sock;
+    fds[0].events = POLLIN | (_blocked ? POLLOUT : 0);
+    fds[0].revents = 0;
+    fds[1].fd = wakeup_fd;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+
+    int ret = poll(fds, wakeup_fd < 0 ? 1 : 2, SSL_pending(_ssl) ? 0 : wait);
+    if (ret < 0 && errno != EINTR) return false;
+
+    if (fds[1].revents & POLLIN) {
+      uint64_t count;
+      if (read(wakeup_fd, &count, sizeof(count)) < 0) { }
+    } // if
+
+    if ((fds[0].revents & POLLIN) || SSL_pending(_ssl)) {
+      if (!receive()) return false;
+    } // if
+    else if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) return false;
+
+    if (!flush(false)) {
+      receive();
+      return false;
+    } // if
+
+    return true;
+  } // GatewayClient::run
+} // namespace apnspusher
@@ -0,0 +1,541 @@
+#include "config.h"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#include <openframe/openframe.h>
+
+#include <Http2Client.h>
+#include <TlsContext.h>
+
+namespace apnspusher {
+  using namespace openframe::loglevel;
+
+  const size_t Http2Client::kDefaultMaxStreams		= 1000;
+  const unsigned int Http2Client::kDefaultMaxAttempts	= 3;
+
+  // stop taking frames from nghttp2 once this much is waiting on the socket
+  static const size_t kMaxWriteBuffer			= 1024 * 1024;
+  static const size_t kReadBuffer			= 16384;
+
+  // APNs error bodies are flat, {"reason":"Unregistered","timestamp":1454402113000}
+  static std::string json_string(const std::string &body, const std::string &name) {
+    std::string::size_type pos = body.find("\"" + name + "\"");
+    if (pos == std::string::npos) return "";
+    pos = body.find('"', body.find(':', pos) + 1);
+    if (pos == std::string::npos) return "";
+    std::string::size_type end = body.find('"', pos + 1);
+    if (end == std::string::npos) return "";
+    return body.substr(pos + 1, end - pos - 1);
+  } // json_string
+
+  static long long json_number(const std::string &body, const std::string &name) {
+    std::string::size_type pos = body.find("\"" + name + "\"");
+    if (pos == std::string::npos) return 0;
+    pos = body.find(':', pos);
+    if (pos == std::string::npos) return 0;
+    return strtoll(body.c_str() + pos + 1, NULL, 10);
+  } // json_number
+
+  static std::string json_escape(const std::string &str) {
+    std::string ret;
+    ret.reserve(str.length() + 2);
+    ret += '"';
+    for(std::string::const_iterator itr = str.begin(); itr != str.end(); itr++) {
+      unsigned char c = *itr;
+      switch(c) {
+        case '"': ret += "\\\""; break;
+        case '\\': ret += "\\\\"; break;
+        case '\n': ret += "\\n"; break;
+        case '\r': ret += "\\r"; break;
+        case '\t': ret += "\\t"; break;
+        default:
+          if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            ret += buf;
+          } // if
+          else ret += c;
+          break;
+      } // switch
+    } // for
+    ret += '"';
+    return ret;
+  } // json_escape
+
+  // nghttp2 keeps the pointers until the frame is packed, name and
+  // value have to outlive nghttp2_submit_request()
+  static nghttp2_nv make_nv(const char *name, const char *value, const size_t valuelen) {
+    nghttp2_nv nv;
+    nv.name = (uint8_t *) name;
+    nv.namelen = strlen(name);
+    nv.value = (uint8_t *) value;
+    nv.valuelen = valuelen;
+    nv.flags = NGHTTP2_NV_FLAG_NONE;
+    return nv;
+  } // make_nv
+
+  static nghttp2_nv make_nv(const char *name, const char *value) {
+    return make_nv(name, value, strlen(value));
+  } // make_nv
+
+  static nghttp2_nv make_nv(const char *name, const std::string &value) {
+    return make_nv(name, value.data(), value.length());
+  } // make_nv
+
+  Http2Client::Http2Client(const std::string &host,
+                           const int port,
+                           const std::string &cert,
+                           const std::string &key,
+                           const std::string &capath,
+                           const std::string &topic) :
+    _host(host),
+    _port(port),
+    _cert(cert),
+    _key(key),
+    _capath(capath),
+    _topic(topic),
+    _verify(true),
+    _max_streams(kDefaultMaxStreams),
+    _sock(-1),
+    _tls(NULL),
+    _own_tls(false),
+    _ssl(NULL),
+    _session(NULL),
+    _goaway(false),
+    _settings(false) {
+    reset_stats();
+  } // Http2Client::Http2Client
+
+  Http2Client::~Http2Client() {
+    disconnect();
+    if (_own_tls) delete _tls;
+  } // Http2Client::~Http2Client
+
+  Http2Client &Http2Client::set_tls(TlsContext *tls) {
+    if (_own_tls) delete _tls;
+    _tls = tls;
+    _own_tls = false;
+    return *this;
+  } // Http2Client::set_tls
+
+  void Http2Client::reset_stats() {
+    _stats.handshakes = 0;
+    _stats.resumed = 0;
+  } // Http2Client::reset_stats
+
+  bool Http2Client::connect() {
+    disconnect();
+
+    if (!_tls) {
+      _tls = new TlsContext(_cert, _key, _capath, _verify);
+      _tls->elogger( elogger(), elog_name() );
+      _own_tls = true;
+    } // if
+
+    bool resumed = false;
+    _ssl = _tls->connect(_host, _port, std::string("\x02h2", 3), &resumed);
+    if (!_ssl) return false;
+    _sock = SSL_get_fd(_ssl);
+
+    ++_stats.handshakes;
+    if (resumed) ++_stats.resumed;
+
+    bool ktls = TlsContext::ktls_send(_ssl);
+
+    const unsigned char *alpn = NULL;
+    unsigned int alpn_len = 0;
+    SSL_get0_alpn_selected(_ssl, &alpn, &alpn_len);
+    if (alpn_len != 2 || memcmp(alpn, "h2", 2)) {
+      LOG(LogWarn, << "HTTP/2 not negotiated by "
+                   << _host
+                   << std::endl);
+      disconnect();
+      return false;
+    } // if
+
+    fcntl(_sock, F_SETFL, fcntl(_sock, F_GETFL, 0) | O_NONBLOCK);
+
+    nghttp2_session_callbacks *callbacks;
+    nghttp2_session_callbacks_new(&callbacks);
+    nghttp2_session_callbacks_set_send_callback(callbacks, send_cb);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, on_header_cb);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, on_data_chunk_cb);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, on_stream_close_cb);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, on_frame_recv_cb);
+    nghttp2_session_client_new(&_session, callbacks, this);
+    nghttp2_session_callbacks_del(callbacks);
+
+    nghttp2_settings_entry settings[1];
+    settings[0].settings_id = NGHTTP2_SETTINGS_ENABLE_PUSH;
+    settings[0].value = 0;
+    nghttp2_submit_settings(_session, NGHTTP2_FLAG_NONE, settings, 1);
+
+    // the stream limit arrives in the server's SETTINGS, submitting
+    // before then risks having streams refused
+    time_t deadline = time(NULL) + TlsContext::kConnectTimeout;
+    while(!_settings) {
+      if (time(NULL) > deadline || !run(1000)) {
+        LOG(LogWarn, << "HTTP/2 no SETTINGS from "
+                     << _host
+                     << std::endl);
+        disconnect();
+        return false;
+      } // if
+    } // while
+
+    LOG(LogInfo, << "HTTP/2 connected to "
+                 << _host
+                 << ":"
+                 << _port
+                 << (resumed ? ", resumed" : ", full handshake")
+                 << (ktls ? ", kernel TLS" : _tls->ktls() ? ", kernel TLS unavailable" : "")
+                 << ", max streams "
+                 << nghttp2_session_get_remote_settings(_session, NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS)
+                 << std::endl);
+
+    return true;
+  } // Http2Client::connect
+
+  void Http2Client::disconnect() {
+    // nothing came back for these, they go out again on the next
+    // connection ahead of anything newer
+    std::map<int32_t, stream_t *>::reverse_iterator ritr;
+    for(ritr = _streams.rbegin(); ritr != _streams.rend(); ritr++) {
+      finish(ritr->second, NGHTTP2_CANCEL);
+      delete ritr->second;
+    } // for
+    _streams.clear();
+
+    if (_session) nghttp2_session_del(_session);
+    if (_ssl) {
+      SSL_shutdown(_ssl);
+      SSL_free(_ssl);
+    } // if
+    if (_sock >= 0) close(_sock);
+
+    _session = NULL;
+    _ssl = NULL;
+    _sock = -1;
+    _goaway = false;
+    _settings = false;
+    _wbuf.clear();
+  } // Http2Client::disconnect
+
+  size_t Http2Client::room() const {
+    if (!_session || _goaway) return 0;
+
+    size_t limit = std::min(size_t(nghttp2_session_get_remote_settings(_session,
+                                   NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS)), _max_streams);
+
+    // keep a stream limit's worth pending so freed streams are reused
+    // straight away instead of waiting on the next dequeue
+    size_t used = _pending.size() + _streams.size();
+    return limit * 2 > used ? limit * 2 - used : 0;
+  } // Http2Client::room
+
+  std::string Http2Client::payload(const std::string &text,
+                                   const std::string &action,
+                                   const int badge) {
+    std::stringstream s;
+    s << "{\"aps\":{\"alert\":{\"body\":"
+      << json_escape(text)
+      << ",\"action-loc-key\":"
+      << json_escape(action)
+      << "},\"badge\":"
+      << badge
+      << "}}";
+    return s.str();
+  } // Http2Client::payload
+
+  void Http2Client::add(const request_t &request) {
+    _pending.push_back(request);
+  } // Http2Client::add
+
+  size_t Http2Client::responses(responses_t &ret) {
+    size_t num = _responses.size();
+    ret.insert(ret.end(), _responses.begin(), _responses.end());
+    _responses.clear();
+    return num;
+  } // Http2Client::responses
+
+  bool Http2Client::run(const int timeout, const int wakeup_fd) {
+    if (!_session) return false;
+
+    if (!submit() || !flush()) return false;
+
+    struct pollfd fds[2];
+    fds[0].fd = _sock;
+    fds[0].events = POLLIN | (_wbuf.empty() ? 0 : POLLOUT);
+    fds[0].revents = 0;
+    fds[1].fd = wakeup_fd;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+
+    // TLS may already hold decrypted records the socket won't report
+    int ret = poll(fds, wakeup_fd < 0 ? 1 : 2, SSL_pending(_ssl) ? 0 : timeout);
+    if (ret < 0 && errno != EINTR) return false;
+
+    if (fds[1].revents & POLLIN) {
+      uint64_t count;
+      if (read(wakeup_fd, &count, sizeof(count)) < 0) { }
+    } // if
+
+    if ((fds[0].revents & POLLIN) || SSL_pending(_ssl)) {
+      if (!receive()) return false;
+    } // if
+    else if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) return false;
+
+    // answers free streams and open the window, refill straight away
+    if (!submit() || !flush()) return false;
+
+    if (_goaway && _streams.empty()) return false;
+
+    return nghttp2_session_want_read(_session) || nghttp2_session_want_write(_session);
+  } // Http2Client::run
+
+  bool Http2Client::submit() {
+    if (!_goaway && _settings) {
+      size_t limit = std::min(size_t(nghttp2_session_get_remote_settings(_session,
+                                     NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS)), _max_streams);
+      int32_t window = nghttp2_session_get_remote_window_size(_session);
+      std::string path, content_length;
+
+      while(!_pending.empty() && _streams.size() < limit) {
+        request_t &request = _pending.front();
+
+        // past the connection window DATA would just sit in nghttp2
+        // until a WINDOW_UPDATE, leave it pending and keep the stream
+        if (window < int32_t(request.payload.length()) && !_streams.empty()) break;
+        window -= request.payload.length();
+
+        stream_t *stream = new stream_t;
+        stream->request = request;
+        stream->status = 0;
+        stream->offset = 0;
+        ++stream->request.attempts;
+        _pending.pop_front();
+
+        path = "/3/device/" + stream->request.device_token;
+        char len[32];
+        snprintf(len, sizeof(len), "%lu", (unsigned long) stream->request.payload.length());
+        content_length = len;
+
+        nghttp2_nv hdrs[7];
+        size_t num_hdrs = 0;
+        hdrs[num_hdrs++] = make_nv(":method", "POST");
+        hdrs[num_hdrs++] = make_nv(":scheme", "https");
+        hdrs[num_hdrs++] = make_nv(":authority", _host);
+        hdrs[num_hdrs++] = make_nv(":path", path);
+        hdrs[num_hdrs++] = make_nv("content-length", content_length);
+        hdrs[num_hdrs++] = make_nv("apns-push-type", "alert");
+        if (_topic.length())
+          hdrs[num_hdrs++] = make_nv("apns-topic", _topic);
+
+        nghttp2_data_provider data;
+        data.source.ptr = stream;
+        data.read_callback = read_payload_cb;
+
+        int32_t stream_id = nghttp2_submit_request(_session, NULL, hdrs, num_hdrs, &data, stream);
+        if (stream_id < 0) {
+          LOG(LogWarn, << "HTTP/2 unable to submit request; "
+                       << nghttp2_strerror(stream_id)
+                       << std::endl);
+          --stream->request.attempts;
+          _pending.push_front(stream->request);
+          delete stream;
+          break;
+        } // if
+
+        _streams[stream_id] = stream;
+      } // while
+    } // if
+
+    // everything submitted above goes into _wbuf as one run of frames
+    int ret = nghttp2_session_send(_session);
+    if (ret != 0) {
+      LOG(LogWarn, << "HTTP/2 send failed; "
+                   << nghttp2_strerror(ret)
+                   << std::endl);
+      return false;
+    } // if
+
+    return true;
+  } // Http2Client::submit
+
+  bool Http2Client::flush() {
+    size_t offset = 0;
+    while(offset < _wbuf.length()) {
+      int ret = SSL_write(_ssl, _wbuf.data() + offset, _wbuf.length() - offset);
+      if (ret > 0) {
+        offset += ret;
+        continue;
+      } // if
+
+      int err = SSL_get_error(_ssl, ret);
+      if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) break;
+
+      LOG(LogWarn, << "HTTP/2 write to "
+                   << _host
+                   << " failed; "
+                   << TlsContext::error()
+                   << std::endl);
+      return false;
+    } // while
+
+    _wbuf.erase(0, offset);
+    return true;
+  } // Http2Client::flush
+
+  bool Http2Client::receive() {
+    unsigned char buf[kReadBuffer];
+
+    while(true) {
+      int ret = SSL_read(_ssl, buf, sizeof(buf));
+      if (ret <= 0) {
+        int err = SSL_get_error(_ssl, ret);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return true;
+        if (err != SSL_ERROR_ZERO_RETURN)
+          LOG(LogWarn, << "HTTP/2 read from "
+                       << _host
+                       << " failed; "
+                       << TlsContext::error()
+                       << std::endl);
+        return false;
+      } // if
+
+      ssize_t num = nghttp2_session_mem_recv(_session, buf, ret);
+      if (num < 0) {
+        LOG(LogWarn, << "HTTP/2 protocol error from "
+                     << _host
+                     << "; "
+                     << nghttp2_strerror(int(num))
+                     << std::endl);
+        return false;
+      } // if
+    } // while
+
+    return true;
+  } // Http2Client::receive
+
+  void Http2Client::finish(stream_t *stream, const uint32_t error_code) {
+    int status = stream->status;
+
+    // a refused stream was never processed, it doesn't use up a try
+    if (error_code == NGHTTP2_REFUSED_STREAM && status == 0)
+      --stream->request.attempts;
+
+    // reset, refused or throttled streams never reached the device,
+    // give them another go on this or the next connection
+    bool retry = (error_code != NGHTTP2_NO_ERROR && status == 0)
+                 || status == 429 || status >= 500;
+    if (retry && stream->request.attempts < kDefaultMaxAttempts) {
+      _pending.push_front(stream->request);
+      return;
+    } // if
+
+    response_t response;
+    response.request = stream->request;
+    response.status = status;
+    response.reason = json_string(stream->body, "reason");
+    response.timestamp = time_t(json_number(stream->body, "timestamp") / 1000);
+    _responses.push_back(response);
+  } // Http2Client::finish
+
+  ssize_t Http2Client::send_cb(nghttp2_session *session, const uint8_t *data, size_t length,
+                               int flags, void *user_data) {
+    Http2Client *client = static_cast<Http2Client *>(user_data);
+    if (client->_wbuf.length() >= kMaxWriteBuffer) return NGHTTP2_ERR_WOULDBLOCK;
+    client->_wbuf.append((const char *) data, length);
+    return length;
+  } // Http2Client::send_cb
+
+  int Http2Client::on_header_cb(nghttp2_session *session, const nghttp2_frame *frame,
+                                const uint8_t *name, size_t namelen,
+                                const uint8_t *value, size_t valuelen,
+                                uint8_t flags, void *user_data) {
+    if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_RESPONSE)
+      return 0;
+
+    stream_t *stream = static_cast<stream_t *>(nghttp2_session_get_stream_user_data(session, frame->hd.stream_id));
+    if (stream && namelen == 7 && !memcmp(name, ":status", 7))
+      stream->status = atoi(std::string((const char *) value, valuelen).c_str());
+
+    return 0;
+  } // Http2Client::on_header_cb
+
+  int Http2Client::on_data_chunk_cb(nghttp2_session *session, uint8_t flags, int32_t stream_id,
+                                    const uint8_t *data, size_t len, void *user_data) {
+    stream_t *stream = static_cast<stream_t *>(nghttp2_session_get_stream_user_data(session, stream_id));
+    if (stream) stream->body.append((const char *) data, len);
+    return 0;
+  } // Http2Client::on_data_chunk_cb
+
+  int Http2Client::on_stream_close_cb(nghttp2_session *session, int32_t stream_id,
+                                      uint32_t error_code, void *user_data) {
+    Http2Client *client = static_cast<Http2Client *>(user_data);
+
+    std::map<int32_t, stream_t *>::iterator ptr = client->_streams.find(stream_id);
+    if (ptr == client->_streams.end()) return 0;
+
+    stream_t *stream = ptr->second;
+    client->_streams.erase(ptr);
+    client->finish(stream, error_code);
+    delete stream;
+
+    return 0;
+  } // Http2Client::on_stream_close_cb
+
+  int Http2Client::on_frame_recv_cb(nghttp2_session *session, const nghttp2_frame *frame, void *user_data) {
+    Http2Client *client = static_cast<Http2Client *>(user_data);
+
+    switch(frame->hd.type) {
+      case NGHTTP2_SETTINGS:
+        if (!(frame->hd.flags & NGHTTP2_FLAG_ACK)) client->_settings = true;
+        break;
+      case NGHTTP2_GOAWAY:
+        // streams past last_stream_id are closed as refused and requeued,
+        // the rest finish before we reconnect
+        LOG(LogNotice, << "HTTP/2 GOAWAY from "
+                       << client->_host
+                       << ", error "
+                       << frame->goaway.error_code
+                       << std::endl);
+        client->_goaway = true;
+        break;
+      default:
+        break;
+    } // switch
+
+    return 0;
+  } // Http2Client::on_frame_recv_cb
+
+  ssize_t Http2Client::read_payload_cb(nghttp2_session *session, int32_t stream_id,
+                                       uint8_t *buf, size_t length, uint32_t *data_flags,
+                                       nghttp2_data_source *source, void *user_data) {
+    stream_t *stream = static_cast<stream_t *>(source->ptr);
+    const Payload &payload = stream->request.payload;
+
+    size_t num = std::min(length, payload.length() - stream->offset);
+    memcpy(buf, payload.data() + stream->offset, num);
+    stream->offset += num;
+    if (stream->offset >= payload.length()) *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+
+    return num;
+  } // Http2Client::read_payload_cb
+} // namespace apnspusher
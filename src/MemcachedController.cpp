@@ -32,6 +32,7 @@
 #include <cassert>
 #include <list>
 #include <map>
+#include <vector>
 #include <new>
 #include <iostream>
 #include <fstream>
@@ -148,6 +149,25 @@ namespace apnspusher {
 
   } // MemcachedController::replace
 
+  void MemcachedController::remove(const std::string &ns, const std::string &key) {
+    std::string cacheKey = ns + ":" + key;
+    memcached_return rc;
+
+    assert(_st != NULL);		// bug
+
+    if (cacheKey.length() > 255)
+      throw MemcachedController_Exception("memcached namespace and key must be less than 256 characters");
+
+    rc = memcached_delete(_st, cacheKey.c_str(), cacheKey.length(), 0);
+
+    // already gone is as good as removed
+    if (rc != MEMCACHED_SUCCESS && rc != MEMCACHED_NOTFOUND) {
+      throw MemcachedController_Exception("memcached unable to remove; "
+        + std::string(memcached_strerror(_st, rc)));
+    } // if
+
+  } // MemcachedController::remove
+
   const MemcachedController::memcachedReturnEnum MemcachedController::get(const std::string &ns, const std::string &key, std::string &buf) {
     std::string cacheKey = ns + ":" + key;
     memcachedReturnEnum ret;
@@ -189,4 +209,51 @@ namespace apnspusher {
     return ret;
   } // MemcachedController::get
 
+  const size_t MemcachedController::mget(const std::string &ns, const std::vector<std::string> &keys, mgetResultType &ret) {
+    std::vector<std::string> cacheKeys;
+    std::vector<const char *> keyList;
+    std::vector<size_t> keyLengths;
+    memcached_result_st *result;
+    memcached_return rc;
+    size_t num = 0;
+
+    assert(_st != NULL);		// bug
+
+    if (keys.empty()) return 0;
+
+    // keyList points into cacheKeys, size it up front
+    cacheKeys.reserve(keys.size());
+    for(std::vector<std::string>::const_iterator itr = keys.begin(); itr != keys.end(); itr++) {
+      std::string cacheKey = ns + ":" + *itr;
+
+      if (cacheKey.length() > 255)
+        throw MemcachedController_Exception("memcached namespace and key must be less than 256 characters");
+
+      cacheKeys.push_back(cacheKey);
+      keyList.push_back(cacheKeys.back().c_str());
+      keyLengths.push_back(cacheKeys.back().length());
+    } // for
+
+    rc = memcached_mget(_st, &keyList[0], &keyLengths[0], keyList.size());
+    if (rc != MEMCACHED_SUCCESS)
+      throw MemcachedController_Exception("memcached unable to mget; "
+            + std::string(memcached_strerror(_st, rc)));
+
+    size_t prefix = ns.length() + 1;
+    while( (result = memcached_fetch_result(_st, NULL, &rc)) != NULL) {
+      std::string cacheKey(memcached_result_key_value(result), memcached_result_key_length(result));
+      if (cacheKey.length() > prefix) {
+        ret[cacheKey.substr(prefix)] = std::string(memcached_result_value(result), memcached_result_length(result));
+        ++num;
+      } // if
+      memcached_result_free(result);
+    } // while
+
+    if (rc != MEMCACHED_END && rc != MEMCACHED_SUCCESS && rc != MEMCACHED_NOTFOUND)
+      throw MemcachedController_Exception("memcached unable to fetch; "
+            + std::string(memcached_strerror(_st, rc)));
+
+    return num;
+  } // MemcachedController::mget
+
 } // namespace apnspusher
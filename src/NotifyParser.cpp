@@ -0,0 +1,155 @@
+#include "config.h"
+
+#include <string>
+
+#include <string.h>
+#include <ctype.h>
+
+#include <openframe/openframe.h>
+
+#include <NotifyParser.h>
+#include <Pipeline.h>
+
+namespace apnspusher {
+
+  // fields we keep track of while scanning
+  enum {
+    FIELD_SR	= 0x01,
+    FIELD_TO	= 0x02,
+    FIELD_MS	= 0x04,
+    FIELD_PA	= 0x08,
+    FIELD_ID	= 0x10
+  };
+
+  NotifyParser::parseEnum NotifyParser::parse(const char *buf, const size_t len, notify_message_t &ret) {
+    // a '|' or ':' inside a value only survives escaped, leave decoding
+    // it to the Vars that encoded it
+    if (memchr(buf, '\\', len) || memchr(buf, '%', len))
+      return parse_escaped(buf, len, ret);
+
+    slice_t sr = { buf, 0 }, to = sr, ms = sr, id = sr;
+    unsigned int seen = 0;
+
+    const char *p = buf;
+    const char *end = buf + len;
+    while(p < end) {
+      const char *next = static_cast<const char *>( memchr(p, '|', end - p) );
+      if (next == NULL) next = end;
+
+      const char *colon = static_cast<const char *>( memchr(p, ':', next - p) );
+      if (colon != NULL) {
+        slice_t key = { p, static_cast<size_t>(colon - p) };
+        slice_t value = { colon + 1, static_cast<size_t>(next - colon - 1) };
+
+        if (is_key(key, "ao")) return PARSE_ACKONLY;
+        else if (is_key(key, "sr")) { sr = value; seen |= FIELD_SR; }
+        else if (is_key(key, "to")) { to = value; seen |= FIELD_TO; }
+        else if (is_key(key, "ms")) { ms = value; seen |= FIELD_MS; }
+        else if (is_key(key, "pa")) seen |= FIELD_PA;
+        else if (is_key(key, "id")) { id = value; seen |= FIELD_ID; }
+      } // if
+
+      p = next + 1;
+    } // while
+
+    const unsigned int required = FIELD_SR | FIELD_TO | FIELD_MS | FIELD_PA;
+    if ((seen & required) != required) return PARSE_INCOMPLETE;
+
+    bool ok = copy(sr, ret.source, notify_message_t::kMaxCallsignLength, true)
+              && copy(to, ret.target, notify_message_t::kMaxCallsignLength, true)
+              && copy(id, ret.id, notify_message_t::kMaxIdLength, false)
+              && copy(ms, ret.body, notify_message_t::kMaxBodyLength, false);
+
+    return ok ? PARSE_OK : PARSE_TOOLONG;
+  } // NotifyParser::parse
+
+  NotifyParser::parseEnum NotifyParser::parse_escaped(const char *buf, const size_t len, notify_message_t &ret) {
+    openframe::Vars v( std::string(buf, len) );
+
+    if (v.is("ao")) return PARSE_ACKONLY;
+    if (!v.is("sr,to,ms,pa")) return PARSE_INCOMPLETE;
+
+    std::string sr = v.get("sr"), to = v.get("to"), id = v.get("id"), ms = v.get("ms");
+    slice_t srs = { sr.data(), sr.size() }, tos = { to.data(), to.size() };
+    slice_t ids = { id.data(), id.size() }, mss = { ms.data(), ms.size() };
+
+    bool ok = copy(srs, ret.source, notify_message_t::kMaxCallsignLength, true)
+              && copy(tos, ret.target, notify_message_t::kMaxCallsignLength, true)
+              && copy(ids, ret.id, notify_message_t::kMaxIdLength, false)
+              && copy(mss, ret.body, notify_message_t::kMaxBodyLength, false);
+
+    return ok ? PARSE_OK : PARSE_TOOLONG;
+  } // NotifyParser::parse_escaped
+
+  size_t NotifyParser::parse_change(const char *buf, const size_t len, std::vector<std::string> &ret) {
+    size_t num = 0;
+
+    const char *p = buf;
+    const char *end = buf + len;
+    while(p < end) {
+      const char *next = static_cast<const char *>( memchr(p, '|', end - p) );
+      if (next == NULL) next = end;
+
+      const char *colon = static_cast<const char *>( memchr(p, ':', next - p) );
+      slice_t key = { p, colon ? static_cast<size_t>(colon - p) : 0 };
+      if (colon != NULL && is_key(key, "cs")) {
+        const char *q = colon + 1;
+        while(q < next) {
+          const char *comma = static_cast<const char *>( memchr(q, ',', next - q) );
+          if (comma == NULL) comma = next;
+
+          slice_t value = { q, static_cast<size_t>(comma - q) };
+          char callsign[notify_message_t::kMaxCallsignLength + 1];
+          if (value.len && copy(value, callsign, notify_message_t::kMaxCallsignLength, true)) {
+            ret.push_back(callsign);
+            ++num;
+          } // if
+
+          q = comma + 1;
+        } // while
+      } // if
+
+      p = next + 1;
+    } // while
+
+    return num;
+  } // NotifyParser::parse_change
+
+  const char *NotifyParser::str(const parseEnum result) {
+    switch(result) {
+      case PARSE_OK:
+        return "ok";
+      case PARSE_ACKONLY:
+        return "ack only";
+      case PARSE_INCOMPLETE:
+        return "missing sr, to, ms or pa";
+      case PARSE_TOOLONG:
+        return "field too long";
+    } // switch
+
+    return "unknown";
+  } // NotifyParser::str
+
+  bool NotifyParser::is_key(const slice_t &key, const char *name) {
+    size_t i = 0;
+    for(; i < key.len; i++) {
+      // keys are plain ascii letters, folding the case bit is enough
+      if (name[i] == '\0' || (key.ptr[i] | 0x20) != name[i]) return false;
+    } // for
+
+    return name[i] == '\0';
+  } // NotifyParser::is_key
+
+  bool NotifyParser::copy(const slice_t &value, char *dst, const size_t max, const bool upper) {
+    if (value.len > max) return false;
+
+    if (upper) {
+      for(size_t i = 0; i < value.len; i++)
+        dst[i] = toupper(static_cast<unsigned char>(value.ptr[i]));
+    } // if
+    else memcpy(dst, value.ptr, value.len);
+
+    dst[value.len] = '\0';
+    return true;
+  } // NotifyParser::copy
+} // namespace apnspusher
@@ -0,0 +1,222 @@
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <openframe/openframe.h>
+
+#include <App.h>
+#include <Pipeline.h>
+#include <PushWriter.h>
+#include <Store.h>
+
+namespace apnspusher {
+  using namespace openframe::loglevel;
+
+  const time_t PushWriter::kDefaultStatsInterval	= 3600;
+  const time_t PushWriter::kDefaultMemcachedExpire	= 3600;
+  const size_t PushWriter::kDefaultFlushRows		= 100;
+  const int PushWriter::kDefaultFlushInterval		= 1000;
+  const int PushWriter::kDefaultIdleTimeout		= 2000;
+
+  PushWriter::PushWriter(const thread_id_t thread_id,
+                         const std::string &memcached_host,
+                         const std::string &db_host,
+                         const std::string &db_user,
+                         const std::string &db_pass,
+                         const std::string &db_database)
+             : openframe::LogObject(thread_id),
+               _memcached_host(memcached_host),
+               _db_host(db_host),
+               _db_user(db_user),
+               _db_pass(db_pass),
+               _db_database(db_database) {
+
+    _store = NULL;
+    _record_q = NULL;
+    _flush_rows = kDefaultFlushRows;
+    _flush_interval = kDefaultFlushInterval;
+
+    init_stats(_stats, true);
+    init_stats(_stompstats, true);
+    _stats.report_interval = 60;
+    _stompstats.report_interval = 5;
+  } // PushWriter::PushWriter
+
+  PushWriter::~PushWriter() {
+    onDestroyStats();
+
+    if (_store) delete _store;
+  } // PushWriter::~PushWriter
+
+  void PushWriter::init() {
+    try {
+      _store = new Store(thread_id(),
+                         _db_host,
+                         _db_user,
+                         _db_pass,
+                         _db_database,
+                         _memcached_host,
+                         kDefaultMemcachedExpire,
+                         kDefaultStatsInterval);
+      _store->set_elogger( elogger(), elog_name() );
+      _store->init();
+    } // try
+    catch(std::bad_alloc xa) {
+      assert(false);
+    } // catch
+
+    _rows.reserve(_flush_rows);
+    _profile.add("pushwriter.flush", 300);
+  } // PushWriter::init
+
+  void PushWriter::init_stats(obj_stats_t &stats, const bool startup) {
+    stats.rows = 0;
+    stats.flushes = 0;
+    stats.retried = 0;
+    stats.failed = 0;
+    stats.max_flush = 0;
+    stats.flush_time = 0.0;
+
+    stats.last_report_at = time(NULL);
+    if (startup) stats.created_at = time(NULL);
+  } // PushWriter::init_stats
+
+  void PushWriter::onDescribeStats() {
+    describe_stat("num.rows", "writer"+thread_id_str()+"/num rows", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("num.flushes", "writer"+thread_id_str()+"/num flushes", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("num.retried", "writer"+thread_id_str()+"/num retried", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("num.failed", "writer"+thread_id_str()+"/num failed", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("flush.rows", "writer"+thread_id_str()+"/rows per flush", openstats::graphTypeGauge, openstats::dataTypeFloat);
+    describe_stat("flush.max", "writer"+thread_id_str()+"/max rows per flush", openstats::graphTypeGauge, openstats::dataTypeInt);
+    describe_stat("flush.latency", "writer"+thread_id_str()+"/seconds per flush", openstats::graphTypeGauge, openstats::dataTypeFloat);
+    describe_stat("queue.record", "writer"+thread_id_str()+"/record queue", openstats::graphTypeGauge, openstats::dataTypeInt);
+  } // PushWriter::onDescribeStats
+
+  void PushWriter::onDestroyStats() {
+    destroy_stat("num.*");
+    destroy_stat("flush.*");
+    destroy_stat("queue.*");
+  } // PushWriter::onDestroyStats
+
+  void PushWriter::try_stats() {
+    try_stompstats();
+
+    if (_stats.last_report_at > time(NULL) - _stats.report_interval) return;
+
+    int diff = time(NULL) - _stats.last_report_at;
+    double rps = double(_stats.rows) / diff;
+    double rpf = _stats.flushes ? double(_stats.rows) / _stats.flushes : 0.0;
+
+    TLOG(LogNotice, << "Stats rows " << _stats.rows
+                    << ", rps " << rps << "/s"
+                    << ", flushes " << _stats.flushes
+                    << ", rows/flush " << rpf
+                    << ", max flush " << _stats.max_flush
+                    << ", retried " << _stats.retried
+                    << ", failed " << _stats.failed
+                    << ", record queue " << _record_q->size()
+                    << "/" << _record_q->capacity()
+                    << ", average "
+                    << std::fixed << std::setprecision(4)
+                    << _profile.average("pushwriter.flush")
+                    << "s"
+                    << std::endl);
+
+    init_stats(_stats);
+  } // PushWriter::try_stats
+
+  void PushWriter::try_stompstats() {
+    if (_stompstats.last_report_at > time(NULL) - _stompstats.report_interval) return;
+
+    datapoint("num.rows", _stompstats.rows);
+    datapoint("num.flushes", _stompstats.flushes);
+    datapoint("num.retried", _stompstats.retried);
+    datapoint("num.failed", _stompstats.failed);
+    datapoint_float("flush.rows", _stompstats.flushes ? double(_stompstats.rows) / _stompstats.flushes : 0.0);
+    datapoint("flush.max", _stompstats.max_flush);
+    datapoint_float("flush.latency", _stompstats.flushes ? _stompstats.flush_time / _stompstats.flushes : 0.0);
+    datapoint("queue.record", _record_q->size());
+
+    init_stats(_stompstats);
+  } // PushWriter::try_stompstats
+
+  bool PushWriter::run() {
+    try_stats();
+
+    // wait for the first row of a batch, then keep collecting until
+    // the batch is full or its interval runs out
+    if ( !_record_q->dequeue(_rows, _flush_rows, kDefaultIdleTimeout) ) return false;
+
+    openframe::Stopwatch sw;
+    sw.Start();
+    while(_rows.size() < _flush_rows) {
+      int remaining = _flush_interval - int(sw.Time() * 1000);
+      if (remaining <= 0 || app->is_done()) break;
+      _record_q->dequeue(_rows, _flush_rows - _rows.size(), remaining);
+    } // while
+
+    return flush();
+  } // PushWriter::run
+
+  void PushWriter::drain() {
+    while( _record_q->dequeue(_rows, _flush_rows, 0) ) flush();
+  } // PushWriter::drain
+
+  bool PushWriter::flush() {
+    if (_rows.empty()) return true;
+
+    openframe::Stopwatch sw;
+    sw.Start();
+
+    size_t num_inserted = _store->setApnsPushes(_rows);
+    double elapsed = sw.Time();
+    _profile.average("pushwriter.flush", elapsed);
+
+    ++_stats.flushes;
+    ++_stompstats.flushes;
+    _stats.rows += _rows.size();
+    _stompstats.rows += _rows.size();
+    _stompstats.flush_time += elapsed;
+    if (_rows.size() > _stats.max_flush) _stats.max_flush = _rows.size();
+    if (_rows.size() > _stompstats.max_flush) _stompstats.max_flush = _rows.size();
+
+    // one bad row gets the whole statement rejected and nothing is
+    // inserted, write them one at a time so only that row is lost
+    bool ok = num_inserted == _rows.size();
+    if (!ok) {
+      TLOG(LogWarn, << "Unable to insert APNS push records, "
+                    << num_inserted
+                    << " of "
+                    << _rows.size()
+                    << " written, retrying one by one"
+                    << std::endl);
+
+      _stats.retried += _rows.size();
+      _stompstats.retried += _rows.size();
+      for(std::vector<apns_push_t>::iterator itr = _rows.begin(); itr != _rows.end(); itr++) {
+        if ( _store->setApnsPush(itr->register_id, itr->alertmsg) ) continue;
+
+        ++_stats.failed;
+        ++_stompstats.failed;
+        TLOG(LogError, << "Unable to insert APNS push record: "
+                       << itr->alertmsg
+                       << std::endl);
+      } // for
+    } // if
+
+    TLOG(LogDebug, << "flushed "
+                   << _rows.size()
+                   << " APNS push records in "
+                   << std::fixed << std::setprecision(4)
+                   << sw.Time()
+                   << "s"
+                   << std::endl);
+
+    _rows.clear();
+    return ok;
+  } // PushWriter::flush
+} // namespace apnspusher
@@ -0,0 +1,306 @@
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include <openframe/openframe.h>
+#include <apns/apns.h>
+
+#include <App.h>
+#include <APNS.h>
+#include <Pipeline.h>
+#include <Pusher.h>
+#include <Store.h>
+
+namespace apnspusher {
+  using namespace openframe::loglevel;
+
+  const time_t Pusher::kDefaultStatsInterval		= 3600;
+  const time_t Pusher::kDefaultMemcachedExpire		= 3600;
+  const int Pusher::kDefaultIdleTimeout			= 2000;
+
+  Pusher::Pusher(const thread_id_t thread_id,
+                 const std::string &memcached_host,
+                 const std::string &db_host,
+                 const std::string &db_user,
+                 const std::string &db_pass,
+                 const std::string &db_database)
+         : openframe::LogObject(thread_id),
+           _memcached_host(memcached_host),
+           _db_host(db_host),
+           _db_user(db_user),
+           _db_pass(db_pass),
+           _db_database(db_database) {
+
+    _store = NULL;
+    _apns = NULL;
+    _push_q = NULL;
+    _record_q = NULL;
+
+    init_stats(_stats, true);
+    init_stats(_stompstats, true);
+    _stats.report_interval = 60;
+    _stompstats.report_interval = 5;
+  } // Pusher::Pusher
+
+  Pusher::~Pusher() {
+    onDestroyStats();
+
+    if (_store) delete _store;
+  } // Pusher::~Pusher
+
+  void Pusher::init() {
+    try {
+      _store = new Store(thread_id(),
+                         _db_host,
+                         _db_user,
+                         _db_pass,
+                         _db_database,
+                         _memcached_host,
+                         kDefaultMemcachedExpire,
+                         kDefaultStatsInterval);
+      _store->set_elogger( elogger(), elog_name() );
+      // callsigns pruned after feedback are evicted from the local cache
+      // and fetched again on the next index sync
+      _store->set_cache( app->register_cache() );
+      _store->set_index( app->register_index() );
+      _store->init();
+
+      _apns = app->apns();
+    } // try
+    catch(std::bad_alloc xa) {
+      assert(false);
+    } // catch
+  } // Pusher::init
+
+  void Pusher::init_stats(obj_stats_t &stats, const bool startup) {
+    stats.jobs = 0;
+    stats.queued = 0;
+    stats.dropped = 0;
+    stats.recorded = 0;
+    stats.record_fallbacks = 0;
+    stats.feedbacks = 0;
+    stats.pruned = 0;
+    stats.evicted = 0;
+
+    stats.last_report_at = time(NULL);
+    if (startup) stats.created_at = time(NULL);
+  } // Pusher::init_stats
+
+  void Pusher::onDescribeStats() {
+    describe_stat("num.jobs", "pusher"+thread_id_str()+"/num jobs", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("num.queued", "pusher"+thread_id_str()+"/num queued", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("num.dropped", "pusher"+thread_id_str()+"/num dropped", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("num.recorded", "pusher"+thread_id_str()+"/num recorded", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("num.record.fallbacks", "pusher"+thread_id_str()+"/num record fallbacks", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("num.feedbacks", "pusher"+thread_id_str()+"/num feedbacks", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("num.pruned", "pusher"+thread_id_str()+"/num tokens pruned", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("queue.push", "pusher"+thread_id_str()+"/push queue", openstats::graphTypeGauge, openstats::dataTypeInt);
+    describe_stat("queue.record", "pusher"+thread_id_str()+"/record queue", openstats::graphTypeGauge, openstats::dataTypeInt);
+    describe_stat("queue.apns", "pusher"+thread_id_str()+"/apns queue", openstats::graphTypeGauge, openstats::dataTypeInt);
+  } // Pusher::onDescribeStats
+
+  void Pusher::onDestroyStats() {
+    destroy_stat("num.*");
+    destroy_stat("queue.*");
+  } // Pusher::onDestroyStats
+
+  void Pusher::try_stats() {
+    try_stompstats();
+
+    if (_stats.last_report_at > time(NULL) - _stats.report_interval) return;
+
+    int diff = time(NULL) - _stats.last_report_at;
+    double qps = double(_stats.queued) / diff;
+
+    TLOG(LogNotice, << "Stats jobs " << _stats.jobs
+                    << ", queued " << _stats.queued
+                    << ", qps " << qps << "/s"
+                    << ", dropped " << _stats.dropped
+                    << ", recorded " << _stats.recorded
+                    << ", record fallbacks " << _stats.record_fallbacks
+                    << ", feedbacks " << _stats.feedbacks
+                    << ", tokens pruned " << _stats.pruned
+                    << ", callsigns evicted " << _stats.evicted
+                    << ", push queue " << _push_q->size()
+                    << "/" << _push_q->capacity()
+                    << ", record queue " << _record_q->size()
+                    << "/" << _record_q->capacity()
+                    << std::endl);
+
+    init_stats(_stats);
+  } // Pusher::try_stats
+
+  void Pusher::try_stompstats() {
+    if (_stompstats.last_report_at > time(NULL) - _stompstats.report_interval) return;
+
+    datapoint("num.jobs", _stompstats.jobs);
+    datapoint("num.queued", _stompstats.queued);
+    datapoint("num.dropped", _stompstats.dropped);
+    datapoint("num.recorded", _stompstats.recorded);
+    datapoint("num.record.fallbacks", _stompstats.record_fallbacks);
+    datapoint("num.feedbacks", _stompstats.feedbacks);
+    datapoint("num.pruned", _stompstats.pruned);
+    datapoint("queue.push", _push_q->size());
+    datapoint("queue.record", _record_q->size());
+    datapoint("queue.apns", _apns->backlog());
+
+    init_stats(_stompstats);
+  } // Pusher::try_stompstats
+
+  bool Pusher::run() {
+    try_stats();
+    try_feedback();
+
+    push_job_t job;
+    if ( !_push_q->dequeue(job, kDefaultIdleTimeout) ) return false;
+
+    ++_stats.jobs;
+    ++_stompstats.jobs;
+    event_message_to_apns(job);
+    return true;
+  } // Pusher::run
+
+  bool Pusher::event_message_to_apns(push_job_t &job) {
+    notify_message_t &nm = job.message;
+    apns_registers_t &res = job.registers;
+
+    openframe::Stopwatch sw;
+    sw.Start();
+
+    // every device gets the same alert, serialize it once and let the
+    // notifications share it
+    std::stringstream s;
+    s << nm.source << ": " << nm.body;
+    std::string text = s.str();
+    Payload payload = APNS::payload(text, "View", 1);
+
+    size_t num_sent = 0;
+    while( !res.empty() ) {
+      apns_register_t *ar = res.front();
+
+      // apns_register.id, apns_register.device_token, apns_register.environment
+      TLOG(LogDebug, << "found id "
+                     << ar->id
+                     << ", device token "
+                     << ar->device_token
+                     << ", environment "
+                     << ar->environment
+                     << ", for "
+                     << nm.target
+                     << std::endl);
+
+      APNS::notification_t notification;
+      notification.device_token = ar->device_token;
+      notification.payload = payload;
+
+      APNS::environmentEnum environment = APNS::ENVIRONMENT_SANDBOX;
+      if (!strcasecmp(ar->environment.c_str(), "prod"))
+        environment = APNS::ENVIRONMENT_PROD;
+
+      if ( !_apns->push(notification, environment) ) {
+        TLOG(LogWarn, << "Dropped APNS to "
+                      << nm.target
+                      << ", "
+                      << APNS::environment_str(environment)
+                      << " push pool not running"
+                      << std::endl);
+        ++_stats.dropped;
+        ++_stompstats.dropped;
+        delete ar;
+        res.pop_front();
+        continue;
+      } // if
+      record_push(ar->id, text);
+
+      TLOG(LogNotice, << "Queuing APNS to "
+                      << nm.target
+                      << ": <"
+                      << nm.source
+                      << "> "
+                      << nm.body
+                      << std::endl);
+      delete ar;
+      res.pop_front();
+
+      ++num_sent;
+    } // while
+
+    double avg = _apns->profile.average("apns.push", sw.Time());
+    _stats.queued += num_sent;
+    _stompstats.queued += num_sent;
+
+    TLOG(LogNotice, << "Queued "
+                    << num_sent
+                    << " rows to APNS in ("
+                    << std::fixed << std::setprecision(4)
+                    << sw.Time()
+                    << " seconds, "
+                    << std::fixed << std::setprecision(4)
+                    << avg
+                    << " 5min)"
+                    << std::endl);
+
+    return true;
+  } // Pusher::event_message_to_apns
+
+  void Pusher::record_push(const std::string &id, const std::string &message) {
+    apns_push_t row;
+    row.register_id = id;
+    row.alertmsg = message;
+    row.created_at = time(NULL);
+
+    // the write behind keeps MySQL off the push path, should it fall
+    // that far behind write the row ourselves rather than lose it
+    if ( _record_q->enqueue(row, 0) ) {
+      ++_stats.recorded;
+      ++_stompstats.recorded;
+      return;
+    } // if
+
+    ++_stats.record_fallbacks;
+    ++_stompstats.record_fallbacks;
+    bool ok = _store->setApnsPush(id, message);
+    if (!ok) {
+      TLOG(LogError, << "Unable to insert APNS push record: "
+                     << message
+                     << std::endl);
+    } // if
+  } // Pusher::record_push
+
+  void Pusher::try_feedback() {
+    std::vector<apns_feedback_t> feedbacks;
+
+    APNS::feedback_t fb;
+    while( _apns->next_feedback(fb) ) {
+      apns_feedback_t feedback;
+      feedback.device_token = fb.device_token;
+      feedback.apns_timestamp = fb.timestamp;
+      feedbacks.push_back(feedback);
+    } // while
+
+    if (feedbacks.empty()) return;
+
+    size_t num_evicted;
+    size_t num_pruned = _store->pruneApnsRegisters(feedbacks, num_evicted);
+
+    _stats.feedbacks += feedbacks.size();
+    _stompstats.feedbacks += feedbacks.size();
+    _stats.pruned += num_pruned;
+    _stompstats.pruned += num_pruned;
+    _stats.evicted += num_evicted;
+
+    TLOG(LogNotice, << "APNS feedback for "
+                    << feedbacks.size()
+                    << " tokens, pruned "
+                    << num_pruned
+                    << " registers, evicted "
+                    << num_evicted
+                    << " callsigns"
+                    << std::endl);
+  } // Pusher::try_feedback
+} // namespace apnspusher
@@ -0,0 +1,164 @@
+#include "config.h"
+
+#include <string>
+#include <new>
+#include <cassert>
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <openframe/openframe.h>
+
+#include "RegisterCache.h"
+
+namespace apnspusher {
+
+/**************************************************************************
+ ** RegisterCache Class                                                  **
+ **************************************************************************/
+  const size_t RegisterCache::kDefaultSize		= 65536;
+  const size_t RegisterCache::kDefaultShards		= 16;
+  const time_t RegisterCache::kDefaultTtl		= 60;
+  const time_t RegisterCache::kDefaultNegativeTtl	= 30;
+
+  RegisterCache::RegisterCache(const size_t size,
+                               const time_t ttl,
+                               const time_t negative_ttl,
+                               const size_t num_shards)
+                : _ttl(ttl),
+                  _negative_ttl(negative_ttl) {
+
+    size_t n = num_shards ? num_shards : 1;
+    size_t per_shard = size / n;
+    if (per_shard < 1) per_shard = 1;
+
+    try {
+      for(size_t i = 0; i < n; i++) {
+        shard_t *s = new shard_t;
+        s->slots.resize(per_shard);
+        for(size_t j = 0; j < per_shard; j++) {
+          s->slots[j].used = false;
+          s->slots[j].referenced = false;
+          s->slots[j].expires_at = 0;
+        } // for
+        s->hand = 0;
+        s->seed = time(NULL) + i;
+        _shards.push_back(s);
+      } // for
+    } // try
+    catch(std::bad_alloc xa) {
+      assert(false);
+    } // catch
+  } // RegisterCache::RegisterCache
+
+  RegisterCache::~RegisterCache() {
+    for(size_t i = 0; i < _shards.size(); i++)
+      delete _shards[i];
+  } // RegisterCache::~RegisterCache
+
+  RegisterCache::shard_t &RegisterCache::shard(const std::string &key) {
+    // FNV-1a
+    unsigned int hash = 2166136261U;
+    for(size_t i = 0; i < key.length(); i++) {
+      hash ^= static_cast<unsigned char>(key[i]);
+      hash *= 16777619U;
+    } // for
+
+    return *_shards[hash % _shards.size()];
+  } // RegisterCache::shard
+
+  RegisterCache::lookupEnum RegisterCache::get(const std::string &key, apns_registers_t &ret) {
+    shard_t &s = shard(key);
+    openframe::scoped_lock slock(&s.lock);
+
+    index_t::iterator itr = s.index.find(key);
+    if (itr == s.index.end()) return REGISTER_CACHE_MISS;
+
+    entry_t &e = s.slots[itr->second];
+    if (e.expires_at <= time(NULL)) {
+      e.used = false;
+      e.rows.clear();
+      s.index.erase(itr);
+      return REGISTER_CACHE_MISS;
+    } // if
+
+    e.referenced = true;
+    if (e.rows.empty()) return REGISTER_CACHE_NOTFOUND;
+
+    for(rows_t::const_iterator ritr = e.rows.begin(); ritr != e.rows.end(); ritr++)
+      ret.push_back(new apns_register_t(*ritr));
+
+    return REGISTER_CACHE_FOUND;
+  } // RegisterCache::get
+
+  void RegisterCache::put(const std::string &key, const apns_registers_t &registers) {
+    shard_t &s = shard(key);
+    openframe::scoped_lock slock(&s.lock);
+
+    size_t slot;
+    index_t::iterator itr = s.index.find(key);
+    if (itr != s.index.end()) slot = itr->second;
+    else {
+      slot = evict(s);
+      s.index[key] = slot;
+    } // else
+
+    entry_t &e = s.slots[slot];
+    e.key = key;
+    e.rows.clear();
+    for(apns_registers_citr ritr = registers.begin(); ritr != registers.end(); ritr++)
+      e.rows.push_back(*(*ritr));
+    // up to a tenth early so callsigns cached together, typically by
+    // the same busy batch, don't all miss at the same moment
+    time_t ttl = registers.empty() ? _negative_ttl : _ttl;
+    if (ttl >= 10) ttl -= rand_r(&s.seed) % (ttl / 10 + 1);
+    e.expires_at = time(NULL) + ttl;
+    e.used = true;
+    e.referenced = false;
+  } // RegisterCache::put
+
+  void RegisterCache::remove(const std::string &key) {
+    shard_t &s = shard(key);
+    openframe::scoped_lock slock(&s.lock);
+
+    index_t::iterator itr = s.index.find(key);
+    if (itr == s.index.end()) return;
+
+    entry_t &e = s.slots[itr->second];
+    e.used = false;
+    e.rows.clear();
+    s.index.erase(itr);
+  } // RegisterCache::remove
+
+  size_t RegisterCache::size() {
+    size_t ret = 0;
+    for(size_t i = 0; i < _shards.size(); i++) {
+      openframe::scoped_lock slock(&_shards[i]->lock);
+      ret += _shards[i]->index.size();
+    } // for
+
+    return ret;
+  } // RegisterCache::size
+
+  // CLOCK, sweep the hand over the slots giving referenced entries a
+  // second chance and take the first free, expired or unreferenced one
+  size_t RegisterCache::evict(shard_t &s) {
+    time_t now = time(NULL);
+    while(true) {
+      size_t slot = s.hand;
+      s.hand = (s.hand + 1) % s.slots.size();
+
+      entry_t &e = s.slots[slot];
+      if (!e.used) return slot;
+
+      if (e.referenced && e.expires_at > now) {
+        e.referenced = false;
+        continue;
+      } // if
+
+      s.index.erase(e.key);
+      e.used = false;
+      return slot;
+    } // while
+  } // RegisterCache::evict
+} // namespace apnspusher
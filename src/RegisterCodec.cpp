@@ -0,0 +1,124 @@
+#include "config.h"
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+#include <strings.h>
+
+#include "RegisterCodec.h"
+
+namespace apnspusher {
+
+/**************************************************************************
+ ** RegisterCodec Class                                                  **
+ **************************************************************************/
+  const unsigned char RegisterCodec::kMagic		= 0xA7;
+  const unsigned char RegisterCodec::kVersion		= 1;
+  const size_t RegisterCodec::kTokenLength		= 32;
+
+  bool RegisterCodec::encode(const apns_registers_t &registers, std::string &ret) {
+    std::string buf;
+    buf.reserve(4 + registers.size() * (kTokenLength + 6));
+
+    buf += static_cast<char>(kMagic);
+    buf += static_cast<char>(kVersion);
+    buf += static_cast<char>(registers.empty() ? 0 : 1);
+    put_varint(registers.size(), buf);
+
+    for(apns_registers_citr itr = registers.begin(); itr != registers.end(); itr++) {
+      const apns_register_t *ar = *itr;
+
+      if (ar->id.empty() || ar->id.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+      put_varint(strtoull(ar->id.c_str(), NULL, 10), buf);
+
+      if (ar->device_token.length() != kTokenLength * 2) return false;
+      for(size_t i = 0; i < kTokenLength; i++) {
+        int hi = unhex(ar->device_token[i * 2]);
+        int lo = unhex(ar->device_token[i * 2 + 1]);
+        if (hi < 0 || lo < 0) return false;
+        buf += static_cast<char>((hi << 4) | lo);
+      } // for
+
+      buf += static_cast<char>(strcasecmp(ar->environment.c_str(), "prod") ? ENVIRONMENT_SANDBOX : ENVIRONMENT_PROD);
+    } // for
+
+    ret = buf;
+    return true;
+  } // RegisterCodec::encode
+
+  RegisterCodec::decodeEnum RegisterCodec::decode(const std::string &buf, apns_registers_t &ret) {
+    static const char *hex = "0123456789abcdef";
+
+    if (!is_binary(buf) || static_cast<unsigned char>(buf[1]) != kVersion)
+      return DECODE_INVALID;
+
+    bool found = buf[2] & 0x01;
+    size_t pos = 3;
+    unsigned long long num_rows;
+    if (!get_varint(buf, pos, num_rows)) return DECODE_INVALID;
+
+    if (!found) return num_rows ? DECODE_INVALID : DECODE_NOTFOUND;
+    if (!num_rows) return DECODE_INVALID;
+
+    apns_registers_t rows;
+    for(unsigned long long n = 0; n < num_rows; n++) {
+      unsigned long long id;
+      if (!get_varint(buf, pos, id) || buf.length() - pos < kTokenLength + 1) break;
+
+      apns_register_t *ar = new apns_register_t;
+
+      char idbuf[24];
+      snprintf(idbuf, sizeof(idbuf), "%llu", id);
+      ar->id = idbuf;
+
+      ar->device_token.reserve(kTokenLength * 2);
+      for(size_t i = 0; i < kTokenLength; i++) {
+        unsigned char c = buf[pos++];
+        ar->device_token += hex[c >> 4];
+        ar->device_token += hex[c & 0x0f];
+      } // for
+
+      ar->environment = buf[pos++] == ENVIRONMENT_PROD ? "prod" : "sandbox";
+      rows.push_back(ar);
+    } // for
+
+    if (rows.size() != num_rows || pos != buf.length()) {
+      while(!rows.empty()) {
+        delete rows.front();
+        rows.pop_front();
+      } // while
+      return DECODE_INVALID;
+    } // if
+
+    ret.insert(ret.end(), rows.begin(), rows.end());
+    return DECODE_FOUND;
+  } // RegisterCodec::decode
+
+  void RegisterCodec::put_varint(unsigned long long value, std::string &ret) {
+    while(value >= 0x80) {
+      ret += static_cast<char>((value & 0x7f) | 0x80);
+      value >>= 7;
+    } // while
+    ret += static_cast<char>(value);
+  } // RegisterCodec::put_varint
+
+  bool RegisterCodec::get_varint(const std::string &buf, size_t &pos, unsigned long long &ret) {
+    ret = 0;
+    for(unsigned int shift = 0; shift < 64 && pos < buf.length(); shift += 7) {
+      unsigned char c = buf[pos++];
+      ret |= static_cast<unsigned long long>(c & 0x7f) << shift;
+      if (!(c & 0x80)) return true;
+    } // for
+
+    return false;
+  } // RegisterCodec::get_varint
+
+  int RegisterCodec::unhex(const char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  } // RegisterCodec::unhex
+} // namespace apnspusher
@@ -0,0 +1,94 @@
+#include "config.h"
+
+#include <string>
+
+#include <time.h>
+#include <pthread.h>
+
+#include "BloomFilter.h"
+#include "RegisterFilter.h"
+
+namespace apnspusher {
+
+/**************************************************************************
+ ** RegisterFilter Class                                                 **
+ **************************************************************************/
+  const time_t RegisterFilter::kDefaultRefreshInterval		= 300;
+  const double RegisterFilter::kDefaultFalsePositiveRate	= 0.01;
+
+  RegisterFilter::RegisterFilter(const time_t refresh_interval, const double fpp)
+                 : _filter(NULL),
+                   _refresh_interval(refresh_interval),
+                   _next_refresh_at(0),
+                   _fpp(fpp) {
+    pthread_rwlock_init(&_filter_l, NULL);
+    pthread_mutex_init(&_refresh_l, NULL);
+  } // RegisterFilter::RegisterFilter
+
+  RegisterFilter::~RegisterFilter() {
+    if (_filter) delete _filter;
+    pthread_mutex_destroy(&_refresh_l);
+    pthread_rwlock_destroy(&_filter_l);
+  } // RegisterFilter::~RegisterFilter
+
+  bool RegisterFilter::maybe_registered(const std::string &key) {
+    pthread_rwlock_rdlock(&_filter_l);
+    bool ret = _filter == NULL || _filter->contains(key);
+    pthread_rwlock_unlock(&_filter_l);
+    return ret;
+  } // RegisterFilter::maybe_registered
+
+  void RegisterFilter::add(const std::string &key) {
+    pthread_rwlock_wrlock(&_filter_l);
+    if (_filter) _filter->add(key);
+    pthread_rwlock_unlock(&_filter_l);
+  } // RegisterFilter::add
+
+  bool RegisterFilter::claim_refresh() {
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&_refresh_l);
+    bool ret = now >= _next_refresh_at;
+    if (ret) _next_refresh_at = now + _refresh_interval;
+    pthread_mutex_unlock(&_refresh_l);
+
+    return ret;
+  } // RegisterFilter::claim_refresh
+
+  void RegisterFilter::swap(BloomFilter *filter) {
+    pthread_rwlock_wrlock(&_filter_l);
+    BloomFilter *old = _filter;
+    _filter = filter;
+    pthread_rwlock_unlock(&_filter_l);
+
+    if (old) delete old;
+  } // RegisterFilter::swap
+
+  bool RegisterFilter::is_loaded() {
+    pthread_rwlock_rdlock(&_filter_l);
+    bool ret = _filter != NULL;
+    pthread_rwlock_unlock(&_filter_l);
+    return ret;
+  } // RegisterFilter::is_loaded
+
+  size_t RegisterFilter::count() {
+    pthread_rwlock_rdlock(&_filter_l);
+    size_t ret = _filter ? _filter->count() : 0;
+    pthread_rwlock_unlock(&_filter_l);
+    return ret;
+  } // RegisterFilter::count
+
+  size_t RegisterFilter::bytes() {
+    pthread_rwlock_rdlock(&_filter_l);
+    size_t ret = _filter ? _filter->bytes() : 0;
+    pthread_rwlock_unlock(&_filter_l);
+    return ret;
+  } // RegisterFilter::bytes
+
+  double RegisterFilter::fpr() {
+    pthread_rwlock_rdlock(&_filter_l);
+    double ret = _filter ? _filter->fpr() : 0.0;
+    pthread_rwlock_unlock(&_filter_l);
+    return ret;
+  } // RegisterFilter::fpr
+} // namespace apnspusher
@@ -0,0 +1,139 @@
+#include "config.h"
+
+#include <string>
+#include <new>
+#include <cassert>
+
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "RegisterFlight.h"
+
+namespace apnspusher {
+
+/**************************************************************************
+ ** RegisterFlight Class                                                 **
+ **************************************************************************/
+  const int RegisterFlight::kDefaultWait		= 2000;
+
+  RegisterFlight::RegisterFlight(const int wait)
+                 : _wait(wait) {
+    pthread_mutex_init(&_lock, NULL);
+    pthread_cond_init(&_landed, NULL);
+  } // RegisterFlight::RegisterFlight
+
+  RegisterFlight::~RegisterFlight() {
+    for(flights_t::iterator itr = _flights.begin(); itr != _flights.end(); itr++)
+      delete itr->second;
+    pthread_cond_destroy(&_landed);
+    pthread_mutex_destroy(&_lock);
+  } // RegisterFlight::~RegisterFlight
+
+  bool RegisterFlight::lead(const std::string &key, flight_t *&flight) {
+    pthread_mutex_lock(&_lock);
+
+    flights_t::iterator itr = _flights.find(key);
+    if (itr != _flights.end()) {
+      flight = itr->second;
+      ++flight->refs;
+      pthread_mutex_unlock(&_lock);
+      return false;
+    } // if
+
+    try {
+      flight = new flight_t;
+    } // try
+    catch(std::bad_alloc xa) {
+      assert(false);
+    } // catch
+    flight->landed = false;
+    flight->abandoned = false;
+    flight->stale = false;
+    flight->refs = 1;
+    _flights[key] = flight;
+
+    pthread_mutex_unlock(&_lock);
+    return true;
+  } // RegisterFlight::lead
+
+  bool RegisterFlight::land(const std::string &key, const apns_registers_t &registers) {
+    pthread_mutex_lock(&_lock);
+
+    flights_t::iterator itr = _flights.find(key);
+    if (itr == _flights.end()) {
+      pthread_mutex_unlock(&_lock);
+      return true;
+    } // if
+
+    // the next miss after this leads a fresh lookup
+    flight_t *flight = itr->second;
+    _flights.erase(itr);
+
+    for(apns_registers_citr ritr = registers.begin(); ritr != registers.end(); ritr++)
+      flight->rows.push_back(*(*ritr));
+    flight->landed = true;
+    bool current = !flight->stale;
+
+    pthread_cond_broadcast(&_landed);
+    release(flight);
+    pthread_mutex_unlock(&_lock);
+    return current;
+  } // RegisterFlight::land
+
+  void RegisterFlight::abandon(const std::string &key) {
+    pthread_mutex_lock(&_lock);
+
+    flights_t::iterator itr = _flights.find(key);
+    if (itr == _flights.end()) {
+      pthread_mutex_unlock(&_lock);
+      return;
+    } // if
+
+    flight_t *flight = itr->second;
+    _flights.erase(itr);
+    flight->abandoned = true;
+
+    pthread_cond_broadcast(&_landed);
+    release(flight);
+    pthread_mutex_unlock(&_lock);
+  } // RegisterFlight::abandon
+
+  void RegisterFlight::invalidate(const std::string &key) {
+    pthread_mutex_lock(&_lock);
+    flights_t::iterator itr = _flights.find(key);
+    if (itr != _flights.end()) itr->second->stale = true;
+    pthread_mutex_unlock(&_lock);
+  } // RegisterFlight::invalidate
+
+  bool RegisterFlight::wait(flight_t *flight, apns_registers_t &ret) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += _wait / 1000;
+    deadline.tv_nsec += (_wait % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      ++deadline.tv_sec;
+      deadline.tv_nsec -= 1000000000L;
+    } // if
+
+    pthread_mutex_lock(&_lock);
+    while(!flight->landed && !flight->abandoned) {
+      if (pthread_cond_timedwait(&_landed, &_lock, &deadline) == ETIMEDOUT) break;
+    } // while
+
+    bool landed = flight->landed;
+    if (landed) {
+      for(std::vector<apns_register_t>::const_iterator itr = flight->rows.begin(); itr != flight->rows.end(); itr++)
+        ret.push_back(new apns_register_t(*itr));
+    } // if
+
+    release(flight);
+    pthread_mutex_unlock(&_lock);
+    return landed;
+  } // RegisterFlight::wait
+
+  // called locked, whoever is last out frees the flight
+  void RegisterFlight::release(flight_t *flight) {
+    if (--flight->refs == 0) delete flight;
+  } // RegisterFlight::release
+} // namespace apnspusher
@@ -0,0 +1,267 @@
+#include "config.h"
+
+#include <string>
+#include <new>
+#include <cassert>
+
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+
+#include <openframe/openframe.h>
+
+#include "RegisterIndex.h"
+
+namespace apnspusher {
+
+/**************************************************************************
+ ** RegisterIndex Class                                                  **
+ **************************************************************************/
+  const time_t RegisterIndex::kDefaultSyncInterval	= 10;
+  const time_t RegisterIndex::kDefaultReloadInterval	= 3600;
+  const size_t RegisterIndex::kMaxReaders		= 64;
+
+  RegisterIndex::RegisterIndex(const time_t sync_interval,
+                               const time_t reload_interval)
+                : _snapshot(NULL),
+                  _epoch(1),
+                  _num_readers(0),
+                  _sync_interval(sync_interval),
+                  _reload_interval(reload_interval),
+                  _next_sync_at(0),
+                  _next_reload_at(0),
+                  _syncing(false) {
+
+    try {
+      _readers = new reader_t[kMaxReaders];
+    } // try
+    catch(std::bad_alloc xa) {
+      assert(false);
+    } // catch
+    memset(_readers, '\0', sizeof(reader_t) * kMaxReaders);
+
+    pthread_mutex_init(&_sync_l, NULL);
+  } // RegisterIndex::RegisterIndex
+
+  RegisterIndex::~RegisterIndex() {
+    if (_snapshot) delete _snapshot;
+    delete [] _readers;
+    pthread_mutex_destroy(&_sync_l);
+  } // RegisterIndex::~RegisterIndex
+
+  // FNV-1a
+  uint32_t RegisterIndex::hash(const std::string &key) {
+    uint32_t hash = 2166136261U;
+    for(size_t i = 0; i < key.length(); i++) {
+      hash ^= static_cast<unsigned char>(key[i]);
+      hash *= 16777619U;
+    } // for
+    return hash;
+  } // RegisterIndex::hash
+
+  const RegisterIndex::entry_t *RegisterIndex::find(const snapshot_t *s, const std::string &key) {
+    size_t mask = s->buckets.size() - 1;
+    for(size_t i = hash(key) & mask; s->buckets[i]; i = (i + 1) & mask) {
+      const entry_t &e = s->entries[s->buckets[i] - 1];
+      if (e.key == key) return &e;
+    } // for
+    return NULL;
+  } // RegisterIndex::find
+
+  int RegisterIndex::attach() {
+    unsigned int reader = __atomic_fetch_add(&_num_readers, 1, __ATOMIC_SEQ_CST);
+    return reader < kMaxReaders ? static_cast<int>(reader) : -1;
+  } // RegisterIndex::attach
+
+  RegisterIndex::snapshot_t *RegisterIndex::acquire(const int reader) {
+    // announce the epoch before looking at the snapshot, a writer that
+    // swaps after this waits for us before freeing what we load
+    uint64_t epoch = __atomic_load_n(&_epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&_readers[reader].epoch, epoch, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&_snapshot, __ATOMIC_SEQ_CST);
+  } // RegisterIndex::acquire
+
+  void RegisterIndex::release(const int reader) {
+    __atomic_store_n(&_readers[reader].epoch, 0, __ATOMIC_RELEASE);
+  } // RegisterIndex::release
+
+  RegisterIndex::lookupEnum RegisterIndex::get(const int reader, const std::string &key, apns_registers_t &ret) {
+    if (reader < 0) return REGISTER_INDEX_UNLOADED;
+
+    const snapshot_t *s = acquire(reader);
+    if (s == NULL) {
+      release(reader);
+      return REGISTER_INDEX_UNLOADED;
+    } // if
+
+    const entry_t *e = find(s, key);
+    if (e) {
+      for(uint32_t i = e->first; i < e->first + e->num_rows; i++)
+        ret.push_back(new apns_register_t(s->rows[i]));
+    } // if
+
+    release(reader);
+    return e ? REGISTER_INDEX_FOUND : REGISTER_INDEX_NOTFOUND;
+  } // RegisterIndex::get
+
+  // called with the sync claimed, nobody else frees the snapshot under us
+  RegisterIndex::snapshot_t *RegisterIndex::build(const snapshot_t *base,
+                                                  const registers_t &registers,
+                                                  const uint64_t last_id) {
+    snapshot_t *s;
+    try {
+      s = new snapshot_t;
+    } // try
+    catch(std::bad_alloc xa) {
+      assert(false);
+    } // catch
+
+    s->last_id = last_id;
+    s->bytes = 0;
+
+    if (base) {
+      if (base->last_id > s->last_id) s->last_id = base->last_id;
+
+      for(std::vector<entry_t>::const_iterator itr = base->entries.begin(); itr != base->entries.end(); itr++) {
+        if (registers.find(itr->key) != registers.end()) continue;
+
+        entry_t e = { itr->key, static_cast<uint32_t>(s->rows.size()), itr->num_rows };
+        s->entries.push_back(e);
+        s->rows.insert(s->rows.end(), base->rows.begin() + itr->first, base->rows.begin() + itr->first + itr->num_rows);
+      } // for
+    } // if
+
+    for(registers_t::const_iterator itr = registers.begin(); itr != registers.end(); itr++) {
+      if (itr->second.empty()) continue;
+
+      entry_t e = { itr->first, static_cast<uint32_t>(s->rows.size()), static_cast<uint32_t>(itr->second.size()) };
+      s->entries.push_back(e);
+      s->rows.insert(s->rows.end(), itr->second.begin(), itr->second.end());
+    } // for
+
+    // open addressing at most half full keeps probes short
+    size_t num_buckets = 16;
+    while(num_buckets < s->entries.size() * 2) num_buckets <<= 1;
+    s->buckets.assign(num_buckets, 0);
+
+    size_t mask = num_buckets - 1;
+    for(size_t i = 0; i < s->entries.size(); i++) {
+      size_t b = hash(s->entries[i].key) & mask;
+      while(s->buckets[b]) b = (b + 1) & mask;
+      s->buckets[b] = i + 1;
+      s->bytes += sizeof(entry_t) + s->entries[i].key.capacity();
+    } // for
+
+    s->bytes += num_buckets * sizeof(uint32_t);
+    for(std::vector<apns_register_t>::const_iterator itr = s->rows.begin(); itr != s->rows.end(); itr++)
+      s->bytes += sizeof(apns_register_t) + itr->id.capacity() + itr->device_token.capacity() + itr->environment.capacity();
+
+    return s;
+  } // RegisterIndex::build
+
+  void RegisterIndex::swap(snapshot_t *snapshot) {
+    pthread_mutex_lock(&_sync_l);
+    snapshot_t *old = __atomic_exchange_n(&_snapshot, snapshot, __ATOMIC_SEQ_CST);
+    uint64_t epoch = __atomic_add_fetch(&_epoch, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&_sync_l);
+
+    if (old == NULL) return;
+
+    // readers that entered before the swap may still hold the old one,
+    // anyone announcing this epoch or later sees the new
+    unsigned int num_readers = __atomic_load_n(&_num_readers, __ATOMIC_SEQ_CST);
+    if (num_readers > kMaxReaders) num_readers = kMaxReaders;
+    for(unsigned int i = 0; i < num_readers; i++) {
+      for(;;) {
+        uint64_t e = __atomic_load_n(&_readers[i].epoch, __ATOMIC_SEQ_CST);
+        if (e == 0 || e >= epoch) break;
+        sched_yield();
+      } // for
+    } // for
+
+    delete old;
+  } // RegisterIndex::swap
+
+  RegisterIndex::syncEnum RegisterIndex::claim_sync() {
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&_sync_l);
+    syncEnum ret = SYNC_NONE;
+    if (!_syncing && now >= _next_sync_at) {
+      _syncing = true;
+      ret = (_snapshot == NULL || now >= _next_reload_at) ? SYNC_FULL : SYNC_DELTA;
+    } // if
+    pthread_mutex_unlock(&_sync_l);
+
+    return ret;
+  } // RegisterIndex::claim_sync
+
+  void RegisterIndex::publish(const syncEnum sync, const registers_t &registers, const uint64_t last_id) {
+    // only the claimer replaces snapshots, reading ours needs no slot
+    snapshot_t *base = __atomic_load_n(&_snapshot, __ATOMIC_SEQ_CST);
+    swap( build(sync == SYNC_FULL ? NULL : base, registers, last_id) );
+
+    time_t now = time(NULL);
+    pthread_mutex_lock(&_sync_l);
+    _syncing = false;
+    _next_sync_at = now + _sync_interval;
+    if (sync == SYNC_FULL) _next_reload_at = now + _reload_interval;
+    pthread_mutex_unlock(&_sync_l);
+  } // RegisterIndex::publish
+
+  void RegisterIndex::abandon() {
+    time_t now = time(NULL);
+    pthread_mutex_lock(&_sync_l);
+    _syncing = false;
+    _next_sync_at = now + _sync_interval;
+    pthread_mutex_unlock(&_sync_l);
+  } // RegisterIndex::abandon
+
+  uint64_t RegisterIndex::last_id() {
+    pthread_mutex_lock(&_sync_l);
+    uint64_t ret = _snapshot ? _snapshot->last_id : 0;
+    pthread_mutex_unlock(&_sync_l);
+    return ret;
+  } // RegisterIndex::last_id
+
+  void RegisterIndex::touch(const std::string &key) {
+    pthread_mutex_lock(&_sync_l);
+    _touched.insert(key);
+    pthread_mutex_unlock(&_sync_l);
+  } // RegisterIndex::touch
+
+  void RegisterIndex::touched(std::vector<std::string> &ret) {
+    pthread_mutex_lock(&_sync_l);
+    ret.insert(ret.end(), _touched.begin(), _touched.end());
+    _touched.clear();
+    pthread_mutex_unlock(&_sync_l);
+  } // RegisterIndex::touched
+
+  bool RegisterIndex::is_loaded() {
+    pthread_mutex_lock(&_sync_l);
+    bool ret = _snapshot != NULL;
+    pthread_mutex_unlock(&_sync_l);
+    return ret;
+  } // RegisterIndex::is_loaded
+
+  size_t RegisterIndex::count() {
+    pthread_mutex_lock(&_sync_l);
+    size_t ret = _snapshot ? _snapshot->entries.size() : 0;
+    pthread_mutex_unlock(&_sync_l);
+    return ret;
+  } // RegisterIndex::count
+
+  size_t RegisterIndex::rows() {
+    pthread_mutex_lock(&_sync_l);
+    size_t ret = _snapshot ? _snapshot->rows.size() : 0;
+    pthread_mutex_unlock(&_sync_l);
+    return ret;
+  } // RegisterIndex::rows
+
+  size_t RegisterIndex::bytes() {
+    pthread_mutex_lock(&_sync_l);
+    size_t ret = _snapshot ? _snapshot->bytes : 0;
+    pthread_mutex_unlock(&_sync_l);
+    return ret;
+  } // RegisterIndex::bytes
+} // namespace apnspusher
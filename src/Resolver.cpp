@@ -0,0 +1,229 @@
+#include "config.h"
+
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <openframe/openframe.h>
+
+#include <App.h>
+#include <Pipeline.h>
+#include <Resolver.h>
+#include <Store.h>
+
+namespace apnspusher {
+  using namespace openframe::loglevel;
+
+  const time_t Resolver::kDefaultStatsInterval		= 3600;
+  const time_t Resolver::kDefaultMemcachedExpire	= 3600;
+  const int Resolver::kDefaultIdleTimeout		= 2000;
+  const size_t Resolver::kDefaultBatchSize		= 64;
+
+  Resolver::Resolver(const thread_id_t thread_id,
+                     const std::string &memcached_host,
+                     const std::string &db_host,
+                     const std::string &db_user,
+                     const std::string &db_pass,
+                     const std::string &db_database)
+           : openframe::LogObject(thread_id),
+             _memcached_host(memcached_host),
+             _db_host(db_host),
+             _db_user(db_user),
+             _db_pass(db_pass),
+             _db_database(db_database) {
+
+    _store = NULL;
+    _lookup_q = NULL;
+    _push_q = NULL;
+    _memcached_binary = false;
+    _register_expire = Store::kDefaultRegisterExpire;
+    _batch_size = kDefaultBatchSize;
+
+    init_stats(_stats, true);
+    init_stats(_stompstats, true);
+    _stats.report_interval = 60;
+    _stompstats.report_interval = 5;
+  } // Resolver::Resolver
+
+  Resolver::~Resolver() {
+    onDestroyStats();
+
+    if (_store) delete _store;
+  } // Resolver::~Resolver
+
+  void Resolver::init() {
+    try {
+      _store = new Store(thread_id(),
+                         _db_host,
+                         _db_user,
+                         _db_pass,
+                         _db_database,
+                         _memcached_host,
+                         kDefaultMemcachedExpire,
+                         kDefaultStatsInterval);
+      _store->replace_stats( stats(), "");
+      _store->set_elogger( elogger(), elog_name() );
+      _store->set_cache( app->register_cache() );
+      _store->set_filter( app->register_filter() );
+      _store->set_flight( app->register_flight() );
+      _store->set_index( app->register_index() );
+      _store->set_memcached_binary(_memcached_binary);
+      _store->set_register_expire(_register_expire);
+      _store->init();
+    } // try
+    catch(std::bad_alloc xa) {
+      assert(false);
+    } // catch
+
+    _profile.add("resolver.lookup", 300);
+  } // Resolver::init
+
+  void Resolver::init_stats(obj_stats_t &stats, const bool startup) {
+    stats.messages = 0;
+    stats.batches = 0;
+    stats.found = 0;
+    stats.not_found = 0;
+
+    stats.last_report_at = time(NULL);
+    if (startup) stats.created_at = time(NULL);
+  } // Resolver::init_stats
+
+  void Resolver::onDescribeStats() {
+    describe_stat("num.messages", "resolver"+thread_id_str()+"/num messages", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("num.batches", "resolver"+thread_id_str()+"/num batches", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("num.found", "resolver"+thread_id_str()+"/num found", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("num.notfound", "resolver"+thread_id_str()+"/num not found", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("queue.lookup", "resolver"+thread_id_str()+"/lookup queue", openstats::graphTypeGauge, openstats::dataTypeInt);
+    describe_stat("queue.push", "resolver"+thread_id_str()+"/push queue", openstats::graphTypeGauge, openstats::dataTypeInt);
+  } // Resolver::onDescribeStats
+
+  void Resolver::onDestroyStats() {
+    destroy_stat("num.*");
+    destroy_stat("queue.*");
+  } // Resolver::onDestroyStats
+
+  void Resolver::try_stats() {
+    try_stompstats();
+
+    if (_stats.last_report_at > time(NULL) - _stats.report_interval) return;
+
+    int diff = time(NULL) - _stats.last_report_at;
+    double mps = double(_stats.messages) / diff;
+    double mpb = _stats.batches ? double(_stats.messages) / _stats.batches : 0.0;
+
+    TLOG(LogNotice, << "Stats messages " << _stats.messages
+                    << ", mps " << mps << "/s"
+                    << ", batches " << _stats.batches
+                    << ", messages/batch " << mpb
+                    << ", found " << _stats.found
+                    << ", not found " << _stats.not_found
+                    << ", lookup queue " << _lookup_q->size()
+                    << "/" << _lookup_q->capacity()
+                    << ", push queue " << _push_q->size()
+                    << "/" << _push_q->capacity()
+                    << ", average "
+                    << std::fixed << std::setprecision(4)
+                    << _profile.average("resolver.lookup")
+                    << "s"
+                    << std::endl);
+
+    init_stats(_stats);
+  } // Resolver::try_stats
+
+  void Resolver::try_stompstats() {
+    if (_stompstats.last_report_at > time(NULL) - _stompstats.report_interval) return;
+
+    datapoint("num.messages", _stompstats.messages);
+    datapoint("num.batches", _stompstats.batches);
+    datapoint("num.found", _stompstats.found);
+    datapoint("num.notfound", _stompstats.not_found);
+    datapoint("queue.lookup", _lookup_q->size());
+    datapoint("queue.push", _push_q->size());
+
+    init_stats(_stompstats);
+  } // Resolver::try_stompstats
+
+  bool Resolver::run() {
+    try_stats();
+    _store->try_stats();
+
+    // take whatever has piled up, a burst costs one lookup round
+    // rather than one per message
+    std::vector<notify_message_t> messages;
+    messages.reserve(_batch_size);
+    if ( !_lookup_q->dequeue(messages, _batch_size, kDefaultIdleTimeout) ) return false;
+
+    _stats.messages += messages.size();
+    _stompstats.messages += messages.size();
+    ++_stats.batches;
+    ++_stompstats.batches;
+    resolve(messages);
+    return true;
+  } // Resolver::run
+
+  bool Resolver::resolve(std::vector<notify_message_t> &messages) {
+    openframe::Stopwatch sw;
+    sw.Start();
+
+    std::vector<std::string> targets;
+    targets.reserve(messages.size());
+    for(std::vector<notify_message_t>::iterator itr = messages.begin(); itr != messages.end(); itr++) {
+      TLOG(LogDebug, << "searching for target "
+                     << itr->target
+                     << std::endl);
+      targets.push_back(itr->target);
+    } // for
+
+    // search for users in apns register
+    apns_register_map_t registers;
+    _store->getApnsRegistersByCallsigns(targets, registers);
+    _profile.average("resolver.lookup", sw.Time());
+
+    // every job owns its registers, copy them out per message
+    bool ok = true;
+    for(std::vector<notify_message_t>::iterator itr = messages.begin(); ok && itr != messages.end(); itr++) {
+      apns_registers_t &found = registers[ openframe::StringTool::toUpper(itr->target) ];
+      if (found.empty()) {
+        ++_stats.not_found;
+        ++_stompstats.not_found;
+        continue;
+      } // if
+
+      ++_stats.found;
+      ++_stompstats.found;
+
+      push_job_t job;
+      job.message = *itr;
+      for(apns_registers_citr ritr = found.begin(); ritr != found.end(); ritr++)
+        job.registers.push_back( new apns_register_t(**ritr) );
+
+      ok = push(job);
+    } // for
+
+    for(apns_register_map_itr itr = registers.begin(); itr != registers.end(); itr++) {
+      while( !itr->second.empty() ) {
+        delete itr->second.front();
+        itr->second.pop_front();
+      } // while
+    } // for
+
+    return ok;
+  } // Resolver::resolve
+
+  bool Resolver::push(push_job_t &job) {
+    // a stalled push stage backs up into the lookup queue and from
+    // there into stomp rather than growing without bound
+    while( !_push_q->enqueue(job, kDefaultIdleTimeout) ) {
+      if ( app->is_abandoned() ) {
+        while( !job.registers.empty() ) {
+          delete job.registers.front();
+          job.registers.pop_front();
+        } // while
+        return false;
+      } // if
+    } // while
+
+    return true;
+  } // Resolver::push
+} // namespace apnspusher
@@ -32,14 +32,21 @@
 #include <sstream>
 
 #include <errno.h>
+#include <stdlib.h>
 #include <time.h>
 #include <math.h>
 
 #include <openframe/openframe.h>
 #include <openstats/StatsClient_Interface.h>
 
+#include "BloomFilter.h"
 #include "DBI.h"
 #include "MemcachedController.h"
+#include "RegisterCache.h"
+#include "RegisterCodec.h"
+#include "RegisterFilter.h"
+#include "RegisterFlight.h"
+#include "RegisterIndex.h"
 #include "Store.h"
 
 namespace apnspusher {
@@ -49,6 +56,7 @@ namespace apnspusher {
  ** Store Class                                                         **
  **************************************************************************/
   const time_t Store::kDefaultReportInterval			= 3600;
+  const time_t Store::kDefaultRegisterExpire			= 3600;
 
   Store::Store(const thread_id_t thread_id,
                const std::string &host,
@@ -72,9 +80,18 @@ namespace apnspusher {
     _stompstats.report_interval = 5;
 
     _last_cache_fail_at = 0;
+    _memcached_binary = false;
+    _register_expire = kDefaultRegisterExpire;
+    _seed = time(NULL) ^ (thread_id << 16);
 
     _dbi = NULL;
     _memcached = NULL;
+    _cache = NULL;
+    _filter = NULL;
+    _flight = NULL;
+    _index = NULL;
+    _index_reader = -1;
+    _index_attached = false;
     _profile = NULL;
   } // Store::Store
 
@@ -101,12 +118,18 @@ namespace apnspusher {
     _profile->add("memcached.message", 300);
     _profile->add("memcached.register", 300);
 
+    try_filter();
+
     return *this;
   } // Store::init
 
   void Store::init_stats(obj_stats_t &stats, const bool startup) {
+    memset(&stats.filter, 0, sizeof(filter_stats_t) );
+    memset(&stats.flight, 0, sizeof(flight_stats_t) );
     memset(&stats.cache_message, 0, sizeof(memcache_stats_t) );
     memset(&stats.cache_register, 0, sizeof(memcache_stats_t) );
+    memset(&stats.cache_local, 0, sizeof(memcache_stats_t) );
+    memset(&stats.index_register, 0, sizeof(memcache_stats_t) );
 
     memset(&stats.sql_register, 0, sizeof(sql_stats_t) );
 
@@ -127,6 +150,28 @@ namespace apnspusher {
     describe_root_stat("store.num.cache.register.stored", "store/cache/register/num stored - register", openstats::graphTypeCounter, openstats::dataTypeInt);
     describe_root_stat("store.num.cache.register.hitrate", "store/cache/register/num hitrate - register", openstats::graphTypeGauge, openstats::dataTypeFloat);
 
+    describe_root_stat("store.num.cache.local.hits", "store/cache/local/num hits - local", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_root_stat("store.num.cache.local.misses", "store/cache/local/num misses - local", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_root_stat("store.num.cache.local.tries", "store/cache/local/num tries - local", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_root_stat("store.num.cache.local.stored", "store/cache/local/num stored - local", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_root_stat("store.num.cache.local.hitrate", "store/cache/local/num hitrate - local", openstats::graphTypeGauge, openstats::dataTypeFloat);
+
+    describe_root_stat("store.num.index.hits", "store/index/num hits", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_root_stat("store.num.index.misses", "store/index/num misses", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_root_stat("store.num.index.tries", "store/index/num tries", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_root_stat("store.index.callsigns", "store/index/callsigns", openstats::graphTypeGauge, openstats::dataTypeInt);
+    describe_root_stat("store.index.bytes", "store/index/bytes", openstats::graphTypeGauge, openstats::dataTypeInt);
+
+    describe_root_stat("store.num.filter.tries", "store/filter/num tries", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_root_stat("store.num.filter.rejects", "store/filter/num rejects", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_root_stat("store.num.filter.falsepositives", "store/filter/num false positives", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_root_stat("store.filter.fpr", "store/filter/estimated false positive rate", openstats::graphTypeGauge, openstats::dataTypeFloat);
+    describe_root_stat("store.filter.bytes", "store/filter/bytes", openstats::graphTypeGauge, openstats::dataTypeInt);
+
+    describe_root_stat("store.num.flight.led", "store/flight/num led", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_root_stat("store.num.flight.coalesced", "store/flight/num coalesced", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_root_stat("store.num.flight.timeouts", "store/flight/num timeouts", openstats::graphTypeCounter, openstats::dataTypeInt);
+
     describe_root_stat("store.num.sql.register.hits", "store/sql/register/num hits - register", openstats::graphTypeCounter, openstats::dataTypeInt);
     describe_root_stat("store.num.sql.register.misses", "store/sql/register/num misses - register", openstats::graphTypeCounter, openstats::dataTypeInt);
     describe_root_stat("store.num.sql.register.tries", "store/sql/register/num tries - register", openstats::graphTypeCounter, openstats::dataTypeInt);
@@ -137,10 +182,14 @@ namespace apnspusher {
 
   void Store::onDestroyStats() {
     destroy_stat("store.num.*");
+    destroy_stat("store.index.*");
+    destroy_stat("store.filter.*");
   } // Store::onDestroyStats
 
   void Store::try_stats() {
     try_stompstats();
+    try_filter();
+    try_index();
 
     if (_stats.last_report_at > time(NULL) - _stats.report_interval) return;
 
@@ -174,11 +223,69 @@ namespace apnspusher {
                     << "s"
                     << std::endl);
 
+    TLOG(LogNotice, << "Local{register} hits "
+                    << _stats.cache_local.hits
+                    << ", misses "
+                    << _stats.cache_local.misses
+                    << ", tries "
+                    << _stats.cache_local.tries
+                    << ", rate %"
+                    << std::fixed << std::setprecision(2)
+                    << OPENSTATS_PERCENT(_stats.cache_local.hits, _stats.cache_local.tries)
+                    << std::endl);
+
+    if (_index) {
+      TLOG(LogNotice, << "Index{register} hits "
+                      << _stats.index_register.hits
+                      << ", misses "
+                      << _stats.index_register.misses
+                      << ", tries "
+                      << _stats.index_register.tries
+                      << ", callsigns "
+                      << _index->count()
+                      << ", rows "
+                      << _index->rows()
+                      << ", bytes "
+                      << _index->bytes()
+                      << std::endl);
+    } // if
+
+    if (_filter) {
+      TLOG(LogNotice, << "Filter{register} tries "
+                      << _stats.filter.tries
+                      << ", rejects "
+                      << _stats.filter.rejects
+                      << ", false positives "
+                      << _stats.filter.false_positives
+                      << ", rate %"
+                      << std::fixed << std::setprecision(2)
+                      << OPENSTATS_PERCENT(_stats.filter.rejects, _stats.filter.tries)
+                      << ", callsigns "
+                      << _filter->count()
+                      << ", bytes "
+                      << _filter->bytes()
+                      << ", fpr "
+                      << std::fixed << std::setprecision(4)
+                      << _filter->fpr()
+                      << std::endl);
+    } // if
+
+    if (_flight) {
+      TLOG(LogNotice, << "Flight{register} led "
+                      << _stats.flight.led
+                      << ", coalesced "
+                      << _stats.flight.coalesced
+                      << ", timeouts "
+                      << _stats.flight.timeouts
+                      << std::endl);
+    } // if
 
     TLOG(LogNotice, << "Sql{register} hits "
                     << _stats.sql_register.hits
                     << ", misses "
                     << _stats.sql_register.misses
+                    << ", failed "
+                    << _stats.sql_register.failed
                     << ", tries "
                     << _stats.sql_register.tries
                     << ", rate %"
@@ -202,6 +309,28 @@ namespace apnspusher {
     datapoint("store.num.sql.register.inserted", _stompstats.sql_register.inserted);
     datapoint("store.num.sql.register.failed", _stompstats.sql_register.failed);
 
+    if (_index) {
+      datapoint("store.num.index.tries", _stompstats.index_register.tries);
+      datapoint("store.num.index.hits", _stompstats.index_register.hits);
+      datapoint("store.num.index.misses", _stompstats.index_register.misses);
+      datapoint("store.index.callsigns", _index->count() );
+      datapoint("store.index.bytes", _index->bytes() );
+    } // if
+
+    if (_filter) {
+      datapoint("store.num.filter.tries", _stompstats.filter.tries);
+      datapoint("store.num.filter.rejects", _stompstats.filter.rejects);
+      datapoint("store.num.filter.falsepositives", _stompstats.filter.false_positives);
+      datapoint_float("store.filter.fpr", _filter->fpr() );
+      datapoint("store.filter.bytes", _filter->bytes() );
+    } // if
+
+    if (_flight) {
+      datapoint("store.num.flight.led", _stompstats.flight.led);
+      datapoint("store.num.flight.coalesced", _stompstats.flight.coalesced);
+      datapoint("store.num.flight.timeouts", _stompstats.flight.timeouts);
+    } // if
+
     datapoint("store.num.cache.message.tries", _stompstats.cache_message.tries);
     datapoint("store.num.cache.message.misses", _stompstats.cache_message.misses);
     datapoint("store.num.cache.message.hits", _stompstats.cache_message.hits);
@@ -214,9 +343,203 @@ namespace apnspusher {
     datapoint_float("store.num.cache.register.hitrate", OPENSTATS_PERCENT(_stompstats.cache_register.hits, _stompstats.cache_register.tries) );
     datapoint("store.num.cache.register.stored", _stompstats.cache_register.stored);
 
+    datapoint("store.num.cache.local.tries", _stompstats.cache_local.tries);
+    datapoint("store.num.cache.local.misses", _stompstats.cache_local.misses);
+    datapoint("store.num.cache.local.hits", _stompstats.cache_local.hits);
+    datapoint_float("store.num.cache.local.hitrate", OPENSTATS_PERCENT(_stompstats.cache_local.hits, _stompstats.cache_local.tries) );
+    datapoint("store.num.cache.local.stored", _stompstats.cache_local.stored);
+
     init_stats(_stompstats);
   } // Store::try_stompstats()
 
+  void Store::try_filter() {
+    if (_filter == NULL || !_filter->claim_refresh()) return;
+    loadApnsRegisterFilter();
+  } // Store::try_filter
+
+  void Store::try_index() {
+    if (_index == NULL) return;
+
+    switch( _index->claim_sync() ) {
+      case RegisterIndex::SYNC_FULL:
+        loadApnsRegisterIndex();
+        break;
+      case RegisterIndex::SYNC_DELTA:
+        syncApnsRegisterIndex();
+        break;
+      default:
+        break;
+    } // switch
+  } // Store::try_index
+
+  bool Store::loadApnsRegisterIndex() {
+    openframe::Stopwatch sw;
+    sw.Start();
+
+    openframe::DBI::resultType res;
+    openframe::DBI::resultSizeType num_rows = _dbi->getApnsRegisterIndex(res);
+    // could just as well be a failed query, keep what we have
+    if (!num_rows) {
+      TLOG(LogWarn, << "no registrations returned, keeping current register index"
+                    << std::endl);
+      _index->abandon();
+      return false;
+    } // if
+
+    RegisterIndex::registers_t registers;
+    uint64_t last_id = 0;
+    for(openframe::DBI::resultSizeType i = 0; i < num_rows; i++) {
+      std::string callsign;
+      res[i]["callsign"].to_string(callsign);
+
+      apns_register_t ar;
+      res[i]["id"].to_string(ar.id);
+      res[i]["device_token"].to_string(ar.device_token);
+      res[i]["environment"].to_string(ar.environment);
+      registers[ openframe::StringTool::toUpper(callsign) ].push_back(ar);
+
+      uint64_t id = strtoull(ar.id.c_str(), NULL, 10);
+      if (id > last_id) last_id = id;
+    } // for
+
+    _index->publish(RegisterIndex::SYNC_FULL, registers, last_id);
+
+    TLOG(LogNotice, << "loaded register index with "
+                    << _index->count()
+                    << " callsigns, "
+                    << _index->rows()
+                    << " rows, "
+                    << _index->bytes()
+                    << " bytes in "
+                    << sw.Time()
+                    << "s"
+                    << std::endl);
+    return true;
+  } // Store::loadApnsRegisterIndex
+
+  // rows added since the last sync show up by id, anything else that
+  // changed a registration is touched by whoever noticed
+  bool Store::syncApnsRegisterIndex() {
+    std::vector<std::string> keys;
+    _index->touched(keys);
+
+    uint64_t last_id = _index->last_id();
+    openframe::DBI::resultType res;
+    bool ok;
+    openframe::DBI::resultSizeType num_rows = _dbi->getApnsRegisterCallsignsSince(openframe::stringify<uint64_t>(last_id), res, &ok);
+    if (!ok) {
+      abandonApnsRegisterIndex(keys);
+      return false;
+    } // if
+
+    for(openframe::DBI::resultSizeType i = 0; i < num_rows; i++) {
+      std::string callsign, id;
+      res[i]["callsign"].to_string(callsign);
+      res[i]["id"].to_string(id);
+      keys.push_back( openframe::StringTool::toUpper(callsign) );
+
+      uint64_t n = strtoull(id.c_str(), NULL, 10);
+      if (n > last_id) last_id = n;
+    } // for
+
+    if (keys.empty()) {
+      _index->abandon();
+      return false;
+    } // if
+
+    // every callsign named is fetched whole, none left means it's gone
+    RegisterIndex::registers_t registers;
+    for(std::vector<std::string>::iterator itr = keys.begin(); itr != keys.end(); itr++)
+      registers[*itr];
+
+    std::vector<std::string> callsigns;
+    for(RegisterIndex::registers_t::iterator itr = registers.begin(); itr != registers.end(); itr++)
+      callsigns.push_back(itr->first);
+
+    openframe::DBI::resultType rows;
+    num_rows = _dbi->getApnsRegistersByCallsigns(callsigns, rows, &ok);
+    // no rows from a failed query isn't every callsign gone, leave the
+    // index and last id alone and try them all again next sync
+    if (!ok) {
+      abandonApnsRegisterIndex(keys);
+      return false;
+    } // if
+
+    for(openframe::DBI::resultSizeType i = 0; i < num_rows; i++) {
+      std::string callsign;
+      rows[i]["callsign"].to_string(callsign);
+      RegisterIndex::registers_t::iterator ritr = registers.find( openframe::StringTool::toUpper(callsign) );
+      if (ritr == registers.end()) continue;
+
+      apns_register_t ar;
+      rows[i]["id"].to_string(ar.id);
+      rows[i]["device_token"].to_string(ar.device_token);
+      rows[i]["environment"].to_string(ar.environment);
+      ritr->second.push_back(ar);
+    } // for
+
+    _index->publish(RegisterIndex::SYNC_DELTA, registers, last_id);
+
+    TLOG(LogInfo, << "synced register index, "
+                  << registers.size()
+                  << " callsigns changed, "
+                  << _index->count()
+                  << " callsigns, last id "
+                  << last_id
+                  << std::endl);
+    return true;
+  } // Store::syncApnsRegisterIndex
+
+  // the sync failed, what it was asked to fetch is touched again so a
+  // later one doesn't miss it
+  void Store::abandonApnsRegisterIndex(const std::vector<std::string> &keys) {
+    for(std::vector<std::string>::const_iterator itr = keys.begin(); itr != keys.end(); itr++)
+      _index->touch(*itr);
+    _index->abandon();
+
+    TLOG(LogWarn, << "register index sync failed, retrying "
+                  << keys.size()
+                  << " callsigns next sync"
+                  << std::endl);
+  } // Store::abandonApnsRegisterIndex
+
+  bool Store::loadApnsRegisterFilter() {
+    openframe::Stopwatch sw;
+    sw.Start();
+
+    openframe::DBI::resultType res;
+    openframe::DBI::resultSizeType num_rows = _dbi->getApnsRegisterCallsigns(res);
+    // could just as well be a failed query, keep what we have
+    if (!num_rows) {
+      TLOG(LogWarn, << "no registered callsigns returned, keeping current filter"
+                    << std::endl);
+      return false;
+    } // if
+
+    // leave headroom for callsigns added between refreshes
+    BloomFilter *filter = new BloomFilter(num_rows + num_rows / 4 + 64, _filter->fpp());
+    for(openframe::DBI::resultSizeType i = 0; i < num_rows; i++) {
+      std::string callsign;
+      res[i]["callsign"].to_string(callsign);
+      filter->add( openframe::StringTool::toUpper(callsign) );
+    } // for
+
+    _filter->swap(filter);
+
+    TLOG(LogNotice, << "loaded register filter with "
+                    << num_rows
+                    << " callsigns, "
+                    << _filter->bytes()
+                    << " bytes, fpr "
+                    << std::fixed << std::setprecision(4)
+                    << _filter->fpr()
+                    << " in "
+                    << sw.Time()
+                    << "s"
+                    << std::endl);
+    return true;
+  } // Store::loadApnsRegisterFilter
+
   //
   // Memcache Apns Register
   //
@@ -259,14 +582,71 @@ namespace apnspusher {
     TLOG(LogDebug, << "memcached{register} found key "
                    << key
                    << std::endl);
-    TLOG(LogDebug, << "memcached{register} data: "
-                   << buf
-                   << std::endl);
+    if ( !RegisterCodec::is_binary(buf) )
+      TLOG(LogDebug, << "memcached{register} data: "
+                     << buf
+                     << std::endl);
 
 
     return true;
   } // Store::getApnsRegisterFromMemcached
 
+  size_t Store::getApnsRegistersFromMemcached(const std::vector<std::string> &keys,
+                                              MemcachedController::mgetResultType &ret) {
+    openframe::Stopwatch sw;
+    size_t num = 0;
+
+    if (!isMemcachedOk()) return 0;
+
+    _stats.cache_register.tries += keys.size();
+    _stompstats.cache_register.tries += keys.size();
+
+    sw.Start();
+
+    try {
+      num = _memcached->mget("apnsregister", keys, ret);
+    } // try
+    catch(MemcachedController_Exception e) {
+      TLOG(LogError, << e.message()
+                     << std::endl);
+      _last_cache_fail_at = time(NULL);
+    } // catch
+
+    _profile->average("memcached.register", sw.Time());
+
+    _stats.cache_register.hits += num;
+    _stompstats.cache_register.hits += num;
+    _stats.cache_register.misses += keys.size() - num;
+    _stompstats.cache_register.misses += keys.size() - num;
+
+    TLOG(LogDebug, << "memcached{register} found "
+                   << num
+                   << " of "
+                   << keys.size()
+                   << " keys"
+                   << std::endl);
+
+    return num;
+  } // Store::getApnsRegistersFromMemcached
+
+  bool Store::removeApnsRegisterFromMemcached(const std::string &callsign) {
+    if (!isMemcachedOk()) return false;
+
+    std::string key = openframe::StringTool::toUpper(callsign);
+
+    try {
+      _memcached->remove("apnsregister", key);
+    } // try
+    catch(MemcachedController_Exception e) {
+      TLOG(LogError, << e.message()
+                     << std::endl);
+      _last_cache_fail_at = time(NULL);
+      return false;
+    } // catch
+
+    return true;
+  } // Store::removeApnsRegisterFromMemcached
+
   bool Store::setApnsRegisterInMemcached(const std::string &callsign, const std::string &buf, const time_t expire) {
     bool isOK = true;
 
@@ -362,99 +742,398 @@ namespace apnspusher {
     return _dbi->setApnsPush(id, message);
   } // Store::setApnsPush
 
+  openframe::DBI::simpleResultSizeType Store::setApnsPushes(const std::vector<apns_push_t> &pushes) {
+    return _dbi->setApnsPushes(pushes);
+  } // Store::setApnsPushes
+
+  size_t Store::pruneApnsRegisters(const std::vector<apns_feedback_t> &feedbacks,
+                                   size_t &num_evicted) {
+    num_evicted = 0;
+    if (feedbacks.empty()) return 0;
+
+    std::vector<std::string> tokens;
+    tokens.reserve(feedbacks.size());
+    for(std::vector<apns_feedback_t>::const_iterator itr = feedbacks.begin(); itr != feedbacks.end(); itr++)
+      tokens.push_back(itr->device_token);
+
+    size_t num_recorded = _dbi->setApnsFeedbacks(feedbacks);
+    if (num_recorded != feedbacks.size()) {
+      TLOG(LogWarn, << "Unable to insert APNS feedback records, "
+                    << num_recorded
+                    << " of "
+                    << feedbacks.size()
+                    << " written"
+                    << std::endl);
+    } // if
+
+    // look up who is affected first, once deactivated the rows no
+    // longer match
+    openframe::DBI::resultType res;
+    openframe::DBI::resultSizeType num_rows = _dbi->getApnsRegisterCallsignsByTokens(tokens, res);
+    size_t num_pruned = _dbi->setApnsRegistersInactive(feedbacks);
+
+    // other instances keep their local copy until its ttl runs out
+    for(openframe::DBI::resultSizeType i = 0; i < num_rows; i++) {
+      std::string callsign;
+      res[i]["callsign"].to_string(callsign);
+      std::string key = openframe::StringTool::toUpper(callsign);
+
+      removeApnsRegisterFromMemcached(key);
+      if (_cache) _cache->remove(key);
+      if (_index) _index->touch(key);
+      ++num_evicted;
+
+      TLOG(LogInfo, << "evicted registers for "
+                    << key
+                    << " after APNS feedback"
+                    << std::endl);
+    } // for
+
+    return num_pruned;
+  } // Store::pruneApnsRegisters
+
+  bool Store::getApnsRegisterFromIndex(const std::string &key, apns_registers_t &ret) {
+    if (_index == NULL) return false;
+
+    if (!_index_attached) {
+      _index_reader = _index->attach();
+      _index_attached = true;
+      if (_index_reader < 0)
+        TLOG(LogWarn, << "register index out of reader slots, using memcached"
+                      << std::endl);
+    } // if
+
+    RegisterIndex::lookupEnum lr = _index->get(_index_reader, key, ret);
+    if (lr == RegisterIndex::REGISTER_INDEX_UNLOADED) return false;
+
+    _stats.index_register.tries++;
+    _stompstats.index_register.tries++;
+    if (lr == RegisterIndex::REGISTER_INDEX_FOUND) {
+      _stats.index_register.hits++;
+      _stompstats.index_register.hits++;
+    } // if
+    else {
+      _stats.index_register.misses++;
+      _stompstats.index_register.misses++;
+    } // else
+
+    return true;
+  } // Store::getApnsRegisterFromIndex
+
+  bool Store::getApnsRegisterFromCache(const std::string &key, apns_registers_t &ret) {
+    if (_cache == NULL) return false;
+
+    _stats.cache_local.tries++;
+    _stompstats.cache_local.tries++;
+
+    RegisterCache::lookupEnum lr = _cache->get(key, ret);
+    if (lr == RegisterCache::REGISTER_CACHE_MISS) {
+      _stats.cache_local.misses++;
+      _stompstats.cache_local.misses++;
+      return false;
+    } // if
+
+    _stats.cache_local.hits++;
+    _stompstats.cache_local.hits++;
+    return true;
+  } // Store::getApnsRegisterFromCache
+
+  void Store::setApnsRegisterInCache(const std::string &key, const apns_registers_t &registers) {
+    if (_cache == NULL) return;
+
+    _cache->put(key, registers);
+    _stats.cache_local.stored++;
+    _stompstats.cache_local.stored++;
+  } // Store::setApnsRegisterInCache
+
   apns_registers_st Store::getApnsRegisterByCallsign(const std::string &callsign,
                                                      apns_registers_t &ret) {
-    // First try and find whether we either have an 'found'
-    // or a not 'found' from memcached
-    std::string buf;
-    bool ok = getApnsRegisterFromMemcached(callsign, buf);
-    if (ok) {
-      openframe::Vars v(buf);
-      if ( v.is("fnd") ) {
-        // not found
-        if (v["fnd"] == "0") {
-          TLOG(LogDebug, << "got not found from memcached for "
-                        << callsign
-                        << std::endl);
-          return 0;
-        } // if
-        else if (v["fnd"] == "1" && v.is("bdy") ) {
-          // found valid packet
-          openframe::StringToken st;
-          st.setDelimiter(',');
-          st = v["bdy"];
-          if (st.size() && st.size() % 3 == 0) {
-            for(size_t i = 0; i < st.size(); i += 3) {
-              apns_register_t *ar = new apns_register_t;
-              ar->id = st[i];
-              ar->device_token = st[i+1];
-              ar->environment = st[i+2];
-              ret.push_back(ar);
-            } // for
-
-            TLOG(LogDebug, << "found and parsed "
-                           << ret.size()
-                           << " from memcached for "
-                           << callsign
-                           << std::endl);
-
-            return ret.size();
-          } // if
-          else TLOG(LogInfo, << "got invalid found packet from memcached for "
-                             << callsign
-                             << "; "
-                             << v["bdy"]
-                             << std::endl);
+    std::vector<std::string> callsigns(1, callsign);
+    apns_register_map_t registers;
+    getApnsRegistersByCallsigns(callsigns, registers);
+
+    apns_registers_t &found = registers.begin()->second;
+    ret.insert(ret.end(), found.begin(), found.end());
+    return found.size();
+  } // Store::getApnsRegisterByCallsign
+
+  size_t Store::getApnsRegistersByCallsigns(const std::vector<std::string> &callsigns,
+                                            apns_register_map_t &ret) {
+    std::vector<std::string> pending;
+    std::vector<std::string> passed;		// by the filter
+
+    for(std::vector<std::string>::const_iterator itr = callsigns.begin(); itr != callsigns.end(); itr++) {
+      std::string key = openframe::StringTool::toUpper(*itr);
+      if (ret.find(key) != ret.end()) continue;
+      apns_registers_t &registers = ret[key];
+
+      // once loaded the index settles every callsign, found or not
+      if ( getApnsRegisterFromIndex(key, registers) ) continue;
+
+      // most traffic is addressed to callsigns that never registered,
+      // settle those from memory
+      if (_filter) {
+        _stats.filter.tries++;
+        _stompstats.filter.tries++;
+        if ( !_filter->maybe_registered(key) ) {
+          _stats.filter.rejects++;
+          _stompstats.filter.rejects++;
+          continue;
         } // if
+        passed.push_back(key);
       } // if
+
+      // heavy hitters are answered from the local cache without a
+      // round trip to memcached
+      if ( getApnsRegisterFromCache(key, registers) ) continue;
+
+      pending.push_back(key);
+    } // for
+
+    // then ask memcached for the rest in one pipelined exchange,
+    // either a 'found' or a not 'found' settles the callsign
+    if (!pending.empty()) {
+      MemcachedController::mgetResultType found;
+      getApnsRegistersFromMemcached(pending, found);
+
+      std::vector<std::string> missed;
+      for(std::vector<std::string>::iterator itr = pending.begin(); itr != pending.end(); itr++) {
+        MemcachedController::mgetResultType::iterator fitr = found.find(*itr);
+        apns_registers_t &registers = ret[*itr];
+        bool is_found;
+        if (fitr != found.end() && decodeApnsRegister(*itr, fitr->second, registers, is_found) ) {
+          TLOG(LogDebug, << "got "
+                         << (is_found ? "found" : "not found")
+                         << " with "
+                         << registers.size()
+                         << " rows from memcached for "
+                         << *itr
+                         << std::endl);
+          setApnsRegisterInCache(*itr, registers);
+          continue;
+        } // if
+
+        missed.push_back(*itr);
+      } // for
+      pending.swap(missed);
     } // if
 
-    _stats.sql_register.tries++;
-    _stompstats.sql_register.tries++;
+    // whatever is left goes to SQL as a single query, callsigns
+    // another Store is already querying are waited for instead
+    if (!pending.empty()) {
+      typedef std::vector<std::pair<std::string, RegisterFlight::flight_t *> > joined_t;
+      joined_t joined;
+      std::vector<std::string> led;
+
+      for(std::vector<std::string>::iterator itr = pending.begin(); itr != pending.end(); itr++) {
+        RegisterFlight::flight_t *flight;
+        if (_flight && !_flight->lead(*itr, flight)) {
+          joined.push_back( std::make_pair(*itr, flight) );
+          continue;
+        } // if
+        led.push_back(*itr);
+      } // for
+
+      // land ours before waiting on anyone else's, two Stores each
+      // leading what the other waits for would otherwise stall
+      getApnsRegistersFromSql(led, ret, _flight != NULL);
+
+      std::vector<std::string> stragglers;
+      for(joined_t::iterator itr = joined.begin(); itr != joined.end(); itr++) {
+        if ( _flight->wait(itr->second, ret[itr->first]) ) {
+          _stats.flight.coalesced++;
+          _stompstats.flight.coalesced++;
+          continue;
+        } // if
+
+        _stats.flight.timeouts++;
+        _stompstats.flight.timeouts++;
+        stragglers.push_back(itr->first);
+      } // for
+
+      getApnsRegistersFromSql(stragglers, ret, false);
+    } // if
+
+    // whichever of the local cache, memcached or SQL answered, a
+    // callsign the filter let through with nothing registered was one
+    // it should have ruled out
+    for(std::vector<std::string>::iterator itr = passed.begin(); itr != passed.end(); itr++) {
+      if (!ret[*itr].empty()) continue;
+      _stats.filter.false_positives++;
+      _stompstats.filter.false_positives++;
+    } // for
+
+    size_t num_found = 0;
+    for(apns_register_map_itr itr = ret.begin(); itr != ret.end(); itr++)
+      if (!itr->second.empty()) ++num_found;
+
+    return num_found;
+  } // Store::getApnsRegistersByCallsigns
+
+  void Store::getApnsRegistersFromSql(const std::vector<std::string> &keys,
+                                      apns_register_map_t &ret,
+                                      const bool land) {
+    if (keys.empty()) return;
+
+    if (land) {
+      _stats.flight.led += keys.size();
+      _stompstats.flight.led += keys.size();
+    } // if
+
+    _stats.sql_register.tries += keys.size();
+    _stompstats.sql_register.tries += keys.size();
 
     openframe::DBI::resultType res;
-    ok = _dbi->getApnsRegisterByCallsign(callsign, res);
+    bool ok = false;
+    openframe::DBI::resultSizeType num_rows = _dbi->getApnsRegistersByCallsigns(keys, res, &ok);
+
+    // no rows from a failed query isn't every callsign unregistered,
+    // keep it out of the caches and let whoever waited query for
+    // themselves
     if (!ok) {
-      _stats.sql_register.misses++;
-      _stompstats.sql_register.misses++;
+      _stats.sql_register.failed += keys.size();
+      _stompstats.sql_register.failed += keys.size();
 
-      openframe::Vars v;
-      v.add("fnd", "0");
-      ok = setApnsRegisterInMemcached(callsign, v.compile(), 3600);
-      TLOG(LogDebug, << "setting not found in memcached for "
-                     << callsign
-                     << std::endl);
-      return 0;
+      if (land) {
+        for(std::vector<std::string>::const_iterator itr = keys.begin(); itr != keys.end(); itr++)
+          _flight->abandon(*itr);
+      } // if
+
+      TLOG(LogWarn, << "register lookup failed for "
+                    << keys.size()
+                    << " callsigns, not caching"
+                    << std::endl);
+      return;
     } // if
 
-    _stats.sql_register.hits++;
-    _stompstats.sql_register.hits++;
+    for(openframe::DBI::resultSizeType i = 0; i < num_rows; i++) {
+      std::string callsign;
+      res[i]["callsign"].to_string(callsign);
+      apns_register_map_itr ritr = ret.find( openframe::StringTool::toUpper(callsign) );
+      if (ritr == ret.end()) continue;
 
-    std::stringstream bdy;
-    for(openframe::DBI::resultSizeType i = 0; i < res.num_rows(); i++) {
       apns_register_t *ar = new apns_register_t;
       res[i]["id"].to_string(ar->id);
       res[i]["device_token"].to_string(ar->device_token);
       res[i]["environment"].to_string(ar->environment);
-      ret.push_back(ar);
+      ritr->second.push_back(ar);
+    } // for
+
+    for(std::vector<std::string>::const_iterator itr = keys.begin(); itr != keys.end(); itr++) {
+      apns_registers_t &registers = ret[*itr];
+      if (registers.empty()) {
+        _stats.sql_register.misses++;
+        _stompstats.sql_register.misses++;
+      } // if
+      else {
+        _stats.sql_register.hits++;
+        _stompstats.sql_register.hits++;
+      } // else
+
+      // a change published while we were querying makes these rows
+      // suspect, hand them to this batch and whoever waited but keep
+      // them out of the caches
+      if (land && !_flight->land(*itr, registers)) {
+        TLOG(LogInfo, << "not caching registers for "
+                      << *itr
+                      << ", changed while in flight"
+                      << std::endl);
+        continue;
+      } // if
+
+      ok = setApnsRegisterInMemcached(*itr, encodeApnsRegister(registers), jitter(_register_expire));
+      TLOG(LogDebug, << "setting "
+                     << (registers.empty() ? "not found " : "found ")
+                     << ok
+                     << " in memcached with "
+                     << registers.size()
+                     << " rows for "
+                     << *itr
+                     << std::endl);
+      setApnsRegisterInCache(*itr, registers);
+    } // for
+  } // Store::getApnsRegistersFromSql
+
+  time_t Store::jitter(const time_t ttl) {
+    time_t spread = ttl / 10;
+    if (spread < 1) return ttl;
+    return ttl - rand_r(&_seed) % (spread + 1);
+  } // Store::jitter
+
+  bool Store::decodeApnsRegister(const std::string &callsign, const std::string &buf,
+                                 apns_registers_t &ret, bool &found) {
+    if ( RegisterCodec::is_binary(buf) ) {
+      RegisterCodec::decodeEnum dr = RegisterCodec::decode(buf, ret);
+      if (dr == RegisterCodec::DECODE_INVALID) {
+        TLOG(LogInfo, << "got invalid binary packet from memcached for "
+                      << callsign
+                      << "; "
+                      << buf.length()
+                      << " bytes"
+                      << std::endl);
+        return false;
+      } // if
+
+      found = (dr == RegisterCodec::DECODE_FOUND);
+      return true;
+    } // if
+
+    // legacy format, written by instances without the binary codec
+    openframe::Vars v(buf);
+    if ( !v.is("fnd") ) return false;
+
+    if (v["fnd"] == "0") {
+      found = false;
+      return true;
+    } // if
+
+    if (v["fnd"] != "1" || !v.is("bdy") ) return false;
 
-      bdy << (i ? "," : "") << ar->id << "," << ar->device_token << "," << ar->environment;
+    openframe::StringToken st;
+    st.setDelimiter(',');
+    st = v["bdy"];
+    if (!st.size() || st.size() % 3 != 0) {
+      TLOG(LogInfo, << "got invalid found packet from memcached for "
+                    << callsign
+                    << "; "
+                    << v["bdy"]
+                    << std::endl);
+      return false;
+    } // if
+
+    for(size_t i = 0; i < st.size(); i += 3) {
+      apns_register_t *ar = new apns_register_t;
+      ar->id = st[i];
+      ar->device_token = st[i+1];
+      ar->environment = st[i+2];
+      ret.push_back(ar);
     } // for
 
+    found = true;
+    return true;
+  } // Store::decodeApnsRegister
+
+  std::string Store::encodeApnsRegister(const apns_registers_t &registers) {
+    std::string buf;
+    // rows the binary format can't represent go out as legacy
+    if (_memcached_binary && RegisterCodec::encode(registers, buf) ) return buf;
+
     openframe::Vars v;
+    if (registers.empty()) {
+      v.add("fnd", "0");
+      return v.compile();
+    } // if
+
+    std::stringstream bdy;
+    for(apns_registers_citr itr = registers.begin(); itr != registers.end(); itr++) {
+      bdy << (itr == registers.begin() ? "" : ",")
+          << (*itr)->id << "," << (*itr)->device_token << "," << (*itr)->environment;
+    } // for
+
     v.add("bdy", bdy.str() );
     v.add("fnd", "1");
-    ok = setApnsRegisterInMemcached(callsign, v.compile(), 3600);
-    TLOG(LogDebug, << "setting found "
-                   << ok
-                   << " in memcached with "
-                   << ret.size()
-                   << " rows for "
-                   << callsign
-                   << std::endl);
-
-    return ret.size();
-  } // Store::getApnsRegisterByCallsign
+    return v.compile();
+  } // Store::encodeApnsRegister
 
 /*
   bool Store::getApnsRegisterByCallsign(const std::string &callsign,
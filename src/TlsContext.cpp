@@ -0,0 +1,250 @@
+#include "config.h"
+
+#include <sstream>
+#include <string>
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include <openframe/openframe.h>
+
+#include <TlsContext.h>
+
+namespace apnspusher {
+  using namespace openframe::loglevel;
+
+  const int TlsContext::kConnectTimeout		= 10;
+
+  TlsContext::TlsContext(const std::string &cert,
+                         const std::string &key,
+                         const std::string &capath,
+                         const bool verify) :
+    _cert(cert),
+    _key(key),
+    _capath(capath),
+    _verify(verify),
+    _ktls(false),
+    _ctx(NULL) {
+  } // TlsContext::TlsContext
+
+  TlsContext::~TlsContext() {
+    for(sessions_t::iterator itr = _sessions.begin(); itr != _sessions.end(); itr++)
+      if (itr->second) SSL_SESSION_free(itr->second);
+    if (_ctx) SSL_CTX_free(_ctx);
+  } // TlsContext::~TlsContext
+
+  bool TlsContext::init() {
+    _ctx = SSL_CTX_new(SSLv23_client_method());
+    SSL_CTX_set_options(_ctx, SSL_OP_ALL | SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3
+                              | SSL_OP_NO_COMPRESSION);
+    SSL_CTX_set_mode(_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE
+                           | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    // OpenSSL's own cache is keyed for servers, we look sessions up by
+    // where we connect and hand them over in open()
+    SSL_CTX_set_session_cache_mode(_ctx, SSL_SESS_CACHE_CLIENT
+                                         | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(_ctx, new_session_cb);
+    SSL_CTX_set_app_data(_ctx, this);
+
+    if (_cert.length()
+        && (SSL_CTX_use_certificate_chain_file(_ctx, _cert.c_str()) != 1
+            || SSL_CTX_use_PrivateKey_file(_ctx, _key.c_str(), SSL_FILETYPE_PEM) != 1)) {
+      LOG(LogError, << "TLS unable to load certificate "
+                    << _cert
+                    << "; "
+                    << error()
+                    << std::endl);
+      SSL_CTX_free(_ctx);
+      _ctx = NULL;
+      return false;
+    } // if
+
+    if (_verify) {
+      SSL_CTX_set_verify(_ctx, SSL_VERIFY_PEER, NULL);
+      if (_capath.length())
+        SSL_CTX_load_verify_locations(_ctx, NULL, _capath.c_str());
+      SSL_CTX_set_default_verify_paths(_ctx);
+    } // if
+
+    return true;
+  } // TlsContext::init
+
+  SSL *TlsContext::open(const int sock, const std::string &host, const int port) {
+    std::stringstream s;
+    s << host << ":" << port;
+
+    openframe::scoped_lock slock(&_sessions_l);
+    if (!_ctx && !init()) return NULL;
+
+    SSL *ssl = SSL_new(_ctx);
+    SSL_set_fd(ssl, sock);
+    SSL_set_tlsext_host_name(ssl, host.c_str());
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    if (_verify) SSL_set1_host(ssl, host.c_str());
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+    // only a request, OpenSSL falls back to user space when the kernel
+    // lacks the tls module or the negotiated cipher
+    if (_ktls) SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+#endif
+
+    // entries are never erased, the key outlives every SSL pointing at it
+    sessions_t::iterator itr = _sessions.insert(std::make_pair(s.str(), (SSL_SESSION *) NULL)).first;
+    if (itr->second) SSL_set_session(ssl, itr->second);
+    SSL_set_app_data(ssl, const_cast<std::string *>(&itr->first));
+
+    return ssl;
+  } // TlsContext::open
+
+  SSL *TlsContext::connect(const std::string &host, const int port,
+                           const std::string &alpn, bool *resumed) {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    int ret = getaddrinfo(host.c_str(), service, &hints, &res);
+    if (ret != 0) {
+      LOG(LogWarn, << "TLS unable to resolve "
+                   << host
+                   << "; "
+                   << gai_strerror(ret)
+                   << std::endl);
+      return NULL;
+    } // if
+
+    struct timeval tv;
+    tv.tv_sec = kConnectTimeout;
+    tv.tv_usec = 0;
+
+    int sock = -1;
+    for(struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+      sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (sock < 0) continue;
+      setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+      setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+      if (::connect(sock, ai->ai_addr, ai->ai_addrlen) == 0) break;
+      close(sock);
+      sock = -1;
+    } // for
+    freeaddrinfo(res);
+
+    if (sock < 0) {
+      LOG(LogWarn, << "TLS unable to connect to "
+                   << host
+                   << ":"
+                   << port
+                   << "; "
+                   << strerror(errno)
+                   << std::endl);
+      return NULL;
+    } // if
+
+    // what we write is already coalesced into full records, don't let
+    // Nagle hold back the tail of a burst
+    int on = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    SSL *ssl = open(sock, host, port);
+    if (!ssl) {
+      close(sock);
+      return NULL;
+    } // if
+
+    // the context is shared between protocols so this is set per
+    // connection
+    if (alpn.length()) {
+      SSL_set_options(ssl, SSL_OP_NO_TLSv1 | SSL_OP_NO_TLSv1_1);
+      SSL_set_alpn_protos(ssl, (const unsigned char *) alpn.data(), alpn.length());
+    } // if
+
+    if (SSL_connect(ssl) != 1) {
+      LOG(LogWarn, << "TLS handshake with "
+                   << host
+                   << ":"
+                   << port
+                   << " failed; "
+                   << error()
+                   << std::endl);
+      forget(host, port);
+      SSL_free(ssl);
+      close(sock);
+      return NULL;
+    } // if
+
+    if (resumed) *resumed = SSL_session_reused(ssl);
+    return ssl;
+  } // TlsContext::connect
+
+  std::string TlsContext::error() {
+    char buf[256];
+    unsigned long err = ERR_get_error();
+    if (!err) return "unknown error";
+    ERR_error_string_n(err, buf, sizeof(buf));
+    ERR_clear_error();
+    return buf;
+  } // TlsContext::error
+
+  bool TlsContext::ktls_send(SSL *ssl) {
+#ifdef BIO_get_ktls_send
+    return BIO_get_ktls_send(SSL_get_wbio(ssl));
+#else
+    return false;
+#endif
+  } // TlsContext::ktls_send
+
+  void TlsContext::forget(const std::string &host, const int port) {
+    std::stringstream s;
+    s << host << ":" << port;
+
+    openframe::scoped_lock slock(&_sessions_l);
+    sessions_t::iterator itr = _sessions.find(s.str());
+    if (itr == _sessions.end() || !itr->second) return;
+    SSL_SESSION_free(itr->second);
+    itr->second = NULL;
+  } // TlsContext::forget
+
+  // called once the handshake, or under TLS 1.3 a later ticket, yields a
+  // session worth resuming, keep the newest for its host:port
+  int TlsContext::new_session_cb(SSL *ssl, SSL_SESSION *session) {
+    TlsContext *tls = static_cast<TlsContext *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    const std::string *name = static_cast<const std::string *>(SSL_get_app_data(ssl));
+    if (!tls || !name) return 0;
+
+    // OpenSSL marks the connection's session unresumable when it isn't
+    // shut down cleanly, which is how Apple ends every connection after
+    // an error or GOAWAY, so keep a copy of our own
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    SSL_SESSION *copy = SSL_SESSION_dup(session);
+    if (!copy) return 0;
+#else
+    SSL_SESSION *copy = session;
+#endif
+
+    openframe::scoped_lock slock(&tls->_sessions_l);
+    sessions_t::iterator itr = tls->_sessions.find(*name);
+    if (itr == tls->_sessions.end()) {
+      if (copy != session) SSL_SESSION_free(copy);
+      return 0;
+    } // if
+    if (itr->second) SSL_SESSION_free(itr->second);
+    itr->second = copy;
+
+    // 1 when we kept OpenSSL's reference rather than a copy
+    return copy == session;
+  } // TlsContext::new_session_cb
+} // namespace apnspusher
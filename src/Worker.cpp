@@ -1,58 +1,69 @@
 #include "config.h"
 
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include <openframe/openframe.h>
 #include <stomp/StompHeaders.h>
 #include <stomp/StompFrame.h>
 #include <stomp/Stomp.h>
-#include <apns/apns.h>
 
 #include <App.h>
-#include <APNS.h>
+#include <EventWait.h>
+#include <NotifyParser.h>
+#include <Pipeline.h>
 #include <Worker.h>
-#include <Store.h>
-#include <MemcachedController.h>
 
 namespace apnspusher {
   using namespace openframe::loglevel;
 
   const int Worker::kDefaultStompPrefetch		= 1024;
-  const time_t Worker::kDefaultStatsInterval		= 3600;
-  const time_t Worker::kDefaultMemcachedExpire		= 3600;
+  const size_t Worker::kDefaultBatchSize		= 64;
+  const time_t Worker::kDefaultBatchTimeout		= 250;
+  const int Worker::kDefaultIdleTimeout			= 2000;
+  const int Worker::kDefaultFlowWait			= 100;
+  const time_t Worker::kDefaultFlowDelay		= 2000;
+  const size_t Worker::kDefaultFlowFloor		= 256;
   const char *Worker::kDefaultStompDestNotifyMessages	= "/topic/notify.aprs.messages";
 
   Worker::Worker(const thread_id_t thread_id,
                  const std::string &stomp_hosts,
                  const std::string &stomp_login,
-                 const std::string &stomp_passcode,
-                 const std::string &memcached_host,
-                 const std::string &db_host,
-                 const std::string &db_user,
-                 const std::string &db_pass,
-                 const std::string &db_database)
+                 const std::string &stomp_passcode)
          : openframe::LogObject(thread_id),
            _stomp_hosts(stomp_hosts),
            _stomp_login(stomp_login),
-           _stomp_passcode(stomp_passcode),
-           _memcached_host(memcached_host),
-           _db_host(db_host),
-           _db_user(db_user),
-           _db_pass(db_pass),
-           _db_database(db_database) {
-
-    _store = NULL;
+           _stomp_passcode(stomp_passcode) {
+
     _stomp = NULL;
-    _apns = NULL;
+    _lookup_q = NULL;
     _connected = false;
     _console = false;
     _no_send = false;
 
+    _batch_size = kDefaultBatchSize;
+    _batch_timeout = kDefaultBatchTimeout;
+
+    _prefetch = kDefaultStompPrefetch;
+    _flow_delay = kDefaultFlowDelay;
+    _flow_floor = kDefaultFlowFloor;
+    _flow_workers = 1;
+    _flow = NULL;
+    _throttled = false;
+
+    _wakeup_fd = -1;
+
     _stomp_dest_notify_msgs = kDefaultStompDestNotifyMessages;
+    _ack = ACK_CLIENT;
 
     init_stats(_stats, true);
     init_stompstats(_stompstats, true);
@@ -63,69 +74,56 @@ namespace apnspusher {
   Worker::~Worker() {
     onDestroyStats();
 
-    _apns->stop();
-    if (_apns) delete _apns;
-
-    if (_store) delete _store;
     if (_stomp) delete _stomp;
+    if (_flow) delete _flow;
+
 
   } // Worker:~Worker
 
   void Worker::init() {
     try {
       stomp::StompHeaders *headers = new stomp::StompHeaders("openstomp.prefetch",
-                                                             openframe::stringify<int>(kDefaultStompPrefetch)
+                                                             openframe::stringify<int>(_prefetch)
                                                             );
       headers->add_header("heart-beat", "0,5000");
       _stomp = new stomp::Stomp(_stomp_hosts,
                                 _stomp_login,
                                 _stomp_passcode,
                                 headers);
-
-      _store = new Store(thread_id(),
-                         _db_host,
-                         _db_user,
-                         _db_pass,
-                         _db_database,
-                         _memcached_host,
-                         kDefaultMemcachedExpire,
-                         kDefaultStatsInterval);
-      _store->replace_stats( stats(), "");
-      _store->set_elogger( elogger(), elog_name() );
-      _store->init();
-
-      _apns = new APNS(app->cfg->get_int("app.apns.push", 1),
-                       app->cfg->get_bool("app.apns.feedback.enable", false)
-                      );
-      _apns->elogger( elogger(), elog_name() );
-
-      _apns->set_cert(app->cfg->get_string("app.apns.ssl.cert"),
-                      app->cfg->get_string("app.apns.ssl.key")
-                     );
-
-      _apns->set_push(app->cfg->get_string("app.apns.push.host"),
-                      app->cfg->get_int("app.apns.push.port"),
-                      app->cfg->get_int("app.apns.push.timeout")
-                     );
-
-      _apns->set_feedback(app->cfg->get_string("app.apns.feedback.host"),
-                          app->cfg->get_int("app.apns.feedback.port"),
-                          app->cfg->get_int("app.apns.feedback.interval")
-                         );
-
-      _apns->start();
+      _flow = new FlowControl(_flow_delay, _flow_floor, _prefetch, _flow_workers);
     } // try
     catch(std::bad_alloc xa) {
       assert(false);
     } // catch
+
+    _events.elogger( elogger(), elog_name() );
+    _events.init(_wakeup_fd);
   } // Worker::init
 
+  Worker::ackEnum Worker::str_to_ack(const std::string &name) {
+    if (!strcasecmp(name.c_str(), "auto")) return ACK_AUTO;
+    if (!strcasecmp(name.c_str(), "client-individual")) return ACK_CLIENT_INDIVIDUAL;
+    return ACK_CLIENT;
+  } // Worker::str_to_ack
+
+  const char *Worker::ack_str(const ackEnum ack) {
+    switch(ack) {
+      case ACK_AUTO: return "auto";
+      case ACK_CLIENT_INDIVIDUAL: return "client-individual";
+      default: break;
+    } // switch
+    return "client";
+  } // Worker::ack_str
+
   void Worker::init_stats(obj_stats_t &stats, const bool startup) {
     stats.connects = 0;
     stats.disconnects = 0;
     stats.packets = 0;
     stats.frames_in = 0;
     stats.frames_out = 0;
+    stats.batches = 0;
+    stats.acks = 0;
+    stats.throttled = 0;
 
     stats.last_report_at = time(NULL);
     if (startup) stats.created_at = time(NULL);
@@ -143,6 +141,7 @@ namespace apnspusher {
     describe_stat("num.frames.in", "worker"+thread_id_str()+"/num frames in", openstats::graphTypeCounter, openstats::dataTypeInt);
     describe_stat("num.bytes.out", "worker"+thread_id_str()+"/num bytes out", openstats::graphTypeCounter, openstats::dataTypeInt);
     describe_stat("num.bytes.in", "worker"+thread_id_str()+"/num bytes in", openstats::graphTypeCounter, openstats::dataTypeInt);
+    describe_stat("num.window", "worker"+thread_id_str()+"/flow window", openstats::graphTypeGauge, openstats::dataTypeInt);
   } // Worker::onDescribeStats
 
   void Worker::onDestroyStats() {
@@ -158,6 +157,7 @@ namespace apnspusher {
     double pps = double(_stats.packets) / diff;
     double fps_in = double(_stats.frames_in) / diff;
     double fps_out = double(_stats.frames_out) / diff;
+    double fpb = _stats.batches ? double(_stats.frames_in) / _stats.batches : 0.0;
 
     TLOG(LogNotice, << "Stats packets " << _stats.packets
                     << ", pps " << pps << "/s"
@@ -165,6 +165,14 @@ namespace apnspusher {
                     << ", fps in " << fps_in << "/s"
                     << ", frames out " << _stats.frames_out
                     << ", fps out " << fps_out << "/s"
+                    << ", batches " << _stats.batches
+                    << ", frames/batch " << fpb
+                    << ", acks " << _stats.acks
+                    << ", window " << _flow->window()
+                    << ", backlog " << _flow->backlog()
+                    << " of " << _flow->target()
+                    << ", drain " << _flow->rate() << "/s"
+                    << ", throttled " << _stats.throttled
                     << ", next in " << _stats.report_interval
                     << ", connect attempts " << _stats.connects
                     << "; " << _stomp->connected_to()
@@ -177,187 +185,183 @@ namespace apnspusher {
   void Worker::try_stompstats() {
     if (_stompstats.last_report_at > time(NULL) - _stompstats.report_interval) return;
 
+    datapoint("num.window", _flow->window());
+
     init_stompstats(_stompstats);
   } // Worker::try_stompstats
 
   bool Worker::run() {
     try_stats();
-    _store->try_stats();
 
     /**********************
      ** Check Connection **
      **********************/
     if (!_connected) {
       ++_stats.connects;
-      bool ok = _stomp->subscribe(_stomp_dest_notify_msgs, "1");
-      if (!ok) {
+      stomp::StompHeaders *headers = new stomp::StompHeaders("ack", ack_str(_ack));
+      if (!_stomp->subscribe(_stomp_dest_notify_msgs, "1", headers)) {
         TLOG(LogInfo, << "not connected, retry in 2 seconds; " << _stomp->last_error() << std::endl);
         return false;
       } // if
       _connected = true;
-      TLOG(LogNotice, << "Connected to " << _stomp->connected_to() << std::endl);
+      TLOG(LogNotice, << "Connected to " << _stomp->connected_to()
+                      << ", subscribed to " << _stomp_dest_notify_msgs
+                      << ", ack " << ack_str(_ack)
+                      << std::endl);
     } // if
 
-    stomp::StompFrame *frame;
-    bool ok = false;
-
-    try {
-      ok = _stomp->next_frame(frame);
-    } // try
-    catch(stomp::Stomp_Exception ex) {
-      TLOG(LogWarn, << "ERROR: " << ex.message() << std::endl);
-      _connected = false;
-      ++_stats.disconnects;
+    /******************
+     ** Flow Control **
+     ******************/
+    // with the window closed leave the messages with the broker, it
+    // stops delivering once prefetch is reached and holds the rest
+    size_t window = _flow->update(backlog(), app->apns()->drained());
+    _throttled = (window == 0);
+    if (_throttled) {
+      ++_stats.throttled;
       return false;
-    } // catch
+    } // if
 
-    if (!ok) return false;
+    /*****************
+     ** Drain Batch **
+     *****************/
+    openframe::Stopwatch sw;
+    sw.Start();
 
-    /*******************
-     ** Process Frame **
-     *******************/
-    ++_stats.frames_in;
-    bool is_usable = frame->is_command(stomp::StompFrame::commandMessage)
-                     && frame->is_header("message-id");
-    if (!is_usable) {
-      frame->release();
-      return true;
-    } // if
-    ++_stats.frames_in;
+    typedef std::vector<stomp::StompFrame *> frames_t;
+    frames_t frames;
+    size_t limit = std::min(_batch_size, window);
+    frames.reserve(limit);
 
-   TLOG(LogDebug, << "received message; "
-                  << frame->body()
-                  << std::endl);
+    bool is_error = false;
+    while(frames.size() < limit) {
+      stomp::StompFrame *frame;
+      bool ok = false;
 
-    process_message( frame->body() );
+      try {
+        ok = _stomp->next_frame(frame);
+      } // try
+      catch(stomp::Stomp_Exception ex) {
+        TLOG(LogWarn, << "ERROR: " << ex.message() << std::endl);
+        _connected = false;
+        ++_stats.disconnects;
+        is_error = true;
+        break;
+      } // catch
 
-    std::string message_id = frame->get_header("message-id");
-    _stomp->ack(message_id, "1");
+      if (!ok) break;
 
-    frame->release();
-    return true;
-  } // Worker::run
+      frames.push_back(frame);
 
-  bool Worker::process_message(const std::string &body) {
-    openframe::Vars *v = new openframe::Vars(body);
+      if (sw.Time() * 1000 >= _batch_timeout) break;
+    } // while
 
-    // if this isn't a message we can ack then we don't
-    // care
-    bool ok = v->is("sr,to,ms,pa");
-    if (!ok) {
-      delete v;
+    // none of the batch can be acked on the dead connection and the
+    // broker delivers all of it again once we're back, pushing it now
+    // would push it twice; with auto ack the broker is already done
+    // with it and this is the only copy
+    if (is_error && _ack != ACK_AUTO) {
+      for(frames_t::iterator itr = frames.begin(); itr != frames.end(); itr++)
+        (*itr)->release();
       return false;
     } // if
 
-    process_message_t pm;
-    pm.source = openframe::StringTool::toUpper( v->get("sr") );
-    pm.target = openframe::StringTool::toUpper( v->get("to") );
-    pm.body = v->get("ms");
-    pm.path = v->get("pa");
-    pm.id = v->get("id");
-    pm.ack = v->get("ack");
-    pm.reply_id = v->get("rpl");
-    pm.is_ackonly = v->is("ao");
-    pm.v = v;
-
-    event_message_to_apns(pm);
-
-    delete v;
-    return true;
-  } // Worker::process_message
-
-  bool Worker::event_message_to_apns(process_message_t &pm) {
-    // was ack only no reply
-    if (pm.is_ackonly) return false;
+    /********************
+     ** Process Frames **
+     ********************/
+    std::string last_message_id;
+    for(frames_t::iterator itr = frames.begin(); itr != frames.end(); itr++) {
+      stomp::StompFrame *frame = *itr;
+
+      ++_stats.frames_in;
+      bool is_usable = frame->is_command(stomp::StompFrame::commandMessage)
+                       && frame->is_header("message-id");
+      if (!is_usable) {
+        frame->release();
+        continue;
+      } // if
 
-    openframe::Stopwatch sw;
-    sw.Start();
+      ++_stats.packets;
 
-   TLOG(LogDebug, << "searching for target "
-                  << pm.target
-                  << std::endl);
-
-    apns_registers_t res;
-    // search for user in apns register
-    bool ok = _store->getApnsRegisterByCallsign(pm.target, res);
-    double avg = _apns->profile.average("apns.push", sw.Time());
-    if (!ok) return false;
-
-    size_t num_sent = 0;
-    while( !res.empty() ) {
-      apns_register_t *ar = res.front();
-
-      // apns_register.id, apns_register.device_token, apns_register.environment
-      TLOG(LogDebug, << "found id "
-                     << ar->id
-                     << ", device token "
-                     << ar->device_token
-                     << ", environment "
-                     << ar->environment
-                     << ", for "
-                     << pm.target
+      TLOG(LogDebug, << "received message; "
+                     << frame->body()
                      << std::endl);
 
-      std::stringstream s;
-      s << pm.source << ": " << pm.body;
-      ok = _store->setApnsPush(ar->id, s.str());
-      if (!ok) {
-        TLOG(LogError, << "Unable to insert APNS push record: "
-                       << s.str()
-                       << std::endl);
+      // shutdown gave up on handing it off, leave it and everything
+      // after it unacked for the broker to deliver again
+      if (!process_message( frame->body() )) {
+        for(; itr != frames.end(); itr++) (*itr)->release();
+        break;
       } // if
 
-      apns::ApnsMessage *aMessage;
-      try {
-        aMessage = new apns::ApnsMessage(ar->device_token);
-      } // try
-      catch (apns::ApnsMessage_Exception e) {
-        TLOG(LogWarn, << "Failed to create new APNS message "
-                      << pm.target
-                      << ">"
-                      << pm.source
-                      << "; "
-                      << e.message()
-                      << std::endl);
-        delete ar;
-        res.pop_front();
-        continue;
-      } // catch
+      last_message_id = frame->get_header("message-id");
+      frame->release();
 
-      aMessage->text(s.str());
-      aMessage->actionKeyCaption("View");
-      aMessage->badgeNumber(1);
+      if (_ack == ACK_CLIENT_INDIVIDUAL) {
+        _stomp->ack(last_message_id, "1");
+        ++_stats.acks;
+      } // if
+    } // for
 
-      if (!strcasecmp(ar->environment.c_str(), "prod"))
-        aMessage->environment(apns::ApnsMessage::APNS_ENVIRONMENT_PROD);
+    if (frames.empty()) return false;
+    ++_stats.batches;
 
-      _apns->push(aMessage);
+    // with client acknowledgement acking the last message acknowledges
+    // every message received before it as well
+    if (_ack == ACK_CLIENT && !last_message_id.empty()) {
+      _stomp->ack(last_message_id, "1");
+      ++_stats.acks;
+    } // if
 
-      TLOG(LogNotice, << "Queuing APNS to "
-                      << pm.target
-                      << ": <"
-                      << pm.source
-                      << "> "
-                      << pm.body
-                      << std::endl);
-      delete ar;
-      res.pop_front();
+    return true;
+  } // Worker::run
 
-      ++num_sent;
-    } // while
+  bool Worker::wait(const int timeout) {
+    // throttled the socket stays readable, poll the backlog instead
+    if (_throttled) return _events.wait(-1, std::min(timeout, kDefaultFlowWait));
+    return _events.wait(_connected ? _stomp->sock() : -1, timeout);
+  } // Worker::wait
+
+  // everything received but not yet written to Apple; it counts
+  // messages before the Pusher fans them out and notifications after,
+  // close enough while most callsigns have a single device
+  size_t Worker::backlog() {
+    return app->lookup_q()->size()
+           + app->push_q()->size()
+           + app->apns()->backlog();
+  } // Worker::backlog
+
+  // false only when the message was neither queued nor rejected and
+  // must not be acked
+  bool Worker::process_message(const std::string &body) {
+    notify_message_t nm;
+    NotifyParser::parseEnum ret = NotifyParser::parse(body, nm);
+    if (ret != NotifyParser::PARSE_OK) {
+      // ack only messages are expected and need no reply
+      if (ret == NotifyParser::PARSE_ACKONLY) return true;
+
+      ++_stompstats.aprs_stats.reject_invparse;
+      TLOG(LogDebug, << "rejected message; "
+                     << NotifyParser::str(ret)
+                     << std::endl);
+      return true;
+    } // if
 
-    TLOG(LogNotice, << "Queued "
-                    << num_sent
-                    << " rows to APNS in ("
-                    << std::fixed << std::setprecision(4)
-                    << sw.Time()
-                    << " seconds, "
-                    << std::fixed << std::setprecision(4)
-                    << avg
-                    << " 5min)"
+    ++_stompstats.aprs_stats.message;
+
+    // hand off to the lookup stage, when it falls behind far enough
+    // to fill the queue we stop reading from stomp and let the broker
+    // hold the backlog
+    while( !_lookup_q->enqueue(nm, kDefaultIdleTimeout) ) {
+      if ( app->is_abandoned() ) return false;
+      TLOG(LogInfo, << "lookup queue full at "
+                    << _lookup_q->capacity()
+                    << ", waiting"
                     << std::endl);
+    } // while
 
+    ++_stats.frames_out;
     return true;
-  } // Worker::event_message_to_apns
+  } // Worker::process_message
 
 } // namespace aprscreate
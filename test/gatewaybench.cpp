@@ -0,0 +1,305 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include <openframe/openframe.h>
+
+#include "GatewayClient.h"
+#include "TlsContext.h"
+
+// Writes notifications through GatewayClient to a loopback TLS sink that
+// stands in for the binary gateway, once with a record per frame (what
+// PushController did) and once coalesced into full records, and compares
+// writes, throughput and CPU per notification, then coalesced again with
+// kernel TLS asked for, which only takes effect where the kernel has the
+// tls module.  A last run salts the stream with invalid tokens
+// the sink rejects the way Apple does, answering with an error response
+// and dropping everything behind it, and checks every good notification
+// still arrives exactly once.
+//
+//   gatewaybench cert.pem key.pem [notifications] [flush delay ms] [bad every]
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+} // now
+
+struct sink_t {
+  SSL_CTX *ctx;
+  int lfd;
+  long frames;				// parsed so far, read by the writer
+  std::vector<char> seen;			// per identifier, for the reject run
+}; // sink_t
+
+static const char kBadToken = char(0xbb);
+
+// accepts one connection per run and counts the frames it carries
+static void *sink_thread(void *arg) {
+  sink_t *sink = static_cast<sink_t *>(arg);
+
+  while(true) {
+    int fd = accept(sink->lfd, NULL, NULL);
+    if (fd < 0) break;
+
+    SSL *ssl = SSL_new(sink->ctx);
+    SSL_set_fd(ssl, fd);
+    if (SSL_accept(ssl) != 1) {
+      ERR_print_errors_fp(stderr);
+      SSL_free(ssl);
+      close(fd);
+      continue;
+    } // if
+
+    std::string buf;
+    char rbuf[65536];
+    int ret;
+    bool rejected = false;
+    while(!rejected && (ret = SSL_read(ssl, rbuf, sizeof(rbuf))) > 0) {
+      buf.append(rbuf, ret);
+
+      // command 1: id 4, expiry 4, token length 2, token, payload length 2, payload
+      size_t pos = 0;
+      while(buf.length() - pos >= 11) {
+        uint16_t tlen, plen;
+        memcpy(&tlen, buf.data() + pos + 9, 2);
+        tlen = ntohs(tlen);
+        if (buf.length() - pos < 13u + tlen) break;
+        memcpy(&plen, buf.data() + pos + 11 + tlen, 2);
+        plen = ntohs(plen);
+        size_t len = 13 + tlen + plen;
+        if (buf.length() - pos < len) break;
+
+        uint32_t id;
+        memcpy(&id, buf.data() + pos + 1, 4);
+        id = ntohl(id);
+
+        // invalid token: answer status 8 and hang up, the rest is lost
+        if (buf[pos + 11] == kBadToken) {
+          char err[6] = { 8, 8 };
+          uint32_t nid = htonl(id);
+          memcpy(err + 2, &nid, 4);
+          SSL_write(ssl, err, sizeof(err));
+          rejected = true;
+          break;
+        } // if
+
+        if (id < sink->seen.size() && sink->seen[id]++) {
+          std::cerr << "notification " << id << " delivered twice" << std::endl;
+          exit(1);
+        } // if
+
+        pos += len;
+        __atomic_add_fetch(&sink->frames, 1, __ATOMIC_RELEASE);
+      } // while
+      buf.erase(0, pos);
+    } // while
+
+    // half close and drain, closing with unread data would reset the
+    // connection and the client could lose the error response
+    if (rejected) {
+      shutdown(fd, SHUT_WR);
+      while(read(fd, rbuf, sizeof(rbuf)) > 0);
+    } // if
+
+    SSL_free(ssl);
+    close(fd);
+  } // while
+
+  return NULL;
+} // sink_thread
+
+// fixed width so every frame is the same length
+static std::string payload(const long i) {
+  std::stringstream s;
+  s << "{\"aps\":{\"alert\":{\"body\":\"N0CALL: message "
+    << std::setw(10) << std::setfill('0') << i
+    << "\",\"action-loc-key\":\"View\"},\"badge\":1}}";
+  return s.str();
+} // payload
+
+// every bad_every-th token is invalid, the rest must arrive exactly once
+static void run_rejects(sink_t &sink, const int port, const long count, const int delay, const long bad_every) {
+  apnspusher::GatewayClient client("127.0.0.1", port, "", "", "", 0);
+  client.set_verify(false);
+  client.set_flush(apnspusher::GatewayClient::kDefaultRecordSize, delay);
+
+  long num_bad = count / bad_every;
+  __atomic_store_n(&sink.frames, 0, __ATOMIC_RELEASE);
+  sink.seen.assign(count, 0);
+  if (!client.connect()) {
+    std::cerr << "unable to connect" << std::endl;
+    exit(1);
+  } // if
+
+  std::string good(64, 'a'), bad;
+  for(int i = 0; i < 32; i++) bad += "bb";
+
+  apnspusher::GatewayClient::rejections_t rejections;
+  long reconnects = 0;
+  double start = now();
+  for(long i = 0; i < count || client.buffered() > 0 || client.resend_pending() > 0
+                  || __atomic_load_n(&sink.frames, __ATOMIC_ACQUIRE) < count - num_bad; ) {
+    for(int j = 0; j < 100 && i < count; j++, i++)
+      client.add(i % bad_every == bad_every - 1 ? bad : good, apnspusher::Payload(payload(i)), uint32_t(i), 0);
+
+    if (!client.run(i < count ? 0 : delay + 1)) {
+      client.disconnect();
+      client.rejections(rejections);
+      ++reconnects;
+      if (!client.connect()) {
+        std::cerr << "reconnect failed" << std::endl;
+        exit(1);
+      } // if
+    } // if
+  } // for
+  double elapsed = now() - start;
+
+  // the answer to a bad token at the very end may still be on its way
+  for(int i = 0; i < 10 && long(rejections.size()) < num_bad; i++) {
+    if (!client.run(100)) {
+      client.disconnect();
+      client.rejections(rejections);
+    } // if
+  } // for
+
+  const apnspusher::GatewayClient::stats_t &stats = client.stats();
+  // resent frames are only counted the first time they're written
+  bool ok = (long(rejections.size()) == num_bad
+             && __atomic_load_n(&sink.frames, __ATOMIC_ACQUIRE) == count - num_bad
+             && client.written() == (unsigned long long) count);
+  std::cout << "one bad token in " << bad_every << ": "
+            << __atomic_load_n(&sink.frames, __ATOMIC_ACQUIRE) << " delivered, "
+            << rejections.size() << " rejected, "
+            << client.written() << " written, "
+            << stats.resent << " resent over "
+            << reconnects << " reconnects ("
+            << stats.resumed << " resumed), "
+            << std::fixed << std::setprecision(0) << count / elapsed << " notifications/s"
+            << (ok ? "" : " MISMATCH")
+            << std::endl;
+  if (!ok) exit(1);
+} // run_rejects
+
+// user and system time of the calling thread, the sink runs on its own
+static double cpu() {
+  struct rusage ru;
+  getrusage(RUSAGE_THREAD, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+         + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+} // cpu
+
+static void run(sink_t &sink, const int port, const std::vector<apnspusher::Payload> &payloads,
+                const size_t record_size, const int delay, const bool ktls) {
+  long count = payloads.size();
+  apnspusher::TlsContext tls("", "", "", false);
+  tls.set_ktls(ktls);
+  apnspusher::GatewayClient client("127.0.0.1", port, "", "", "", 0);
+  client.set_tls(&tls);
+  client.set_flush(record_size, delay);
+
+  __atomic_store_n(&sink.frames, 0, __ATOMIC_RELEASE);
+  if (!client.connect()) {
+    std::cerr << "unable to connect" << std::endl;
+    exit(1);
+  } // if
+
+  std::string token(64, 'a');
+  double start = now();
+  double start_cpu = cpu();
+  for(long i = 0; i < count; ) {
+    // the ssl thread takes up to app.apns.ssl.maxqueue per pass
+    for(int j = 0; j < 100 && i < count; j++, i++) {
+      client.add(token, payloads[i], uint32_t(i), 0);
+    } // for
+    client.run(0);
+  } // for
+  while(client.buffered() > 0) client.run(delay + 1);
+  double used = cpu() - start_cpu;
+  while(__atomic_load_n(&sink.frames, __ATOMIC_ACQUIRE) < count) usleep(100);
+  double elapsed = now() - start;
+
+  const apnspusher::GatewayClient::stats_t &stats = client.stats();
+  std::cout << std::setw(6) << record_size << " byte records"
+            << (!ktls ? "" : stats.ktls ? ", kernel TLS" : ", kernel TLS unavailable")
+            << ": "
+            << stats.records << " writes, "
+            << std::fixed << std::setprecision(1)
+            << double(stats.bytes) / stats.records << " bytes/record, "
+            << double(stats.frames) / stats.records << " frames/record, "
+            << std::setprecision(0) << count / elapsed << " notifications/s, "
+            << std::setprecision(2) << used * 1000000.0 / count << "us cpu/notification"
+            << std::endl;
+} // run
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "usage: " << argv[0] << " <cert> <key> [notifications] [flush delay ms] [bad every]" << std::endl;
+    return 1;
+  } // if
+
+  long count = argc > 3 ? atol(argv[3]) : 200000;
+  int delay = argc > 4 ? atoi(argv[4]) : apnspusher::GatewayClient::kDefaultFlushDelay;
+  long bad_every = argc > 5 ? atol(argv[5]) : 1000;
+
+  signal(SIGPIPE, SIG_IGN);
+  SSL_library_init();
+  SSL_load_error_strings();
+
+  sink_t sink;
+  sink.frames = 0;
+  sink.ctx = SSL_CTX_new(SSLv23_server_method());
+  if (SSL_CTX_use_certificate_chain_file(sink.ctx, argv[1]) != 1
+      || SSL_CTX_use_PrivateKey_file(sink.ctx, argv[2], SSL_FILETYPE_PEM) != 1) {
+    ERR_print_errors_fp(stderr);
+    return 1;
+  } // if
+
+  sink.lfd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (bind(sink.lfd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+      || listen(sink.lfd, 4) < 0
+      || getsockname(sink.lfd, (struct sockaddr *) &addr, &len) < 0) {
+    perror("listen");
+    return 1;
+  } // if
+  int port = ntohs(addr.sin_port);
+
+  pthread_t tid;
+  pthread_create(&tid, NULL, sink_thread, &sink);
+
+  std::cout << "notifications: " << count << ", flush delay: " << delay << "ms" << std::endl;
+
+  std::vector<apnspusher::Payload> payloads;
+  payloads.reserve(count);
+  for(long i = 0; i < count; i++) payloads.push_back(apnspusher::Payload(payload(i)));
+
+  // a record the size of one frame is what writing each message on
+  // its own gives
+  run(sink, port, payloads, 45 + payload(0).length(), delay, false);
+  run(sink, port, payloads, apnspusher::GatewayClient::kDefaultRecordSize, delay, false);
+  run(sink, port, payloads, apnspusher::GatewayClient::kDefaultRecordSize, delay, true);
+  run_rejects(sink, port, count, delay, bad_every);
+
+  return 0;
+} // main
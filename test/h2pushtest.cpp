@@ -0,0 +1,121 @@
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <openframe/openframe.h>
+
+#include "Http2Client.h"
+
+// Drives Http2Client against h2server (or the real sandbox) and prints
+// what came back per status.  Every tenth token is "dead...", every
+// hundredth "bad..." and one in a hundred "busy...", so against h2server
+// the counts show 410, 400 and retried 429 handling alongside the 200s.
+//
+//   h2pushtest 127.0.0.1 8443 100000 [max streams] [cert key]
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+} // now
+
+int main(int argc, char **argv) {
+  if (argc < 4) {
+    std::cerr << "usage: " << argv[0] << " <host> <port> <count> [max streams] [cert key]" << std::endl;
+    return 1;
+  } // if
+
+  std::string host = argv[1];
+  int port = atoi(argv[2]);
+  long count = atol(argv[3]);
+  size_t max_streams = argc > 4 ? atol(argv[4]) : apnspusher::Http2Client::kDefaultMaxStreams;
+  std::string cert = argc > 6 ? argv[5] : "";
+  std::string key = argc > 6 ? argv[6] : "";
+
+  // apnspusher catches SIGPIPE itself, the server closing after a GOAWAY
+  // would otherwise kill us here
+  signal(SIGPIPE, SIG_IGN);
+  SSL_library_init();
+  SSL_load_error_strings();
+
+  apnspusher::Http2Client client(host, port, cert, key, "", "");
+  client.set_verify(false);
+  client.set_max_streams(max_streams);
+
+  double start = now();
+  if (!client.connect()) {
+    std::cerr << "unable to connect to " << host << ":" << port << std::endl;
+    return 1;
+  } // if
+
+  std::map<int, long> statuses;
+  std::map<std::string, long> reasons;
+  long added = 0, answered = 0, reconnects = 0;
+  size_t max_in_flight = 0;
+
+  while(answered < count) {
+    for(size_t room = client.room(); room > 0 && added < count; room--, added++) {
+      std::stringstream token;
+      if (added % 100 == 99) token << "bad";
+      else if (added % 10 == 9) token << "dead";
+      else if (added % 100 == 50) token << "busy";
+      token << std::setw(16) << std::setfill('0') << added;
+
+      apnspusher::Http2Client::request_t request;
+      request.device_token = token.str();
+      request.payload = apnspusher::Payload(apnspusher::Http2Client::payload("TEST: message " + token.str(), "View", 1));
+      clock_gettime(CLOCK_MONOTONIC, &request.queued_at);
+      request.attempts = 0;
+      client.add(request);
+    } // for
+
+    bool ok = client.run(1000);
+    if (client.in_flight() > max_in_flight) max_in_flight = client.in_flight();
+
+    apnspusher::Http2Client::responses_t responses;
+    client.responses(responses);
+    for(size_t i = 0; i < responses.size(); i++) {
+      ++statuses[responses[i].status];
+      if (responses[i].reason.length()) ++reasons[responses[i].reason];
+    } // for
+    answered += responses.size();
+
+    if (!ok) {
+      // in flight requests go back to pending, collect what gave up
+      client.disconnect();
+      responses.clear();
+      client.responses(responses);
+      for(size_t i = 0; i < responses.size(); i++) ++statuses[responses[i].status];
+      answered += responses.size();
+
+      ++reconnects;
+      if (!client.connect()) {
+        std::cerr << "reconnect failed" << std::endl;
+        return 1;
+      } // if
+    } // if
+  } // while
+
+  double elapsed = now() - start;
+
+  std::cout << "notifications " << answered
+            << " in " << std::fixed << std::setprecision(3) << elapsed << "s"
+            << ", " << std::setprecision(0) << answered / elapsed << "/s"
+            << ", max in flight " << max_in_flight
+            << ", reconnects " << reconnects
+            << ", resumed " << client.stats().resumed
+            << " of " << client.stats().handshakes << " handshakes"
+            << std::endl;
+  for(std::map<int, long>::iterator itr = statuses.begin(); itr != statuses.end(); itr++)
+    std::cout << "  status " << itr->first << ": " << itr->second << std::endl;
+  for(std::map<std::string, long>::iterator itr = reasons.begin(); itr != reasons.end(); itr++)
+    std::cout << "  reason " << itr->first << ": " << itr->second << std::endl;
+
+  return 0;
+} // main
@@ -0,0 +1,316 @@
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <nghttp2/nghttp2.h>
+
+// Local stand-in for the APNs provider API, enough of it to exercise the
+// HTTP/2 transport: TLS with ALPN h2, POST /3/device/<token>, one status
+// per stream.  Tokens starting with "dead" answer 410 Unregistered, "bad"
+// 400 BadDeviceToken, "busy" 429 on every other try; the rest 200.
+//
+//   openssl req -x509 -newkey rsa:2048 -nodes -days 365 -subj /CN=localhost
+//     -keyout key.pem -out cert.pem
+//   h2server 8443 cert.pem key.pem [max streams] [goaway after N streams]
+
+struct stream_t {
+  std::string path;
+  std::string body;
+  std::string response;
+}; // stream_t
+
+struct conn_t {
+  int fd;
+  SSL *ssl;
+  nghttp2_session *session;
+  std::string wbuf;
+  std::map<int32_t, stream_t *> streams;
+  unsigned long served;
+}; // conn_t
+
+static unsigned int max_streams = 1000;
+static unsigned long goaway_after = 0;
+static unsigned long busy_count = 0;
+
+static ssize_t send_cb(nghttp2_session *, const uint8_t *data, size_t length, int, void *user_data) {
+  conn_t *c = static_cast<conn_t *>(user_data);
+  c->wbuf.append((const char *) data, length);
+  return length;
+} // send_cb
+
+static int on_begin_headers_cb(nghttp2_session *session, const nghttp2_frame *frame, void *user_data) {
+  conn_t *c = static_cast<conn_t *>(user_data);
+  if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_REQUEST) return 0;
+  stream_t *s = new stream_t;
+  c->streams[frame->hd.stream_id] = s;
+  nghttp2_session_set_stream_user_data(session, frame->hd.stream_id, s);
+  return 0;
+} // on_begin_headers_cb
+
+static int on_header_cb(nghttp2_session *session, const nghttp2_frame *frame,
+                        const uint8_t *name, size_t namelen, const uint8_t *value, size_t valuelen,
+                        uint8_t, void *) {
+  stream_t *s = static_cast<stream_t *>(nghttp2_session_get_stream_user_data(session, frame->hd.stream_id));
+  if (s && namelen == 5 && !memcmp(name, ":path", 5)) s->path.assign((const char *) value, valuelen);
+  return 0;
+} // on_header_cb
+
+static int on_data_chunk_cb(nghttp2_session *session, uint8_t, int32_t stream_id,
+                            const uint8_t *data, size_t len, void *) {
+  stream_t *s = static_cast<stream_t *>(nghttp2_session_get_stream_user_data(session, stream_id));
+  if (s) s->body.append((const char *) data, len);
+  return 0;
+} // on_data_chunk_cb
+
+static ssize_t read_response_cb(nghttp2_session *, int32_t, uint8_t *buf, size_t length,
+                                uint32_t *data_flags, nghttp2_data_source *source, void *) {
+  stream_t *s = static_cast<stream_t *>(source->ptr);
+  size_t num = std::min(length, s->response.length());
+  memcpy(buf, s->response.data(), num);
+  s->response.erase(0, num);
+  if (s->response.empty()) *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+  return num;
+} // read_response_cb
+
+static void respond(nghttp2_session *session, conn_t *c, int32_t stream_id, stream_t *s) {
+  std::string token = s->path.compare(0, 10, "/3/device/") ? "" : s->path.substr(10);
+  const char *status = "200";
+  if (token.empty() || !token.compare(0, 3, "bad") || s->body.find("\"aps\"") == std::string::npos) {
+    status = "400";
+    s->response = "{\"reason\":\"BadDeviceToken\"}";
+  } // if
+  else if (!token.compare(0, 4, "dead")) {
+    status = "410";
+    char buf[128];
+    snprintf(buf, sizeof(buf), "{\"reason\":\"Unregistered\",\"timestamp\":%lld000}", (long long) time(NULL));
+    s->response = buf;
+  } // else if
+  else if (!token.compare(0, 4, "busy") && (busy_count++ % 2) == 0) {
+    status = "429";
+    s->response = "{\"reason\":\"TooManyRequests\"}";
+  } // else if
+
+  nghttp2_nv hdrs[1];
+  hdrs[0].name = (uint8_t *) ":status";
+  hdrs[0].namelen = 7;
+  hdrs[0].value = (uint8_t *) status;
+  hdrs[0].valuelen = 3;
+  hdrs[0].flags = NGHTTP2_NV_FLAG_NONE;
+
+  if (s->response.empty())
+    nghttp2_submit_response(session, stream_id, hdrs, 1, NULL);
+  else {
+    nghttp2_data_provider data;
+    data.source.ptr = s;
+    data.read_callback = read_response_cb;
+    nghttp2_submit_response(session, stream_id, hdrs, 1, &data);
+  } // else
+
+  if (++c->served == goaway_after)
+    nghttp2_submit_goaway(session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_NO_ERROR, NULL, 0);
+} // respond
+
+static int on_frame_recv_cb(nghttp2_session *session, const nghttp2_frame *frame, void *user_data) {
+  conn_t *c = static_cast<conn_t *>(user_data);
+  if ((frame->hd.type == NGHTTP2_DATA || frame->hd.type == NGHTTP2_HEADERS)
+      && (frame->hd.flags & NGHTTP2_FLAG_END_STREAM)) {
+    stream_t *s = static_cast<stream_t *>(nghttp2_session_get_stream_user_data(session, frame->hd.stream_id));
+    if (s) respond(session, c, frame->hd.stream_id, s);
+  } // if
+  return 0;
+} // on_frame_recv_cb
+
+static int on_stream_close_cb(nghttp2_session *, int32_t stream_id, uint32_t, void *user_data) {
+  conn_t *c = static_cast<conn_t *>(user_data);
+  std::map<int32_t, stream_t *>::iterator ptr = c->streams.find(stream_id);
+  if (ptr != c->streams.end()) {
+    delete ptr->second;
+    c->streams.erase(ptr);
+  } // if
+  return 0;
+} // on_stream_close_cb
+
+static int alpn_select_cb(SSL *, const unsigned char **out, unsigned char *outlen,
+                          const unsigned char *in, unsigned int inlen, void *) {
+  for(unsigned int i = 0; i < inlen; i += in[i] + 1) {
+    if (in[i] == 2 && i + 3 <= inlen && !memcmp(in + i + 1, "h2", 2)) {
+      *out = in + i + 1;
+      *outlen = 2;
+      return SSL_TLSEXT_ERR_OK;
+    } // if
+  } // for
+  return SSL_TLSEXT_ERR_NOACK;
+} // alpn_select_cb
+
+static conn_t *accept_conn(int lfd, SSL_CTX *ctx) {
+  int fd = accept(lfd, NULL, NULL);
+  if (fd < 0) return NULL;
+
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+  SSL *ssl = SSL_new(ctx);
+  SSL_set_fd(ssl, fd);
+  if (SSL_accept(ssl) != 1) {
+    ERR_print_errors_fp(stderr);
+    SSL_free(ssl);
+    close(fd);
+    return NULL;
+  } // if
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+  conn_t *c = new conn_t;
+  c->fd = fd;
+  c->ssl = ssl;
+  c->served = 0;
+
+  nghttp2_session_callbacks *callbacks;
+  nghttp2_session_callbacks_new(&callbacks);
+  nghttp2_session_callbacks_set_send_callback(callbacks, send_cb);
+  nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, on_begin_headers_cb);
+  nghttp2_session_callbacks_set_on_header_callback(callbacks, on_header_cb);
+  nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, on_data_chunk_cb);
+  nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, on_frame_recv_cb);
+  nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, on_stream_close_cb);
+  nghttp2_session_server_new(&c->session, callbacks, c);
+  nghttp2_session_callbacks_del(callbacks);
+
+  nghttp2_settings_entry settings[1];
+  settings[0].settings_id = NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS;
+  settings[0].value = max_streams;
+  nghttp2_submit_settings(c->session, NGHTTP2_FLAG_NONE, settings, 1);
+
+  std::cout << "connection " << fd << std::endl;
+  return c;
+} // accept_conn
+
+// false once the connection is finished with
+static bool service(conn_t *c) {
+  unsigned char buf[16384];
+  while(true) {
+    int ret = SSL_read(c->ssl, buf, sizeof(buf));
+    if (ret <= 0) {
+      int err = SSL_get_error(c->ssl, ret);
+      if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) break;
+      return false;
+    } // if
+    if (nghttp2_session_mem_recv(c->session, buf, ret) < 0) return false;
+  } // while
+
+  if (nghttp2_session_send(c->session) != 0) return false;
+
+  size_t offset = 0;
+  while(offset < c->wbuf.length()) {
+    int ret = SSL_write(c->ssl, c->wbuf.data() + offset, c->wbuf.length() - offset);
+    if (ret <= 0) {
+      int err = SSL_get_error(c->ssl, ret);
+      if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) break;
+      return false;
+    } // if
+    offset += ret;
+  } // while
+  c->wbuf.erase(0, offset);
+
+  return nghttp2_session_want_read(c->session) || nghttp2_session_want_write(c->session)
+         || !c->wbuf.empty();
+} // service
+
+static void close_conn(conn_t *c) {
+  std::cout << "closed " << c->fd << " after " << c->served << " streams" << std::endl;
+  for(std::map<int32_t, stream_t *>::iterator itr = c->streams.begin(); itr != c->streams.end(); itr++)
+    delete itr->second;
+  nghttp2_session_del(c->session);
+  SSL_free(c->ssl);
+  close(c->fd);
+  delete c;
+} // close_conn
+
+int main(int argc, char **argv) {
+  if (argc < 4) {
+    std::cerr << "usage: " << argv[0] << " <port> <cert> <key> [max streams] [goaway after]" << std::endl;
+    return 1;
+  } // if
+
+  int port = atoi(argv[1]);
+  if (argc > 4) max_streams = atoi(argv[4]);
+  if (argc > 5) goaway_after = atol(argv[5]);
+
+  signal(SIGPIPE, SIG_IGN);
+  SSL_library_init();
+  SSL_load_error_strings();
+
+  SSL_CTX *ctx = SSL_CTX_new(SSLv23_server_method());
+  SSL_CTX_set_options(ctx, SSL_OP_ALL | SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION);
+  SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  if (SSL_CTX_use_certificate_chain_file(ctx, argv[2]) != 1
+      || SSL_CTX_use_PrivateKey_file(ctx, argv[3], SSL_FILETYPE_PEM) != 1) {
+    ERR_print_errors_fp(stderr);
+    return 1;
+  } // if
+  SSL_CTX_set_alpn_select_cb(ctx, alpn_select_cb, NULL);
+
+  int lfd = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+  setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(lfd, 16) < 0) {
+    perror("listen");
+    return 1;
+  } // if
+
+  std::cout << "listening on 127.0.0.1:" << port
+            << ", max streams " << max_streams
+            << ", goaway after " << goaway_after
+            << std::endl;
+
+  std::vector<conn_t *> conns;
+  while(true) {
+    std::vector<struct pollfd> fds(conns.size() + 1);
+    fds[0].fd = lfd;
+    fds[0].events = POLLIN;
+    for(size_t i = 0; i < conns.size(); i++) {
+      fds[i + 1].fd = conns[i]->fd;
+      fds[i + 1].events = POLLIN | (conns[i]->wbuf.empty() ? 0 : POLLOUT);
+    } // for
+
+    if (poll(&fds[0], fds.size(), 1000) < 0 && errno != EINTR) break;
+
+    for(size_t i = conns.size(); i > 0; i--) {
+      if (!fds[i].revents) continue;
+      conn_t *c = conns[i - 1];
+      if (!service(c)) {
+        close_conn(c);
+        conns.erase(conns.begin() + (i - 1));
+      } // if
+    } // for
+
+    if (fds[0].revents & POLLIN) {
+      conn_t *c = accept_conn(lfd, ctx);
+      if (c) {
+        conns.push_back(c);
+        service(c);
+      } // if
+    } // if
+  } // while
+
+  return 0;
+} // main
@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "RegisterIndex.h"
+
+// Readers look callsigns up in a RegisterIndex while delta syncs swap
+// snapshots under them.  Meant to be built with -fsanitize=thread or
+// -fsanitize=address as well: a snapshot freed while a reader still
+// holds it shows up there, or as a lookup returning the wrong rows.
+
+using apnspusher::RegisterIndex;
+using apnspusher::apns_register_t;
+using apnspusher::apns_registers_t;
+
+static const int kCallsigns = 2000;
+static const int kLoaded = 1000;
+
+struct test_t {
+  RegisterIndex *index;
+  int done;
+  unsigned long lookups;
+  unsigned long found;
+  unsigned long errors;
+}; // test_t
+
+static std::string callsign(const int n) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "CALL%d", n);
+  return buf;
+} // callsign
+
+static apns_register_t row(const char *id, const char *token, const char *environment) {
+  apns_register_t ar;
+  ar.id = id;
+  ar.device_token = token;
+  ar.environment = environment;
+  return ar;
+} // row
+
+static void *reader(void *arg) {
+  test_t *t = static_cast<test_t *>(arg);
+  int slot = t->index->attach();
+  unsigned int seed = slot;
+  unsigned long lookups = 0, found = 0, errors = 0;
+
+  while(!__atomic_load_n(&t->done, __ATOMIC_ACQUIRE)) {
+    apns_registers_t ret;
+    RegisterIndex::lookupEnum l = t->index->get(slot, callsign(rand_r(&seed) % kCallsigns), ret);
+    ++lookups;
+
+    if (l == RegisterIndex::REGISTER_INDEX_FOUND) {
+      ++found;
+      // every row published starts with "tok", anything else was freed
+      if (ret.empty() || ret[0]->device_token.compare(0, 3, "tok")) ++errors;
+    } // if
+    else if (l != RegisterIndex::REGISTER_INDEX_NOTFOUND) ++errors;
+
+    for(size_t i = 0; i < ret.size(); i++) delete ret[i];
+  } // while
+
+  __atomic_add_fetch(&t->lookups, lookups, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&t->found, found, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&t->errors, errors, __ATOMIC_RELAXED);
+  return NULL;
+} // reader
+
+int main(int argc, char **argv) {
+  int num_readers = argc > 1 ? atoi(argv[1]) : 4;
+  int num_syncs = argc > 2 ? atoi(argv[2]) : 200;
+  // every delta removes one of the loaded callsigns
+  num_syncs = std::max(1, std::min(num_syncs, kLoaded));
+
+  // sync every call, reload never
+  RegisterIndex index(0, 3600);
+  test_t t = { &index, 0, 0, 0, 0 };
+
+  RegisterIndex::registers_t all;
+  for(int i = 0; i < kLoaded; i++)
+    all[callsign(i)].push_back(row("1", "tok", "prod"));
+
+  if (index.claim_sync() != RegisterIndex::SYNC_FULL) {
+    std::cerr << "first sync isn't a full load" << std::endl;
+    return 1;
+  } // if
+  index.publish(RegisterIndex::SYNC_FULL, all, kLoaded);
+
+  std::vector<pthread_t> tids(num_readers);
+  for(int i = 0; i < num_readers; i++) pthread_create(&tids[i], NULL, reader, &t);
+
+  // each delta adds a callsign with two rows and removes a loaded one
+  for(int i = 0; i < num_syncs; i++) {
+    if (index.claim_sync() != RegisterIndex::SYNC_DELTA) {
+      std::cerr << "sync " << i << " isn't a delta" << std::endl;
+      return 1;
+    } // if
+
+    RegisterIndex::registers_t delta;
+    delta[callsign(kLoaded + i)].push_back(row("2", "tok2", "sandbox"));
+    delta[callsign(kLoaded + i)].push_back(row("3", "tok3", "sandbox"));
+    delta[callsign(i)];
+    index.publish(RegisterIndex::SYNC_DELTA, delta, kLoaded + i);
+  } // for
+
+  __atomic_store_n(&t.done, 1, __ATOMIC_RELEASE);
+  for(int i = 0; i < num_readers; i++) pthread_join(tids[i], NULL);
+
+  std::cout << "readers: " << num_readers
+            << ", syncs: " << num_syncs
+            << ", lookups: " << t.lookups
+            << ", found: " << t.found
+            << ", callsigns: " << index.count()
+            << ", rows: " << index.rows()
+            << ", bytes: " << index.bytes()
+            << std::endl;
+
+  // what the last delta left behind
+  apns_registers_t ret;
+  int slot = index.attach();
+  bool ok = t.errors == 0
+            && index.count() == size_t(kLoaded)
+            && index.rows() == size_t(kLoaded + num_syncs)
+            && index.last_id() == uint64_t(kLoaded + num_syncs - 1)
+            && index.get(slot, callsign(0), ret) == RegisterIndex::REGISTER_INDEX_NOTFOUND
+            && index.get(slot, callsign(kLoaded), ret) == RegisterIndex::REGISTER_INDEX_FOUND
+            && ret.size() == 2;
+  for(size_t i = 0; i < ret.size(); i++) delete ret[i];
+
+  if (!ok) {
+    std::cerr << "index inconsistent, " << t.errors << " bad lookups" << std::endl;
+    return 1;
+  } // if
+
+  return 0;
+} // main
@@ -0,0 +1,206 @@
+#include <cassert>
+#include <exception>
+#include <iostream>
+#include <iomanip>
+#include <new>
+#include <string>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <openframe/openframe.h>
+
+#include "NotifyParser.h"
+#include "Pipeline.h"
+
+// Compares the openframe::Vars path Worker::process_message used to take
+// with NotifyParser on the same notify body, first what each makes of
+// escaped, missing and oversized fields and then how fast they are.
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+} // now
+
+struct vars_message_t {
+  std::string source;
+  std::string target;
+  std::string id;
+  std::string ack;
+  std::string reply_id;
+  std::string path;
+  std::string body;
+  bool is_ackonly;
+}; // vars_message_t
+
+static bool vars_parse(const std::string &body, vars_message_t &pm) {
+  openframe::Vars *v = new openframe::Vars(body);
+
+  bool ok = v->is("sr,to,ms,pa");
+  if (!ok) {
+    delete v;
+    return false;
+  } // if
+
+  pm.source = openframe::StringTool::toUpper( v->get("sr") );
+  pm.target = openframe::StringTool::toUpper( v->get("to") );
+  pm.body = v->get("ms");
+  pm.path = v->get("pa");
+  pm.id = v->get("id");
+  pm.ack = v->get("ack");
+  pm.reply_id = v->get("rpl");
+  pm.is_ackonly = v->is("ao");
+
+  delete v;
+  return !pm.is_ackonly;
+} // vars_parse
+
+enum expectEnum {
+  EXPECT_SAME,				// both accept, same fields
+  EXPECT_REJECT,			// both reject
+  EXPECT_TOOLONG			// Vars keeps it whole, NotifyParser refuses
+};
+
+// fields as name, value pairs, a NULL value leaves the field out
+static std::string compile(const char *fields[][2]) {
+  openframe::Vars v;
+  for(size_t i = 0; fields[i][0]; i++)
+    if (fields[i][1]) v.add(fields[i][0], fields[i][1]);
+  return v.compile();
+} // compile
+
+static bool check(const char *name, const std::string &body, const expectEnum expect) {
+  vars_message_t pm;
+  apnspusher::notify_message_t nm;
+  bool vars_ok = vars_parse(body, pm);
+  apnspusher::NotifyParser::parseEnum ret = apnspusher::NotifyParser::parse(body, nm);
+
+  bool ok = false;
+  switch(expect) {
+    case EXPECT_SAME:
+      ok = vars_ok && ret == apnspusher::NotifyParser::PARSE_OK
+           && pm.source == nm.source && pm.target == nm.target
+           && pm.body == nm.body && pm.id == nm.id;
+      break;
+    case EXPECT_REJECT:
+      ok = !vars_ok && ret != apnspusher::NotifyParser::PARSE_OK;
+      break;
+    case EXPECT_TOOLONG:
+      ok = vars_ok && ret == apnspusher::NotifyParser::PARSE_TOOLONG;
+      break;
+  } // switch
+
+  if (!ok)
+    std::cerr << name << ": parsers disagree on " << body << std::endl
+              << "  Vars " << (vars_ok ? "accepts" : "rejects")
+              << " sr:" << pm.source << " to:" << pm.target << " id:" << pm.id << " ms:" << pm.body << std::endl
+              << "  NotifyParser " << apnspusher::NotifyParser::str(ret);
+  if (!ok && ret == apnspusher::NotifyParser::PARSE_OK)
+    std::cerr << " sr:" << nm.source << " to:" << nm.target << " id:" << nm.id << " ms:" << nm.body;
+  if (!ok) std::cerr << std::endl;
+
+  return ok;
+} // check
+
+static int check_fields() {
+  const std::string callsign(apnspusher::notify_message_t::kMaxCallsignLength, 'k');
+  const std::string id(apnspusher::notify_message_t::kMaxIdLength, '9');
+  const std::string ms(apnspusher::notify_message_t::kMaxBodyLength, 'x');
+  const std::string callsign_over = callsign + "1";
+  const std::string id_over = id + "9";
+  const std::string ms_over = ms + "x";
+  const std::string ms_over_escaped = ms + "|";
+
+  struct case_t {
+    const char *name;
+    const char *fields[8][2];
+    expectEnum expect;
+  } cases[] = {
+    { "plain", { {"sr", "ea1eol-10"}, {"to", "ea1cc-9"}, {"id", "38"}, {"ms", "ESE TIENE TONO"}, {"pa", "APU25N,WIDE3"}, {NULL, NULL} }, EXPECT_SAME },
+    { "escaped pipe", { {"sr", "n0call"}, {"to", "k1abc"}, {"id", "1"}, {"ms", "a|b||c|"}, {"pa", "WIDE1-1|WIDE2-2"}, {NULL, NULL} }, EXPECT_SAME },
+    { "escaped colon", { {"sr", "n0call"}, {"to", "k1abc"}, {"id", "2"}, {"ms", "ack:to:me:"}, {"pa", "qAR:N0CALL"}, {NULL, NULL} }, EXPECT_SAME },
+    { "escaped backslash", { {"sr", "n0call"}, {"to", "k1abc"}, {"id", "3"}, {"ms", "c:\\path\\ |\\"}, {"pa", "\\"}, {NULL, NULL} }, EXPECT_SAME },
+    { "escaped percent", { {"sr", "n0call"}, {"to", "k1abc"}, {"id", "4"}, {"ms", "100% of %7C and %3A + more"}, {"pa", "%"}, {NULL, NULL} }, EXPECT_SAME },
+    { "escaped callsign", { {"sr", "n0:ca|l"}, {"to", "k1%ab\\c"}, {"id", "5"}, {"ms", "hi"}, {"pa", "WIDE1-1"}, {NULL, NULL} }, EXPECT_SAME },
+    { "empty values", { {"sr", "n0call"}, {"to", "k1abc"}, {"id", ""}, {"ms", ""}, {"pa", ""}, {NULL, NULL} }, EXPECT_SAME },
+    { "missing id", { {"sr", "n0call"}, {"to", "k1abc"}, {"id", NULL}, {"ms", "hi"}, {"pa", "WIDE1-1"}, {NULL, NULL} }, EXPECT_SAME },
+    { "missing sr", { {"sr", NULL}, {"to", "k1abc"}, {"id", "6"}, {"ms", "hi"}, {"pa", "WIDE1-1"}, {NULL, NULL} }, EXPECT_REJECT },
+    { "missing to", { {"sr", "n0call"}, {"to", NULL}, {"id", "7"}, {"ms", "hi"}, {"pa", "WIDE1-1"}, {NULL, NULL} }, EXPECT_REJECT },
+    { "missing ms", { {"sr", "n0call"}, {"to", "k1abc"}, {"id", "8"}, {"ms", NULL}, {"pa", "WIDE1-1"}, {NULL, NULL} }, EXPECT_REJECT },
+    { "missing pa", { {"sr", "n0call"}, {"to", "k1abc"}, {"id", "9"}, {"ms", "hi"}, {"pa", NULL}, {NULL, NULL} }, EXPECT_REJECT },
+    { "missing escaped", { {"sr", NULL}, {"to", "k1abc"}, {"id", "10"}, {"ms", "a|b"}, {"pa", "WIDE1-1"}, {NULL, NULL} }, EXPECT_REJECT },
+    { "ack only", { {"sr", "n0call"}, {"to", "k1abc"}, {"id", "11"}, {"ms", "hi"}, {"pa", "WIDE1-1"}, {"ao", "1"}, {NULL, NULL} }, EXPECT_REJECT },
+    { "ack only escaped", { {"sr", "n0call"}, {"to", "k1abc"}, {"id", "12"}, {"ms", "a|b"}, {"pa", "WIDE1-1"}, {"ao", "1"}, {NULL, NULL} }, EXPECT_REJECT },
+    { "at limit", { {"sr", callsign.c_str()}, {"to", callsign.c_str()}, {"id", id.c_str()}, {"ms", ms.c_str()}, {"pa", "WIDE1-1"}, {NULL, NULL} }, EXPECT_SAME },
+    { "oversized sr", { {"sr", callsign_over.c_str()}, {"to", "k1abc"}, {"id", "13"}, {"ms", "hi"}, {"pa", "WIDE1-1"}, {NULL, NULL} }, EXPECT_TOOLONG },
+    { "oversized to", { {"sr", "n0call"}, {"to", callsign_over.c_str()}, {"id", "14"}, {"ms", "hi"}, {"pa", "WIDE1-1"}, {NULL, NULL} }, EXPECT_TOOLONG },
+    { "oversized id", { {"sr", "n0call"}, {"to", "k1abc"}, {"id", id_over.c_str()}, {"ms", "hi"}, {"pa", "WIDE1-1"}, {NULL, NULL} }, EXPECT_TOOLONG },
+    { "oversized ms", { {"sr", "n0call"}, {"to", "k1abc"}, {"id", "15"}, {"ms", ms_over.c_str()}, {"pa", "WIDE1-1"}, {NULL, NULL} }, EXPECT_TOOLONG },
+    { "oversized escaped", { {"sr", "n0call"}, {"to", "k1abc"}, {"id", "16"}, {"ms", ms_over_escaped.c_str()}, {"pa", "WIDE1-1"}, {NULL, NULL} }, EXPECT_TOOLONG },
+    // a long path is never copied, only its presence counts
+    { "oversized pa", { {"sr", "n0call"}, {"to", "k1abc"}, {"id", "17"}, {"ms", "hi"}, {"pa", ms_over.c_str()}, {NULL, NULL} }, EXPECT_SAME }
+  };
+
+  int failed = 0;
+  for(size_t i = 0; i < sizeof(cases) / sizeof(case_t); i++)
+    if (!check(cases[i].name, compile(cases[i].fields), cases[i].expect)) ++failed;
+
+  std::cout << "fields: " << sizeof(cases) / sizeof(case_t) - failed
+            << " of " << sizeof(cases) / sizeof(case_t) << " cases agree" << std::endl;
+  return failed;
+} // check_fields
+
+int main(int argc, char **argv) {
+  int num = argc > 1 ? atoi(argv[1]) : 1000000;
+
+  openframe::Vars v;
+  v.add("ct", openframe::stringify<int>( time(NULL) ) );
+  v.add("id", "38");
+  v.add("ms", "ESE TIENE TONO 100 EL DE LA ESTRADA");
+  v.add("pa", "APU25N,EA1URF-3,ED1YAX-3,EA1RCI-3*,WIDE3,qAR,EB1FJK-10");
+  v.add("rpl", "38");
+  v.add("sr", "ea1eol-10");
+  v.add("to", "ea1cc-9");
+  std::string body = v.compile();
+
+  v.add("ao", "1");
+  std::string ackonly = v.compile();
+
+  // both paths must agree before their speed means anything
+  if (check_fields() || !check("bench", body, EXPECT_SAME)) return 1;
+
+  std::cout << "body: " << body << std::endl
+            << "iterations: " << num << std::endl;
+
+  const std::string *inputs[] = { &body, &ackonly };
+  const char *names[] = { "message", "ack only" };
+  for(size_t i = 0; i < 2; i++) {
+    const std::string &in = *inputs[i];
+
+    double start = now();
+    size_t hits = 0;
+    for(int n = 0; n < num; n++) {
+      vars_message_t pm;
+      if (vars_parse(in, pm)) ++hits;
+    } // for
+    double vars_ns = (now() - start) * 1e9 / num;
+
+    start = now();
+    for(int n = 0; n < num; n++) {
+      apnspusher::notify_message_t nm;
+      if (apnspusher::NotifyParser::parse(in, nm) == apnspusher::NotifyParser::PARSE_OK) ++hits;
+    } // for
+    double parser_ns = (now() - start) * 1e9 / num;
+
+    std::cout << std::setw(9) << names[i] << ": Vars "
+              << std::fixed << std::setprecision(1) << vars_ns << " ns/op"
+              << ", NotifyParser " << parser_ns << " ns/op"
+              << ", speedup " << std::setprecision(2) << vars_ns / parser_ns << "x"
+              << " (" << hits << " accepted)"
+              << std::endl;
+  } // for
+
+  return 0;
+} // main
@@ -0,0 +1,137 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+
+#include <openframe/openframe.h>
+
+#include "RingQueue.h"
+
+// Compares the openframe::ThreadQueue APNS used for its push queue with
+// RingQueue, N producers against N consumers for N = 1 .. 32.
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+} // now
+
+static const size_t kBulk = 16;
+
+typedef openframe::ThreadQueue<long> thread_queue_t;
+typedef apnspusher::RingQueue<long> ring_queue_t;
+
+struct bench_t {
+  thread_queue_t *thread_q;
+  ring_queue_t *ring_q;
+  long per_producer;
+  long total;
+  long consumed;
+  long sum;
+}; // bench_t
+
+static void *thread_producer(void *arg) {
+  bench_t *b = static_cast<bench_t *>(arg);
+  for(long i = 1; i <= b->per_producer; i++) b->thread_q->enqueue(i);
+  return NULL;
+} // thread_producer
+
+static void *thread_consumer(void *arg) {
+  bench_t *b = static_cast<bench_t *>(arg);
+  long sum = 0;
+  while(__atomic_load_n(&b->consumed, __ATOMIC_RELAXED) < b->total) {
+    long item;
+    if (!b->thread_q->dequeue(item)) {
+      sched_yield();
+      continue;
+    } // if
+    sum += item;
+    __atomic_add_fetch(&b->consumed, 1, __ATOMIC_RELAXED);
+  } // while
+  __atomic_add_fetch(&b->sum, sum, __ATOMIC_RELAXED);
+  return NULL;
+} // thread_consumer
+
+static void *ring_producer(void *arg) {
+  bench_t *b = static_cast<bench_t *>(arg);
+  for(long i = 1; i <= b->per_producer; i++) {
+    while(!b->ring_q->enqueue(i)) sched_yield();
+  } // for
+  return NULL;
+} // ring_producer
+
+static void *ring_consumer(void *arg) {
+  bench_t *b = static_cast<bench_t *>(arg);
+  ring_queue_t::items_t items;
+  items.reserve(kBulk);
+  long sum = 0;
+  while(__atomic_load_n(&b->consumed, __ATOMIC_RELAXED) < b->total) {
+    items.clear();
+    size_t num = b->ring_q->dequeue(items, kBulk);
+    if (!num) {
+      sched_yield();
+      continue;
+    } // if
+    for(size_t i = 0; i < num; i++) sum += items[i];
+    __atomic_add_fetch(&b->consumed, long(num), __ATOMIC_RELAXED);
+  } // while
+  __atomic_add_fetch(&b->sum, sum, __ATOMIC_RELAXED);
+  return NULL;
+} // ring_consumer
+
+static double run(bench_t &b, const int threads, void *(*producer)(void *), void *(*consumer)(void *)) {
+  std::vector<pthread_t> tids(threads * 2);
+  b.consumed = 0;
+  b.sum = 0;
+
+  double start = now();
+  for(int i = 0; i < threads; i++) pthread_create(&tids[i], NULL, consumer, &b);
+  for(int i = 0; i < threads; i++) pthread_create(&tids[threads + i], NULL, producer, &b);
+  for(size_t i = 0; i < tids.size(); i++) pthread_join(tids[i], NULL);
+  double elapsed = now() - start;
+
+  // every item has to come out exactly once
+  long expect = threads * (b.per_producer * (b.per_producer + 1) / 2);
+  if (b.consumed != b.total || b.sum != expect) {
+    std::cerr << "lost or duplicated items at " << threads << " threads" << std::endl;
+    exit(1);
+  } // if
+
+  return b.total / elapsed;
+} // run
+
+int main(int argc, char **argv) {
+  long num = argc > 1 ? atol(argv[1]) : 2000000;
+  size_t capacity = argc > 2 ? atol(argv[2]) : 4096;
+
+  std::cout << "items: " << num
+            << ", ring capacity: " << capacity
+            << ", ring bulk dequeue: " << kBulk
+            << std::endl;
+
+  for(int threads = 1; threads <= 32; threads *= 2) {
+    thread_queue_t thread_q;
+    ring_queue_t ring_q(capacity);
+
+    bench_t b;
+    b.thread_q = &thread_q;
+    b.ring_q = &ring_q;
+    b.per_producer = num / threads;
+    b.total = b.per_producer * threads;
+
+    double thread_ops = run(b, threads, thread_producer, thread_consumer);
+    double ring_ops = run(b, threads, ring_producer, ring_consumer);
+
+    std::cout << std::setw(2) << threads << "x" << std::setw(2) << threads
+              << ": ThreadQueue " << std::fixed << std::setprecision(2) << thread_ops / 1e6 << " Mops/s"
+              << ", RingQueue " << ring_ops / 1e6 << " Mops/s"
+              << ", speedup " << ring_ops / thread_ops << "x"
+              << std::endl;
+  } // for
+
+  return 0;
+} // main